@@ -46,6 +46,15 @@ static conf_option_t conf_server_option[] =
 	{ string_make("blk_rep"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, blk_rep) },
 
+	{ string_make("rpc_depth"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, rpc_depth) },
+
+	{ string_make("rpc_timeout"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, rpc_timeout) },
+
+	{ string_make("rpc_retries"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, rpc_retries) },
+
     { string_null, NULL, OPE_EQUAL, 0 }    
 };
 
@@ -109,7 +118,11 @@ static void *conf_server_init(pool_t *pool)
 
 static int conf_server_make_default(void *var)
 {
-    conf_server_t *sconf = (conf_server_t *)var;
+    conf_server_t *sconf = (conf_server_t *)((conf_variable_t *)var)->conf;
+
+    set_def_int(sconf->rpc_depth, DEF_RPC_DEPTH);
+    set_def_int(sconf->rpc_timeout, DEF_RPC_TIMEOUT);
+    set_def_int(sconf->rpc_retries, DEF_RPC_RETRIES);
 	
     return DFS_OK;
 }
@@ -17,6 +17,9 @@ struct conf_server_s
     uint32_t send_buff_len;
 	uint64_t blk_sz;
 	short    blk_rep;
+	uint32_t rpc_depth;
+	uint32_t rpc_timeout;
+	uint32_t rpc_retries;
 };
 
 conf_object_t *get_dn_conf_object(void);
@@ -24,6 +27,9 @@ conf_object_t *get_dn_conf_object(void);
 #define DEF_RBUFF_LEN          64 * 1024
 #define DEF_SBUFF_LEN          64 * 1024
 #define DEF_MMAX_TQUEUE_LEN    1000
+#define DEF_RPC_DEPTH          16
+#define DEF_RPC_TIMEOUT        30000
+#define DEF_RPC_RETRIES        3
 
 #define set_def_string(key, value) do { \
     if (!(key)->len) { \
@@ -7,6 +7,8 @@
 
 static int dfs_open(rw_context_t *rw_ctx);
 static int dfs_read_blk(rw_context_t *rw_ctx);
+static int dfs_read_replica(rw_context_t *rw_ctx, int datafd, 
+	blk_loc_t *loc, int dn_index);
 static int do_recvfile_splice(int fromfd, int tofd, 
 	loff_t *offset, size_t count);
 
@@ -29,6 +31,8 @@ int dfscli_get(char *src, char *dst)
 	strcpy(rw_ctx->dst, dst);
 	rw_ctx->blk_sz = sconf->blk_sz;
 	rw_ctx->blk_rep = sconf->blk_rep;
+	rw_ctx->locs = NULL;
+	rw_ctx->blk_num = 0;
 	
 	if (dfs_open(rw_ctx) != DFS_OK) 
 	{
@@ -37,6 +41,9 @@ int dfscli_get(char *src, char *dst)
 
 	dfs_read_blk(rw_ctx);
 
+	free(rw_ctx->locs);
+	rw_ctx->locs = NULL;
+
 	//dfs_close(rw_ctx);
 
 	if (rw_ctx->nn_fd > 0) 
@@ -61,8 +68,8 @@ static int dfs_open(rw_context_t *rw_ctx)
 {
     conf_server_t     *sconf = NULL;
     server_bind_t     *nn_addr = NULL;
-	create_blk_info_t  blk_info;
-	create_resp_info_t resp_info;
+	open_range_info_t  range;
+	open_resp_head_t   head;
 
 	sconf = (conf_server_t *)dfs_cycle->sconf;
 	nn_addr = (server_bind_t *)sconf->namenode_addr.elts;
@@ -82,12 +89,11 @@ static int dfs_open(rw_context_t *rw_ctx)
 
 	out_t.permission = 755;
 
-	memset(&blk_info, 0x00, sizeof(create_blk_info_t));
-	blk_info.blk_sz = rw_ctx->blk_sz;
-	blk_info.blk_rep = rw_ctx->blk_rep;
+	// the whole file
+	memset(&range, 0x00, sizeof(open_range_info_t));
 
-	out_t.data_len = sizeof(create_blk_info_t);
-	out_t.data = &blk_info;
+	out_t.data_len = sizeof(open_range_info_t);
+	out_t.data = &range;
 
 	char sBuf[BUF_SZ] = "";
 	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
@@ -103,6 +109,7 @@ static int dfs_open(rw_context_t *rw_ctx)
 
 	int pLen = 0;
 	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
+	pLen = task_frame_size((char *)&pLen);
 	if (rLen < 0) 
 	{
 	    dfscli_log(DFS_LOG_WARN, "recv err, rLen: %d", rLen);
@@ -122,7 +129,8 @@ static int dfs_open(rw_context_t *rw_ctx)
         return DFS_ERROR;
 	}
 
-	rLen = read(sockfd, pNext, pLen);
+	// a file of many blocks does not come in one read
+	rLen = recv(sockfd, pNext, pLen, MSG_WAITALL);
 	if (rLen < 0) 
 	{
 	    dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
@@ -166,26 +174,54 @@ static int dfs_open(rw_context_t *rw_ctx)
 
         return DFS_ERROR;
 	}
-	else if (NULL != in_t.data && in_t.data_len > 0) 
+	else if (NULL != in_t.data 
+		&& in_t.data_len >= (int)sizeof(open_resp_head_t)) 
 	{
-        memset(&resp_info, 0x00, sizeof(create_resp_info_t));
-		memcpy(&resp_info, in_t.data, in_t.data_len);
+        memcpy(&head, in_t.data, sizeof(open_resp_head_t));
+
+		if ((uint64_t)in_t.data_len < sizeof(open_resp_head_t) 
+			+ (uint64_t)head.blk_num * sizeof(blk_loc_t)) 
+		{
+		    dfscli_log(DFS_LOG_WARN, "open err, short reply: %d", 
+				in_t.data_len);
+
+			close(sockfd);
+
+            return DFS_ERROR;
+		}
+
+		// an empty file has no blocks
+		rw_ctx->locs = (blk_loc_t *)malloc(head.blk_num * sizeof(blk_loc_t) 
+			+ 1);
+		if (!rw_ctx->locs) 
+		{
+		    dfscli_log(DFS_LOG_WARN, "malloc err, blk_num: %u", 
+				head.blk_num);
+
+			close(sockfd);
+
+            return DFS_ERROR;
+		}
+
+		memcpy(rw_ctx->locs, (char *)in_t.data + sizeof(open_resp_head_t), 
+			head.blk_num * sizeof(blk_loc_t));
 
 		rw_ctx->nn_fd = sockfd;
-		rw_ctx->blk_id = resp_info.blk_id;
-		rw_ctx->blk_sz = resp_info.blk_sz;
-		rw_ctx->namespace_id = resp_info.namespace_id;
-		rw_ctx->dn_num = resp_info.dn_num;
-		memcpy(rw_ctx->dn_ips, resp_info.dn_ips, sizeof(resp_info.dn_ips));
+		rw_ctx->blk_num = head.blk_num;
+		rw_ctx->fsize = head.length;
+		rw_ctx->namespace_id = head.namespace_id;
 	}
 	
     return DFS_OK;
 }
 
+// block after block into dst, each from the closest of its replicas 
+// that answers
 static int dfs_read_blk(rw_context_t *rw_ctx)
 {
-    int dn_index = 0;
-	int res = -1;
+    uint32_t   i = 0;
+	int        j = 0;
+	blk_loc_t *loc = NULL;
 
 	int datafd = open(rw_ctx->dst, O_RDWR | O_CREAT | O_TRUNC, 0666);
 	if (datafd < 0) 
@@ -196,37 +232,68 @@ static int dfs_read_blk(rw_context_t *rw_ctx)
         return DFS_ERROR;
 	}
 
-	int sockfd = dfs_connect(rw_ctx->dn_ips[dn_index], DN_PORT);
-	if (sockfd < 0) 
+	for (i = 0; i < rw_ctx->blk_num; i++) 
 	{
-		close(datafd);
-		unlink(rw_ctx->dst);
+	    loc = &rw_ctx->locs[i];
 		
-	    return DFS_ERROR;
+        for (j = 0; j < loc->dn_num; j++) 
+		{
+            if (dfs_read_replica(rw_ctx, datafd, loc, j) == DFS_OK) 
+			{
+                break;
+			}
+		}
+
+		if (j == loc->dn_num) 
+		{
+		    dfscli_log(DFS_LOG_WARN, "no replica of blk %lu could be read", 
+				loc->blk_id);
+			
+            close(datafd);
+			unlink(rw_ctx->dst);
+
+			return DFS_ERROR;
+		}
 	}
 
-	long fsize = rw_ctx->blk_sz;
+	dfscli_log(DFS_LOG_INFO, "get file %s to local %s succesfully.", 
+		rw_ctx->src, rw_ctx->dst);
+
+	close(datafd);
+
+	return DFS_OK;
+}
+
+// the block at loc from its dn_index'th replica, at its place in datafd
+static int dfs_read_replica(rw_context_t *rw_ctx, int datafd, 
+	blk_loc_t *loc, int dn_index)
+{
+	int    res = -1;
+	loff_t off = loc->offset;
+
+	int sockfd = dfs_connect(loc->dn_ips[dn_index], DN_PORT);
+	if (sockfd < 0) 
+	{
+	    return DFS_ERROR;
+	}
 
 	data_transfer_header_t header;
 	memset(&header, 0x00, sizeof(data_transfer_header_t));
 
 	header.op_type = OP_READ_BLOCK;
 	header.namespace_id = rw_ctx->namespace_id;
-	header.block_id = rw_ctx->blk_id;
+	header.block_id = loc->blk_id;
 	header.generation_stamp = 0;
 	header.start_offset = 0;
-	header.len = fsize;
+	header.len = loc->blk_sz;
 
 	res = send(sockfd, &header, sizeof(data_transfer_header_t), 0);
 	if (res < 0) 
 	{
 	    dfscli_log(DFS_LOG_WARN, "send header to %s err, %s", 
-			rw_ctx->dn_ips[dn_index], strerror(errno));
+			loc->dn_ips[dn_index], strerror(errno));
 
-		close(datafd);
 		close(sockfd);
-
-		unlink(rw_ctx->dst);
 		
 	    return DFS_ERROR;
 	}
@@ -237,22 +304,16 @@ static int dfs_read_blk(rw_context_t *rw_ctx)
 	if (res < 0 || (rsp.op_status != OP_STATUS_SUCCESS && rsp.err != DFS_OK)) 
 	{
 	    dfscli_log(DFS_LOG_WARN, "recv header rsp from %s err, %s", 
-			rw_ctx->dn_ips[dn_index], strerror(errno));
+			loc->dn_ips[dn_index], strerror(errno));
 
-		close(datafd);
 		close(sockfd);
-
-		unlink(rw_ctx->dst);
 		
 	    return DFS_ERROR;
 	}
 
-	if (do_recvfile_splice(sockfd, datafd, NULL, fsize) == DFS_ERROR) 
+	if (do_recvfile_splice(sockfd, datafd, &off, loc->blk_sz) == DFS_ERROR) 
 	{
-	    close(datafd);
 		close(sockfd);
-
-		unlink(rw_ctx->dst);
 		
 	    return DFS_ERROR;
 	}
@@ -262,20 +323,13 @@ static int dfs_read_blk(rw_context_t *rw_ctx)
 	if (res < 0 || (rsp.op_status != OP_STATUS_SUCCESS && rsp.err != DFS_OK)) 
 	{
 	    dfscli_log(DFS_LOG_WARN, "recv read done rsp from %s err, %s", 
-			rw_ctx->dn_ips[dn_index], strerror(errno));
+			loc->dn_ips[dn_index], strerror(errno));
 		
-        close(datafd);
 		close(sockfd);
-
-		unlink(rw_ctx->dst);
 		
 	    return DFS_ERROR;
 	}
 
-	dfscli_log(DFS_LOG_INFO, "get file %s to local %s succesfully.", 
-		rw_ctx->src, rw_ctx->dst);
-
-	close(datafd);
 	close(sockfd);
 
 	return DFS_OK;
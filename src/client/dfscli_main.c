@@ -18,6 +18,7 @@
 #include "dfscli_conf.h"
 #include "dfscli_put.h"
 #include "dfscli_get.h"
+#include "dfscli_rpc.h"
 
 #define INVALID_SYMBOLS_IN_PATH "\\:*?\"<>|"
 #define MY_LOG_RAW (1 << 10) // Modifier to log without timestamp
@@ -28,14 +29,16 @@ string_t config_file;
 
 static void log_raw(uint32_t level, const char *msg);
 static void help(int argc, char **argv);
-static int dfscli_mkdir(char *path);
-static int dfscli_rmr(char *path);
-static int dfscli_ls(char *path);
+static int dfscli_batch(cmd_t cmd, char **paths, int n, 
+	cli_rpc_done_pt done);
+static void mkdir_done(task_t *req, task_t *rsp, void *arg);
+static void rmr_done(task_t *req, task_t *rsp, void *arg);
+static void ls_done(task_t *req, task_t *rsp, void *arg);
+static void rm_done(task_t *req, task_t *rsp, void *arg);
 static int showDirsFiles(char *p, int len);
 static int getTimeStr(uint64_t msec, char *str, int len);
 static int isPathValid(char *path);
 static int getValidPath(char *src, char *dst);
-static int dfscli_rm(char *path);
 
 int dfscli_daemon()
 {
@@ -128,12 +131,12 @@ static void log_raw(uint32_t level, const char *msg)
 static void help(int argc, char **argv)
 {		    
     fprintf(stderr, "Usage: %s cmd...\n"
-		"\t -mkdir <path> \n"
-		"\t -rmr <path> \n"
-		"\t -ls <path> \n"
+		"\t -mkdir <path>... \n"
+		"\t -rmr <path>... \n"
+		"\t -ls <path>... \n"
 		"\t -put <local path> <remote path> \n"
 		"\t -get <remote path> <local path> \n"
-		"\t -rm <path> \n", 
+		"\t -rm <path>... \n", 
 		argv[0]);
 }
 
@@ -182,37 +185,15 @@ int main(int argc, char **argv)
 
 	if (0 == strncmp(cmd, "-mkdir", strlen("-mkdir"))) 
 	{
-	    if (!isPathValid(path)) 
-	    {
-		    dfscli_log(DFS_LOG_WARN, 
-				"path[%s] is invalid, these symbols[%s] can't use in the path", 
-				path, INVALID_SYMBOLS_IN_PATH);
-		
-		    goto out;
-	    }
-
-        char vPath[PATH_LEN] = {0};
-		getValidPath(path, vPath);
-
-        dfscli_mkdir(vPath);
+        ret = dfscli_batch(NN_MKDIR, argv + 2, argc - 2, mkdir_done);
 	}
 	else if (0 == strncmp(cmd, "-rmr", strlen("-rmr"))) 
 	{
-	    // check path's pattern
-	    
-	    char vPath[PATH_LEN] = {0};
-		getValidPath(path, vPath);
-		
-        dfscli_rmr(vPath);
+        ret = dfscli_batch(NN_RMR, argv + 2, argc - 2, rmr_done);
 	}
 	else if (0 == strncmp(cmd, "-ls", strlen("-ls")))
 	{
-	    // check path's pattern
-
-		char vPath[PATH_LEN] = {0};
-		getValidPath(path, vPath);
-		
-        dfscli_ls(vPath);
+        ret = dfscli_batch(NN_LS, argv + 2, argc - 2, ls_done);
 	}
 	else if (4 == argc && 0 == strncmp(cmd, "-put", strlen("-put"))) 
 	{
@@ -243,12 +224,7 @@ int main(int argc, char **argv)
 	}
 	else if (0 == strncmp(cmd, "-rm", strlen("-rm"))) 
 	{
-        // check path's pattern
-
-		char vPath[PATH_LEN] = {0};
-		getValidPath(path, vPath);
-		
-        dfscli_rm(vPath);
+        ret = dfscli_batch(NN_RM, argv + 2, argc - 2, rm_done);
 	}
 	else 
 	{
@@ -334,255 +310,6 @@ void getUserInfo(task_t *out_t)
 	strcpy(out_t->group, group->gr_name);
 }
 
-static int dfscli_mkdir(char *path)
-{
-    conf_server_t *sconf = NULL;
-    server_bind_t *nn_addr = NULL;
-
-	sconf = (conf_server_t *)dfs_cycle->sconf;
-	nn_addr = (server_bind_t *)sconf->namenode_addr.elts;
-	
-    int sockfd = dfs_connect((char *)nn_addr[0].addr.data, nn_addr[0].port);
-	if (sockfd < 0) 
-	{
-	    return DFS_ERROR;
-	}
-	
-	task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = NN_MKDIR;
-	keyEncode((uchar_t *)path, (uchar_t *)out_t.key);
-
-	getUserInfo(&out_t);
-
-	out_t.permission = 755;
-
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
-	}
-
-	char rBuf[BUF_SZ] = "";
-	int rLen = read(sockfd, rBuf, sizeof(rBuf));
-	if (rLen < 0) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
-	}
-	
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(rBuf, rLen, &in_t);
-
-    if (in_t.ret != DFS_OK) 
-	{
-	    if (in_t.ret == KEY_EXIST) 
-		{
-            dfscli_log(DFS_LOG_WARN, "mkdir err, path %s is exist.", path);
-		}
-		else if (in_t.ret == NOT_DIRECTORY) 
-		{
-            dfscli_log(DFS_LOG_WARN, 
-				"mkdir err, parent path is not a directory.");
-		} 
-		else if (in_t.ret == PERMISSION_DENY) 
-		{
-            dfscli_log(DFS_LOG_WARN, "mkdir err, permission deny.");
-		}
-		else 
-		{
-            dfscli_log(DFS_LOG_WARN, "mkdir err, ret: %d", in_t.ret);
-		}
-	}
-
-	close(sockfd);
-	
-    return DFS_OK;
-}
-
-static int dfscli_rmr(char *path)
-{
-    conf_server_t *sconf = NULL;
-    server_bind_t *nn_addr = NULL;
-
-	sconf = (conf_server_t *)dfs_cycle->sconf;
-	nn_addr = (server_bind_t *)sconf->namenode_addr.elts;
-	
-    int sockfd = dfs_connect((char *)nn_addr[0].addr.data, nn_addr[0].port);
-	if (sockfd < 0) 
-	{
-	    return DFS_ERROR;
-	}
-	
-	task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = NN_RMR;
-	keyEncode((uchar_t *)path, (uchar_t *)out_t.key);
-
-	getUserInfo(&out_t);
-
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
-	}
-
-	char rBuf[BUF_SZ] = "";
-	int rLen = read(sockfd, rBuf, sizeof(rBuf));
-	if (rLen < 0) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
-	}
-	
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(rBuf, rLen, &in_t);
-
-    if (in_t.ret != DFS_OK) 
-	{
-        if (in_t.ret == NOT_DIRECTORY) 
-		{
-            dfscli_log(DFS_LOG_WARN, 
-				"rmr err, the target is a file, you should use -rm instead.");
-		}
-		else if (in_t.ret == KEY_NOTEXIST) 
-		{
-            dfscli_log(DFS_LOG_WARN, "rmr err, path %s doesn't exist.", path);
-		}
-		else if (in_t.ret == PERMISSION_DENY) 
-		{
-            dfscli_log(DFS_LOG_WARN, "rmr err, permission deny.");
-		}
-		else 
-		{
-            dfscli_log(DFS_LOG_WARN, "rmr err, ret: %d", in_t.ret);
-		}
-	}
-
-	close(sockfd);
-	
-    return DFS_OK;
-}
-
-static int dfscli_ls(char *path)
-{
-    conf_server_t *sconf = NULL;
-    server_bind_t *nn_addr = NULL;
-
-	sconf = (conf_server_t *)dfs_cycle->sconf;
-	nn_addr = (server_bind_t *)sconf->namenode_addr.elts;
-	
-    int sockfd = dfs_connect((char *)nn_addr[0].addr.data, nn_addr[0].port);
-	if (sockfd < 0) 
-	{
-	    return DFS_ERROR;
-	}
-	
-	task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = NN_LS;
-	keyEncode((uchar_t *)path, (uchar_t *)out_t.key);
-
-	getUserInfo(&out_t);
-
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
-	}
-
-	int pLen = 0;
-	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
-	if (rLen < 0) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "recv err, rLen: %d", rLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
-	}
-
-	char *pNext = (char *)malloc(pLen);
-	if (NULL == pNext) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "malloc err, pLen: %d", pLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
-	}
-
-	rLen = read(sockfd, pNext, pLen);
-	if (rLen < 0) 
-	{
-	    dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
-		
-	    close(sockfd);
-
-		free(pNext);
-		pNext = NULL;
-		
-        return DFS_ERROR;
-	}
-
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(pNext, rLen, &in_t);
-
-    if (in_t.ret != DFS_OK) 
-	{
-		if (in_t.ret == KEY_NOTEXIST) 
-		{
-            dfscli_log(DFS_LOG_WARN, "ls err, path %s doesn't exist.", path);
-		}
-		else if (in_t.ret == PERMISSION_DENY) 
-		{
-            dfscli_log(DFS_LOG_WARN, "ls err, permission deny.");
-		}
-		else 
-		{
-            dfscli_log(DFS_LOG_WARN, "ls err, ret: %d", in_t.ret);
-		}
-	}
-	else if (NULL != in_t.data && in_t.data_len > 0) 
-	{
-        showDirsFiles((char *)in_t.data, in_t.data_len);
-	}
-
-	close(sockfd);
-
-	free(pNext);
-	pNext = NULL;
-	
-    return DFS_OK;
-}
-
 static int showDirsFiles(char *p, int len)
 {
     fi_inode_t fii;
@@ -697,77 +424,195 @@ static int getValidPath(char *src, char *dst)
     return DFS_OK;
 }
 
-static int dfscli_rm(char *path)
+// all paths go out pipelined on one connection, they are independent 
+// requests and may complete in any order
+static int dfscli_batch(cmd_t cmd, char **paths, int n, 
+	                       cli_rpc_done_pt done)
 {
-    conf_server_t *sconf = NULL;
-    server_bind_t *nn_addr = NULL;
+    int        i = 0;
+	int        rc = DFS_OK;
+	task_t    *reqs = NULL;
+	cli_rpc_t  rpc;
 
-	sconf = (conf_server_t *)dfs_cycle->sconf;
-	nn_addr = (server_bind_t *)sconf->namenode_addr.elts;
-	
-    int sockfd = dfs_connect((char *)nn_addr[0].addr.data, nn_addr[0].port);
-	if (sockfd < 0) 
+	reqs = (task_t *)calloc(n, sizeof(task_t));
+	if (!reqs) 
 	{
-	    return DFS_ERROR;
+	    dfscli_log(DFS_LOG_WARN, "calloc err, n: %d", n);
+		
+        return DFS_ERROR;
 	}
-	
-	task_t out_t;
-	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = NN_RM;
-	keyEncode((uchar_t *)path, (uchar_t *)out_t.key);
-
-	getUserInfo(&out_t);
 
-	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
-	int ws = write(sockfd, sBuf, sLen);
-	if (ws != sLen) 
+	for (i = 0; i < n; i++) 
 	{
-	    dfscli_log(DFS_LOG_WARN, "write err, ws: %d, sLen: %d", ws, sLen);
+	    char vPath[PATH_LEN] = {0};
+
+	    if (strlen(paths[i]) >= PATH_LEN) 
+		{
+            dfscli_log(DFS_LOG_WARN, "path's len is greater than %d", 
+				(int)PATH_LEN);
+
+			rc = DFS_ERROR;
+
+			goto out;
+		}
+
+		if (cmd == NN_MKDIR && !isPathValid(paths[i])) 
+	    {
+		    dfscli_log(DFS_LOG_WARN, 
+				"path[%s] is invalid, these symbols[%s] can't use in the path", 
+				paths[i], INVALID_SYMBOLS_IN_PATH);
+
+			rc = DFS_ERROR;
 		
-	    close(sockfd);
+		    goto out;
+	    }
+
+		getValidPath(paths[i], vPath);
 		
-        return DFS_ERROR;
+		reqs[i].cmd = cmd;
+		keyEncode((uchar_t *)vPath, (uchar_t *)reqs[i].key);
+		getUserInfo(&reqs[i]);
+
+		if (cmd == NN_MKDIR) 
+		{
+            reqs[i].permission = 755;
+		}
 	}
 
-	char rBuf[BUF_SZ] = "";
-	int rLen = read(sockfd, rBuf, sizeof(rBuf));
-	if (rLen < 0) 
+	if (cli_rpc_open(&rpc) != DFS_OK) 
 	{
-	    dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
-		
-	    close(sockfd);
-		
-        return DFS_ERROR;
+        rc = DFS_ERROR;
+
+		goto out;
 	}
+
+	rc = cli_rpc_call(&rpc, reqs, n, done, &n);
+
+	cli_rpc_close(&rpc);
+
+out:
+	free(reqs);
 	
-	task_t in_t;
-	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(rBuf, rLen, &in_t);
+    return rc;
+}
+
+static void mkdir_done(task_t *req, task_t *rsp, void *arg)
+{
+    uchar_t path[PATH_LEN] = "";
+
+	keyDecode((uchar_t *)req->key, path);
 
-    if (in_t.ret != DFS_OK) 
+    if (rsp->ret != DFS_OK) 
 	{
-        if (in_t.ret == NOT_FILE) 
+	    if (rsp->ret == KEY_EXIST) 
+		{
+            dfscli_log(DFS_LOG_WARN, "mkdir err, path %s is exist.", path);
+		}
+		else if (rsp->ret == NOT_DIRECTORY) 
 		{
             dfscli_log(DFS_LOG_WARN, 
-				"rm err, the target is a directory, you should use -rmr instead.");
+				"mkdir err, parent path of %s is not a directory.", path);
+		} 
+		else if (rsp->ret == PERMISSION_DENY) 
+		{
+            dfscli_log(DFS_LOG_WARN, "mkdir err, %s permission deny.", path);
 		}
-		else if (in_t.ret == KEY_NOTEXIST) 
+		else 
 		{
-            dfscli_log(DFS_LOG_WARN, "rm err, path %s doesn't exist.", path);
+            dfscli_log(DFS_LOG_WARN, "mkdir err, ret: %d", rsp->ret);
+		}
+	}
+}
+
+static void rmr_done(task_t *req, task_t *rsp, void *arg)
+{
+    uchar_t path[PATH_LEN] = "";
+
+	keyDecode((uchar_t *)req->key, path);
+
+    if (rsp->ret != DFS_OK) 
+	{
+        if (rsp->ret == NOT_DIRECTORY) 
+		{
+            dfscli_log(DFS_LOG_WARN, 
+				"rmr err, %s is a file, you should use -rm instead.", path);
+		}
+		else if (rsp->ret == KEY_NOTEXIST) 
+		{
+            dfscli_log(DFS_LOG_WARN, "rmr err, path %s doesn't exist.", path);
 		}
-		else if (in_t.ret == PERMISSION_DENY) 
+		else if (rsp->ret == PERMISSION_DENY) 
 		{
-            dfscli_log(DFS_LOG_WARN, "rm err, permission deny.");
+            dfscli_log(DFS_LOG_WARN, "rmr err, %s permission deny.", path);
 		}
 		else 
 		{
-            dfscli_log(DFS_LOG_WARN, "rm err, ret: %d", in_t.ret);
+            dfscli_log(DFS_LOG_WARN, "rmr err, ret: %d", rsp->ret);
 		}
 	}
+}
+
+static void ls_done(task_t *req, task_t *rsp, void *arg)
+{
+    uchar_t path[PATH_LEN] = "";
+
+	keyDecode((uchar_t *)req->key, path);
 
-	close(sockfd);
+    if (rsp->ret != DFS_OK) 
+	{
+		if (rsp->ret == KEY_NOTEXIST) 
+		{
+            dfscli_log(DFS_LOG_WARN, "ls err, path %s doesn't exist.", path);
+		}
+		else if (rsp->ret == PERMISSION_DENY) 
+		{
+            dfscli_log(DFS_LOG_WARN, "ls err, %s permission deny.", path);
+		}
+		else 
+		{
+            dfscli_log(DFS_LOG_WARN, "ls err, ret: %d", rsp->ret);
+		}
+
+		return;
+	}
+
+	if (*(int *)arg > 1) 
+	{
+        printf("%s:\n", path);
+	}
 	
-    return DFS_OK;
+	if (NULL != rsp->data && rsp->data_len > 0) 
+	{
+        showDirsFiles((char *)rsp->data, rsp->data_len);
+	}
+}
+
+static void rm_done(task_t *req, task_t *rsp, void *arg)
+{
+    uchar_t path[PATH_LEN] = "";
+
+	keyDecode((uchar_t *)req->key, path);
+
+    if (rsp->ret != DFS_OK) 
+	{
+        if (rsp->ret == NOT_FILE) 
+		{
+            dfscli_log(DFS_LOG_WARN, 
+				"rm err, %s is a directory, you should use -rmr instead.", 
+				path);
+		}
+		else if (rsp->ret == KEY_NOTEXIST) 
+		{
+            dfscli_log(DFS_LOG_WARN, "rm err, path %s doesn't exist.", path);
+		}
+		else if (rsp->ret == PERMISSION_DENY) 
+		{
+            dfscli_log(DFS_LOG_WARN, "rm err, %s permission deny.", path);
+		}
+		else 
+		{
+            dfscli_log(DFS_LOG_WARN, "rm err, ret: %d", rsp->ret);
+		}
+	}
 }
 
@@ -45,6 +45,8 @@ typedef struct rw_context_s
 	int       res[3];
 	uint64_t  fsize;
 	short     write_done_blk_rep;
+	blk_loc_t *locs;         // of the file opened, in file order
+	uint32_t  blk_num;
 } rw_context_t;
 
 int dfscli_daemon();
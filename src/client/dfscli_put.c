@@ -107,6 +107,7 @@ static int dfs_create(rw_context_t *rw_ctx)
 
 	int pLen = 0;
 	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
+	pLen = task_frame_size((char *)&pLen);
 	if (rLen < 0) 
 	{
 	    dfscli_log(DFS_LOG_WARN, "recv err, rLen: %d", rLen);
@@ -482,6 +483,7 @@ static int dfs_get_additional_blk(rw_context_t *rw_ctx)
 
 	int pLen = 0;
 	int rLen = recv(rw_ctx->nn_fd, &pLen, sizeof(int), MSG_PEEK);
+	pLen = task_frame_size((char *)&pLen);
 	if (rLen < 0) 
 	{
 	    dfscli_log(DFS_LOG_WARN, "recv err, rLen: %d", rLen);
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "dfscli_rpc.h"
+#include "dfscli_main.h"
+#include "dfscli_conf.h"
+#include "dfscli_cycle.h"
+
+static int cli_rpc_connect(cli_rpc_t *rpc);
+static int cli_rpc_replay(cli_rpc_t *rpc, task_t *reqs, char *answered,
+	int sent);
+static uint64_t cli_rpc_client_id(void);
+static int cli_rpc_post(cli_rpc_t *rpc, task_t *task);
+static int cli_rpc_write(int fd, char *buf, int len);
+static int cli_rpc_fill(cli_rpc_t *rpc, int need);
+
+int cli_rpc_open(cli_rpc_t *rpc)
+{
+    conf_server_t *sconf = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	memset(rpc, 0x00, sizeof(cli_rpc_t));
+
+	rpc->fd = -1;
+	rpc->depth = sconf->rpc_depth > 0 ? sconf->rpc_depth : 1;
+	rpc->timeout = sconf->rpc_timeout;
+	rpc->retries = sconf->rpc_retries;
+	rpc->seq = 1;
+	rpc->client_id = cli_rpc_client_id();
+	rpc->rsize = sconf->recv_buff_len > BUF_SZ
+		? sconf->recv_buff_len : BUF_SZ;
+	rpc->rbuf = (char *)malloc(rpc->rsize);
+	if (!rpc->rbuf)
+	{
+	    dfscli_log(DFS_LOG_WARN, "malloc err, size: %d", rpc->rsize);
+
+        return DFS_ERROR;
+	}
+
+	if (cli_rpc_connect(rpc) != DFS_OK)
+	{
+	    cli_rpc_close(rpc);
+
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
+static int cli_rpc_connect(cli_rpc_t *rpc)
+{
+    int             nodelay = 1;
+	struct timeval  tv;
+    conf_server_t  *sconf = NULL;
+    server_bind_t  *nn_addr = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+	nn_addr = (server_bind_t *)sconf->namenode_addr.elts;
+
+	rpc->fd = dfs_connect((char *)nn_addr[0].addr.data, nn_addr[0].port);
+	if (rpc->fd < 0)
+	{
+	    return DFS_ERROR;
+	}
+
+	// small requests back to back, don't let nagle hold them
+	setsockopt(rpc->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	// a namenode this slow gets the outstanding calls again on a new conn
+	if (rpc->timeout > 0)
+	{
+	    tv.tv_sec = rpc->timeout / 1000;
+		tv.tv_usec = (rpc->timeout % 1000) * 1000;
+		setsockopt(rpc->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	}
+
+	rpc->rpos = 0;
+	rpc->rlen = 0;
+
+	return DFS_OK;
+}
+
+void cli_rpc_close(cli_rpc_t *rpc)
+{
+    if (rpc->fd >= 0)
+	{
+        close(rpc->fd);
+		rpc->fd = -1;
+	}
+
+	if (rpc->rbuf)
+	{
+        free(rpc->rbuf);
+		rpc->rbuf = NULL;
+	}
+}
+
+int cli_rpc_send(cli_rpc_t *rpc, task_t *task)
+{
+	task->seq = rpc->seq++;
+	task->client_id = rpc->client_id;
+
+	return cli_rpc_post(rpc, task);
+}
+
+static int cli_rpc_post(cli_rpc_t *rpc, task_t *task)
+{
+    char sBuf[BUF_SZ] = "";
+
+	int sLen = task_encode2str(task, sBuf, sizeof(sBuf));
+	if (sLen <= 0)
+	{
+	    dfscli_log(DFS_LOG_WARN, "encode err, sLen: %d", sLen);
+
+		return DFS_ERROR;
+	}
+
+	return cli_rpc_write(rpc->fd, sBuf, sLen);
+}
+
+// the returned task's data points into the rpc buffer, it is valid until
+// the next cli_rpc_recv
+int cli_rpc_recv(cli_rpc_t *rpc, task_t *task)
+{
+    int   fLen = 0;
+	int   rc = 0;
+	char *nbuf = NULL;
+
+	if (rpc->rpos > 0)
+	{
+	    memmove(rpc->rbuf, rpc->rbuf + rpc->rpos, rpc->rlen - rpc->rpos);
+		rpc->rlen -= rpc->rpos;
+		rpc->rpos = 0;
+	}
+
+	if (cli_rpc_fill(rpc, TASK_FRAME_HDR_LEN) != DFS_OK)
+	{
+	    return DFS_ERROR;
+	}
+
+	fLen = task_frame_size(rpc->rbuf);
+	if (fLen <= TASK_FRAME_HDR_LEN)
+	{
+	    dfscli_log(DFS_LOG_WARN, "bad frame, len: %d", fLen);
+
+        return DFS_ERROR;
+	}
+
+	if (fLen > rpc->rsize)
+	{
+        nbuf = (char *)realloc(rpc->rbuf, fLen);
+		if (!nbuf)
+		{
+		    dfscli_log(DFS_LOG_WARN, "realloc err, size: %d", fLen);
+
+            return DFS_ERROR;
+		}
+
+		rpc->rbuf = nbuf;
+		rpc->rsize = fLen;
+	}
+
+	if (cli_rpc_fill(rpc, fLen) != DFS_OK)
+	{
+	    return DFS_ERROR;
+	}
+
+	memset(task, 0x00, sizeof(task_t));
+
+	rc = task_decodefstr(rpc->rbuf, fLen, task);
+	if (rc < 0)
+	{
+	    dfscli_log(DFS_LOG_WARN, "decode err, rc: %d", rc);
+
+        return DFS_ERROR;
+	}
+
+	rpc->rpos = fLen;
+
+	return DFS_OK;
+}
+
+// keeps up to depth of reqs in flight and hands every reply to done along
+// with the request it answers, whatever order they complete in. a request
+// the namenode turned away as busy is sent again after the retry_after 
+// it asked for. when the conn fails or times out every unanswered request
+// is replayed on a new one, with the seq it had
+int cli_rpc_call(cli_rpc_t *rpc, task_t *reqs, int n,
+	                cli_rpc_done_pt done, void *arg)
+{
+    int      sent = 0;
+	int      recvd = 0;
+	int      tries = 0;
+	int      rc = DFS_ERROR;
+	uint32_t base = rpc->seq;
+	uint32_t idx = 0;
+	int      wait = 0;
+	char    *answered = NULL;
+	task_t   rsp;
+
+	answered = (char *)calloc(n > 0 ? n : 1, sizeof(char));
+	if (!answered)
+	{
+        return DFS_ERROR;
+	}
+
+	while (recvd < n)
+	{
+	    while (sent < n && sent - recvd < rpc->depth)
+		{
+            // the seq is taken even if the send fails, a replay sends it
+            if (cli_rpc_send(rpc, &reqs[sent++]) != DFS_OK)
+			{
+                goto replay;
+			}
+		}
+
+		if (cli_rpc_recv(rpc, &rsp) != DFS_OK)
+		{
+            goto replay;
+		}
+
+		idx = rsp.seq - base;
+		if (idx >= (uint32_t)sent)
+		{
+		    dfscli_log(DFS_LOG_WARN, "unexpected reply, seq: %u", rsp.seq);
+
+            goto out;
+		}
+
+		if (answered[idx])
+		{
+            continue;
+		}
+
+		if (rsp.ret == RETRY_LATER)
+		{
+		    wait = rsp.data && rsp.data_len >= (int)sizeof(retry_info_t)
+				? ((retry_info_t *)rsp.data)->retry_after : 0;
+			usleep((wait > 0 ? wait : 1) * 1000);
+
+			if (cli_rpc_post(rpc, &reqs[idx]) != DFS_OK)
+			{
+                goto replay;
+			}
+
+			continue;
+		}
+
+		answered[idx] = 1;
+
+		if (done)
+		{
+            done(&reqs[idx], &rsp, arg);
+		}
+
+		recvd++;
+
+		continue;
+
+replay:
+		if (tries++ >= rpc->retries 
+			|| cli_rpc_replay(rpc, reqs, answered, sent) != DFS_OK)
+		{
+            goto out;
+		}
+	}
+
+	rc = DFS_OK;
+
+out:
+	free(answered);
+
+	return rc;
+}
+
+static int cli_rpc_replay(cli_rpc_t *rpc, task_t *reqs, char *answered, 
+	                            int sent)
+{
+    int i = 0;
+
+	dfscli_log(DFS_LOG_WARN, "namenode conn lost, replaying %d calls", 
+		sent);
+
+	if (rpc->fd >= 0)
+	{
+        close(rpc->fd);
+		rpc->fd = -1;
+	}
+
+	if (cli_rpc_connect(rpc) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < sent; i++)
+	{
+	    if (!answered[i] && cli_rpc_post(rpc, &reqs[i]) != DFS_OK)
+		{
+            return DFS_ERROR;
+		}
+	}
+
+	return DFS_OK;
+}
+
+// names this client to the namenode retry cache
+static uint64_t cli_rpc_client_id(void)
+{
+    int            fd = -1;
+	uint64_t       id = 0;
+	struct timeval tv;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0)
+	{
+	    if (read(fd, &id, sizeof(id)) != (ssize_t)sizeof(id))
+		{
+            id = 0;
+		}
+
+		close(fd);
+	}
+
+	if (!id)
+	{
+	    gettimeofday(&tv, NULL);
+		id = ((uint64_t)getpid() << 40) ^ ((uint64_t)tv.tv_sec << 20) 
+			^ tv.tv_usec;
+	}
+
+	return id ? id : 1;
+}
+
+static int cli_rpc_write(int fd, char *buf, int len)
+{
+    int ws = 0;
+
+	while (len > 0)
+	{
+	    ws = write(fd, buf, len);
+		if (ws < 0)
+		{
+		    if (errno == EINTR)
+			{
+                continue;
+			}
+
+		    dfscli_log(DFS_LOG_WARN, "write err: %s", strerror(errno));
+
+            return DFS_ERROR;
+		}
+
+		buf += ws;
+		len -= ws;
+	}
+
+	return DFS_OK;
+}
+
+static int cli_rpc_fill(cli_rpc_t *rpc, int need)
+{
+    int rLen = 0;
+
+	while (rpc->rlen < need)
+	{
+	    rLen = read(rpc->fd, rpc->rbuf + rpc->rlen, rpc->rsize - rpc->rlen);
+		if (rLen < 0 && errno == EINTR)
+		{
+            continue;
+		}
+
+		if (rLen <= 0)
+		{
+		    dfscli_log(DFS_LOG_WARN, "read err, rLen: %d", rLen);
+
+            return DFS_ERROR;
+		}
+
+		rpc->rlen += rLen;
+	}
+
+	return DFS_OK;
+}
+
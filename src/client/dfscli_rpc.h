@@ -0,0 +1,33 @@
+#ifndef DFS_CLI_RPC_H
+#define DFS_CLI_RPC_H
+
+#include "dfs_types.h"
+#include "dfs_task.h"
+
+// up to depth requests are outstanding on one namenode connection, a
+// reply carries the seq of its request and may come back in any order
+typedef void (*cli_rpc_done_pt)(task_t *req, task_t *rsp, void *arg);
+
+typedef struct cli_rpc_s
+{
+    int       fd;
+	int       depth;
+	int       timeout;
+	int       retries;
+	uint32_t  seq;
+	uint64_t  client_id;   // the namenode answers a replayed seq from cache
+	char     *rbuf;
+	int       rsize;
+	int       rpos;
+	int       rlen;
+} cli_rpc_t;
+
+int cli_rpc_open(cli_rpc_t *rpc);
+void cli_rpc_close(cli_rpc_t *rpc);
+int cli_rpc_send(cli_rpc_t *rpc, task_t *task);
+int cli_rpc_recv(cli_rpc_t *rpc, task_t *task);
+int cli_rpc_call(cli_rpc_t *rpc, task_t *reqs, int n,
+	cli_rpc_done_pt done, void *arg);
+
+#endif
+
@@ -4,6 +4,56 @@
 
 #include "dfs_task.h"
 
+/*
+ * v1 frame, all integers are little-endian or varints:
+ *
+ *   uint32 frame_len | uint8 TASK_V1_MAGIC | uint8 flags 
+ *   | varint cmd | zigzag ret | varint seq | [varint client_id]
+ *   | [varint call_id]
+ *   | [zigzag master_nodeid] | [varint len, key] | [varint len, user] 
+ *   | [varint len, group] | [varint permission] | [varint len, data]
+ *
+ * optional fields are present only when their flag is set, i.e. when 
+ * they are not zero or empty.
+ */
+#define TASK_V1_MAGIC 0xD1
+
+#define TASK_F_NODEID     0x01
+#define TASK_F_KEY        0x02
+#define TASK_F_USER       0x04
+#define TASK_F_GROUP      0x08
+#define TASK_F_PERMISSION 0x10
+#define TASK_F_DATA       0x20
+#define TASK_F_CLIENT     0x40
+#define TASK_F_CALL       0x80
+
+#define VARINT_MAX_LEN 10
+
+// layout of task_t as written by nodes before the v1 frame
+typedef struct task_legacy_s
+{
+	cmd_t     cmd;
+	int       ret;
+	uint32_t  seq;
+	void     *opq;
+	int       master_nodeid;
+	char      key[KEY_LEN];
+	char      user[OWNER_LEN];
+	char      group[GROUP_LEN];
+	short     permission;
+	int       data_len; 
+	void     *data;
+} task_legacy_t;
+
+static int task_encode_legacy(task_t *task, char *buff, int len, int copy);
+static int task_decode_legacy(char *buff, int len, task_t *task);
+static int task_encode_v1(task_t *task, char *buff, int len, int copy);
+static int task_decode_v1(char *buff, int len, task_t *task);
+static int varint_size(uint64_t v);
+static int varint_put(uint8_t *p, uint64_t v);
+static int varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v);
+static void frame_len_put(char *buff, int len);
+
 task_t * task_new()
 {
 	task_t* t = (task_t *)malloc(sizeof(task_t));
@@ -32,27 +82,343 @@ void task_clear(task_t* task)
 }
 
 int task_encode2str(task_t *task, char *buff, int len)
+{
+    if (task->wire_ver == TASK_WIRE_LEGACY) 
+	{
+        return task_encode_legacy(task, buff, len, 1);
+	}
+
+	return task_encode_v1(task, buff, len, 1);
+}
+
+// the frame without the trailing data bytes, the caller sends task->data 
+// right after it, returns the header length
+int task_encode2hdr(task_t *task, char *buff, int len)
+{
+    if (task->wire_ver == TASK_WIRE_LEGACY) 
+	{
+        return task_encode_legacy(task, buff, len, 0);
+	}
+
+	return task_encode_v1(task, buff, len, 0);
+}
+
+int task_decodefstr(char *buff, int len, task_t *task)
+{
+    if (len < TASK_FRAME_HDR_LEN + 1) 
+	{
+        return TASK_EAGIN;
+	}
+
+	if ((uint8_t)buff[TASK_FRAME_HDR_LEN] == TASK_V1_MAGIC) 
+	{
+        return task_decode_v1(buff, len, task);
+	}
+
+	// the first byte of a legacy frame is the low byte of cmd
+	return task_decode_legacy(buff, len, task);
+}
+
+int task_frame_size(const char *buff)
+{
+    const uint8_t *p = (const uint8_t *)buff;
+
+	return (int)((uint32_t)p[0] | (uint32_t)p[1] << 8 
+		| (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static int task_encode_v1(task_t *task, char *buff, int len, int copy)
+{
+	int      need_size = 0;
+	int      klen = 0;
+	int      ulen = 0;
+	int      glen = 0;
+	uint8_t  flags = 0;
+	uint8_t *p = NULL;
+
+	klen = strnlen(task->key, KEY_LEN);
+	ulen = strnlen(task->user, OWNER_LEN);
+	glen = strnlen(task->group, GROUP_LEN);
+
+	need_size = TASK_FRAME_HDR_LEN + 2 + varint_size(task->cmd) 
+		+ varint_size(((uint32_t)task->ret << 1) ^ (task->ret >> 31)) 
+		+ varint_size(task->seq);
+
+	if (task->client_id != 0) 
+	{
+	    flags |= TASK_F_CLIENT;
+		need_size += varint_size(task->client_id);
+	}
+
+	if (task->call_id != 0) 
+	{
+	    flags |= TASK_F_CALL;
+		need_size += varint_size(task->call_id);
+	}
+
+	if (task->master_nodeid != 0) 
+	{
+	    flags |= TASK_F_NODEID;
+		need_size += varint_size(((uint32_t)task->master_nodeid << 1) 
+			^ (task->master_nodeid >> 31));
+	}
+
+	if (klen > 0) 
+	{
+	    flags |= TASK_F_KEY;
+		need_size += varint_size(klen) + klen;
+	}
+
+	if (ulen > 0) 
+	{
+	    flags |= TASK_F_USER;
+		need_size += varint_size(ulen) + ulen;
+	}
+
+	if (glen > 0) 
+	{
+	    flags |= TASK_F_GROUP;
+		need_size += varint_size(glen) + glen;
+	}
+
+	if (task->permission != 0) 
+	{
+	    flags |= TASK_F_PERMISSION;
+		need_size += varint_size((uint16_t)task->permission);
+	}
+
+	if (task->data_len > 0) 
+	{
+	    flags |= TASK_F_DATA;
+		need_size += varint_size(task->data_len) + task->data_len;
+	}
+
+	if (len < need_size - (copy ? 0 : task->data_len)) 
+	{
+        return TASK_EAGIN;
+	}
+
+	frame_len_put(buff, need_size);
+
+	p = (uint8_t *)buff + TASK_FRAME_HDR_LEN;
+	*p++ = TASK_V1_MAGIC;
+	*p++ = flags;
+	p += varint_put(p, task->cmd);
+	p += varint_put(p, ((uint32_t)task->ret << 1) ^ (task->ret >> 31));
+	p += varint_put(p, task->seq);
+
+	if (flags & TASK_F_CLIENT) 
+	{
+		p += varint_put(p, task->client_id);
+	}
+
+	if (flags & TASK_F_CALL) 
+	{
+		p += varint_put(p, task->call_id);
+	}
+
+	if (flags & TASK_F_NODEID) 
+	{
+		p += varint_put(p, ((uint32_t)task->master_nodeid << 1) 
+			^ (task->master_nodeid >> 31));
+	}
+
+	if (flags & TASK_F_KEY) 
+	{
+	    p += varint_put(p, klen);
+		memcpy(p, task->key, klen);
+		p += klen;
+	}
+
+	if (flags & TASK_F_USER) 
+	{
+	    p += varint_put(p, ulen);
+		memcpy(p, task->user, ulen);
+		p += ulen;
+	}
+
+	if (flags & TASK_F_GROUP) 
+	{
+	    p += varint_put(p, glen);
+		memcpy(p, task->group, glen);
+		p += glen;
+	}
+
+	if (flags & TASK_F_PERMISSION) 
+	{
+	    p += varint_put(p, (uint16_t)task->permission);
+	}
+
+	if (flags & TASK_F_DATA) 
+	{
+	    p += varint_put(p, task->data_len);
+
+		if (!copy) 
+		{
+		    return (char *)p - buff;
+		}
+
+		memcpy(p, task->data, task->data_len);
+	}
+
+	return need_size;
+}
+
+static int task_decode_v1(char *buff, int len, task_t *task)
+{
+    int            need_size = task_frame_size(buff);
+	int            n = 0;
+	uint8_t        flags = 0;
+	uint64_t       v = 0;
+	const uint8_t *p = NULL;
+	const uint8_t *end = NULL;
+
+	if (need_size < TASK_FRAME_HDR_LEN + 2) 
+	{
+        return TASK_ERROR;
+	}
+
+	if (len < need_size) 
+	{
+        return TASK_EAGIN;
+	}
+
+	p = (const uint8_t *)buff + TASK_FRAME_HDR_LEN + 1;
+	end = (const uint8_t *)buff + need_size;
+	flags = *p++;
+
+#define TASK_GET_VARINT() do { \
+    n = varint_get(p, end, &v); \
+    if (n <= 0) { \
+        return TASK_ERROR; \
+    } \
+    p += n; \
+} while (0)
+
+#define TASK_GET_STRING(dst, max) do { \
+    TASK_GET_VARINT(); \
+    if (v >= (max) || v > (uint64_t)(end - p)) { \
+        return TASK_ERROR; \
+    } \
+    memcpy((dst), p, v); \
+    (dst)[v] = '\0'; \
+    p += v; \
+} while (0)
+
+	TASK_GET_VARINT();
+	task->cmd = (cmd_t)v;
+	TASK_GET_VARINT();
+	task->ret = (int)((uint32_t)v >> 1) ^ -(int)(v & 1);
+	TASK_GET_VARINT();
+	task->seq = (uint32_t)v;
+
+	task->client_id = 0;
+	task->call_id = 0;
+	task->master_nodeid = 0;
+	task->key[0] = '\0';
+	task->user[0] = '\0';
+	task->group[0] = '\0';
+	task->permission = 0;
+	task->data_len = 0;
+	task->data = NULL;
+	task->wire_ver = TASK_WIRE_V1;
+
+	if (flags & TASK_F_CLIENT) 
+	{
+	    TASK_GET_VARINT();
+		task->client_id = v;
+	}
+
+	if (flags & TASK_F_CALL) 
+	{
+	    TASK_GET_VARINT();
+		task->call_id = (uint32_t)v;
+	}
+
+	if (flags & TASK_F_NODEID) 
+	{
+	    TASK_GET_VARINT();
+		task->master_nodeid = (int)((uint32_t)v >> 1) ^ -(int)(v & 1);
+	}
+
+	if (flags & TASK_F_KEY) 
+	{
+	    TASK_GET_STRING(task->key, KEY_LEN);
+	}
+
+	if (flags & TASK_F_USER) 
+	{
+	    TASK_GET_STRING(task->user, OWNER_LEN);
+	}
+
+	if (flags & TASK_F_GROUP) 
+	{
+	    TASK_GET_STRING(task->group, GROUP_LEN);
+	}
+
+	if (flags & TASK_F_PERMISSION) 
+	{
+	    TASK_GET_VARINT();
+		task->permission = (short)v;
+	}
+
+	if (flags & TASK_F_DATA) 
+	{
+	    TASK_GET_VARINT();
+		if (v > (uint64_t)(end - p)) 
+		{
+            return TASK_ERROR;
+		}
+
+		task->data_len = (int)v;
+		task->data = (void *)p;
+	}
+
+#undef TASK_GET_VARINT
+#undef TASK_GET_STRING
+
+	return need_size;
+}
+
+static int task_encode_legacy(task_t *task, char *buff, int len, int copy)
 {
 	int need_size = 0;
     int pkg_size = (int)sizeof(int);
-    int task_size = sizeof(task_t);
+    int task_size = sizeof(task_legacy_t);
     int data_size = (int)sizeof(int);
+	task_legacy_t lt;
 
     need_size = pkg_size + task_size + data_size + task->data_len;
-    if (len < need_size)
+    if (len < need_size - (copy ? 0 : task->data_len))
     {
         return TASK_EAGIN;
     }
 
+	memset(&lt, 0x00, sizeof(task_legacy_t));
+	lt.cmd = task->cmd;
+	lt.ret = task->ret;
+	lt.seq = task->seq;
+	lt.master_nodeid = task->master_nodeid;
+	memcpy(lt.key, task->key, KEY_LEN);
+	memcpy(lt.user, task->user, OWNER_LEN);
+	memcpy(lt.group, task->group, GROUP_LEN);
+	lt.permission = task->permission;
+	lt.data_len = task->data_len;
+
     *(int *)buff = need_size;
     buff += pkg_size;
 
-    memcpy(buff, task, task_size);
+    memcpy(buff, &lt, task_size);
     buff += task_size;
 
     *(int *)buff = task->data_len;
     buff += data_size;
 
+    if (!copy) 
+    {
+        return pkg_size + task_size + data_size;
+    }
+
     if (task->data_len > 0) 
     {
         memcpy(buff, task->data, task->data_len);
@@ -61,13 +427,18 @@ int task_encode2str(task_t *task, char *buff, int len)
     return need_size;
 }
 
-int task_decodefstr(char *buff, int len, task_t *task)
+static int task_decode_legacy(char *buff, int len, task_t *task)
 {
-    void *data = task->opq;
     int need_size = *(int *)buff;
     int pkg_size = (int)sizeof(int);
-    int task_size = sizeof(task_t);
+    int task_size = sizeof(task_legacy_t);
     int data_size = (int)sizeof(int);
+	task_legacy_t *lt = NULL;
+
+	if (need_size < pkg_size + task_size + data_size) 
+	{
+        return TASK_ERROR;
+	}
 
     if (len < need_size)
     {
@@ -76,19 +447,88 @@ int task_decodefstr(char *buff, int len, task_t *task)
 
     buff += pkg_size;
 
-    memcpy(task, buff, task_size);
+	lt = (task_legacy_t *)buff;
+	task->cmd = lt->cmd;
+	task->ret = lt->ret;
+	task->seq = lt->seq;
+	task->client_id = 0;
+	task->call_id = 0;
+	task->master_nodeid = lt->master_nodeid;
+	memcpy(task->key, lt->key, KEY_LEN);
+	memcpy(task->user, lt->user, OWNER_LEN);
+	memcpy(task->group, lt->group, GROUP_LEN);
+	task->permission = lt->permission;
+	task->wire_ver = TASK_WIRE_LEGACY;
     buff += task_size;
 
     int data_len = *(int *)buff;
     buff += data_size;
 
-    if (data_len > 0)
-    {
-        task->data = buff;
-    }
-
-	task->opq = data;
+	task->data_len = data_len;
+	task->data = data_len > 0 ? buff : NULL;
 
     return need_size;
 }
 
+static int varint_size(uint64_t v)
+{
+    int n = 1;
+
+	while (v >= 0x80) 
+	{
+	    v >>= 7;
+		n++;
+	}
+
+	return n;
+}
+
+static int varint_put(uint8_t *p, uint64_t v)
+{
+    int n = 0;
+
+	while (v >= 0x80) 
+	{
+	    p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+
+	p[n++] = (uint8_t)v;
+
+	return n;
+}
+
+static int varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    int      n = 0;
+	int      shift = 0;
+	uint64_t r = 0;
+
+	while (p + n < end && n < VARINT_MAX_LEN) 
+	{
+	    uint8_t b = p[n++];
+		
+		r |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) 
+		{
+		    *v = r;
+			
+		    return n;
+		}
+
+		shift += 7;
+	}
+
+	return -1;
+}
+
+static void frame_len_put(char *buff, int len)
+{
+    uint8_t *p = (uint8_t *)buff;
+
+	p[0] = (uint8_t)len;
+	p[1] = (uint8_t)(len >> 8);
+	p[2] = (uint8_t)(len >> 16);
+	p[3] = (uint8_t)(len >> 24);
+}
+
@@ -14,11 +14,20 @@
 #define OWNER_LEN 16
 #define GROUP_LEN 16
 
+// wire format of a task, the decoder accepts both and records which one 
+// it saw so a reply goes back in the format of the request
+#define TASK_WIRE_V1     0
+#define TASK_WIRE_LEGACY 1
+
+#define TASK_FRAME_HDR_LEN 4
+
 typedef struct task_s
 {
 	cmd_t     cmd;
 	int       ret;
-	uint32_t  seq;
+	uint32_t  seq;           // echoed back, matches pipelined replies
+	uint64_t  client_id;     // with seq names a call across retries, 0 none
+	uint32_t  call_id;       // the client's seq of a forwarded call, else 0
 	void     *opq;
 	int       master_nodeid;
 	char      key[KEY_LEN];
@@ -27,13 +36,16 @@ typedef struct task_s
 	short     permission;
 	int       data_len; 
 	void     *data;
+	uint8_t   wire_ver;
 } task_t;
 
 task_t * task_new();
 void task_free(task_t* task);
 void task_clear(task_t* task);
 int task_encode2str(task_t *task, char *buff, int len);
+int task_encode2hdr(task_t *task, char *buff, int len);
 int task_decodefstr(char *buff, int len, task_t *task);
+int task_frame_size(const char *buff);
 
 #endif
 
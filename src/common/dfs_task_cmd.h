@@ -8,6 +8,7 @@
 #define OP_COPY_BLOCK              84
 #define OP_BLOCK_CHECKSUM          85
 #define OP_READ_BLOCK_ACCELERATOR  86
+#define OP_DELETE_BLOCK            87
   
 #define OP_STATUS_SUCCESS          0
 #define OP_STATUS_ERROR            1  
@@ -31,7 +32,8 @@ typedef enum
     DN_HEARTBEAT,
     DN_RECV_BLK_REPORT,
     DN_DEL_BLK_REPORT,
-    DN_BLK_REPORT
+    DN_BLK_REPORT,
+    DN_CMD_WAIT
 } cmd_t;
 
 typedef enum
@@ -49,7 +51,8 @@ typedef enum
     NOT_DIRECTORY = -20,
     NOT_FILE = -21,
     IN_SAFE_MODE = -4,
-    NOT_DATANODE
+    NOT_DATANODE,
+    RETRY_LATER = -11
 } opt_err;
 
 typedef enum
@@ -75,6 +78,122 @@ typedef struct create_resp_info_s
 	char     dn_ips[3][32];
 } create_resp_info_t;
 
+// data of an NN_OPEN, the bytes of the file wanted, len 0 for up to its 
+// end
+typedef struct open_range_info_s
+{
+    uint64_t offset;
+	uint64_t len;
+} open_range_info_t;
+
+// replicas named for a block, the closest to the reader first
+#define BLK_LOC_DN_MAX 8
+
+// the data of an NN_OPEN reply is this head then blk_num blk_loc_t, the 
+// blocks covering the range in file order
+typedef struct open_resp_head_s
+{
+    uint64_t namespace_id;
+	uint64_t length;      // of the whole file
+	uint32_t blk_num;
+	uint32_t pad;
+} open_resp_head_t;
+
+typedef struct blk_loc_s
+{
+    uint64_t blk_id;
+	uint64_t blk_sz;
+	uint64_t offset;      // of the block in the file
+	short    dn_num;      // 0 when no live datanode has it
+	short    pad[3];
+	char     dn_ips[BLK_LOC_DN_MAX][32];
+} blk_loc_t;
+
+// data of a RETRY_LATER reply
+typedef struct retry_info_s
+{
+    int retry_after; // msec
+} retry_info_t;
+
+// heartbeat_info_t.cmd_ver of a datanode that reads dn_cmd_t replies
+#define DN_CMD_VER 1
+
+// data of a DN_HEARTBEAT, what the namenode places blocks by
+typedef struct heartbeat_info_s
+{
+    uint64_t capacity;
+	uint64_t dfs_used;
+	uint64_t remaining;
+	int      active_conn;
+	uint32_t del_pending; // deletions handed out, not done yet
+	uint32_t cmd_ver;     // DN_CMD_VER
+	uint32_t pad;
+} heartbeat_info_t;
+
+// the data of a DN_HEARTBEAT reply is a list of these, a DN_CMD_WAIT 
+// reply has them after its head. a datanode without cmd_ver gets the 
+// ids of the blocks to delete, as uint64_t
+typedef struct dn_cmd_s
+{
+    int      op;          // OP_DELETE_BLOCK or OP_COPY_BLOCK
+	int      rate;        // OP_COPY_BLOCK, KB/s it is held to, 0 no limit
+	uint64_t blk_id;
+	char     target[32];  // OP_COPY_BLOCK, the datanode to copy it to
+} dn_cmd_t;
+
+// data of a DN_CMD_WAIT, a datanode waiting on its command channel until 
+// the namenode has work for it. ack is the seq of the batch it got last, 
+// one it did not get is sent again
+typedef struct cmd_wait_info_s
+{
+    uint32_t ack;
+	uint32_t del_pending; // as in heartbeat_info_t
+} cmd_wait_info_t;
+
+// the data of a DN_CMD_WAIT reply is this head then num dn_cmd_t, none 
+// when the wait ran out
+typedef struct cmd_batch_head_s
+{
+    uint32_t seq;
+	uint32_t num;
+} cmd_batch_head_t;
+
+// entries one DN_BLK_REPORT frame carries, it has to fit the namenode's 
+// receive buffer
+#define BLK_REPORT_MAX 4000
+
+// a full block report is a run of DN_BLK_REPORT tasks, the data of each is 
+// this head then num entries, ids ascending over the whole run
+typedef struct blk_report_head_s
+{
+    uint64_t report_id;
+	uint32_t seq;       // of the frame in the run, from 0
+	uint32_t num;
+	uint32_t last;
+	uint32_t pad;
+} blk_report_head_t;
+
+typedef struct blk_report_entry_s
+{
+    uint64_t id;
+	uint64_t size;
+} blk_report_entry_t;
+
+#define BLK_RECEIVED 0
+#define BLK_DELETED  1
+
+// entries one DN_RECV_BLK_REPORT carries, what a datanode stored or 
+// dropped since its last one
+#define BLK_RECV_REPORT_MAX 2000
+
+typedef struct blk_recv_entry_s
+{
+    uint64_t id;
+	uint64_t size;
+	uint32_t state;   // BLK_RECEIVED or BLK_DELETED
+	uint32_t pad;
+} blk_recv_entry_t;
+
 typedef struct report_blk_info_s
 {
 	uint64_t blk_id;
@@ -40,3 +40,22 @@ int task_encode(task_t *task, buffer_t *buff)
 	return DFS_OK;
 }
 
+int task_encode_hdr(task_t *task, buffer_t *buff)
+{
+	int ret = 0;
+
+	if (buffer_free_size(buff) <= 0) 
+	{
+		return DFS_AGAIN;
+	}
+		
+	ret = task_encode2hdr(task, (char*)buff->last, buffer_free_size(buff));
+	if (ret <= 0) 
+	{
+	    return ret;
+	}
+	        
+	buff->last += ret;
+
+	return DFS_OK;
+}
@@ -7,6 +7,7 @@
 
 int task_decode(buffer_t *buff, task_t *task);
 int task_encode(task_t *task, buffer_t *buff);
+int task_encode_hdr(task_t *task, buffer_t *buff);
 
 #endif
 
@@ -70,6 +70,27 @@ int conn_listening_open(array_t *listening, log_t *log)
                 goto error;
             }
 
+            if (ls[i].reuseport) 
+			{
+#ifdef SO_REUSEPORT
+                if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                    (const void *) &reuseaddr, sizeof(int)) == DFS_ERROR) 
+                {
+                    dfs_log_error(log, DFS_LOG_ERROR, errno,
+                        "conn_listening_open: SO_REUSEPORT %V failed",
+                        &ls[i].addr_text);
+				
+                    goto error;
+                }
+#else
+                dfs_log_error(log, DFS_LOG_ERROR, 0,
+                    "conn_listening_open: SO_REUSEPORT %V not supported",
+                    &ls[i].addr_text);
+				
+                goto error;
+#endif
+            }
+
             if (ls[i].rcvbuf != -1) 
 			{
                 if (setsockopt(s, SOL_SOCKET, SO_RCVBUF,
@@ -258,6 +279,14 @@ int conn_listening_close(array_t *listening)
 }
 
 int conn_listening_add_event(event_base_t *base, array_t *listening)
+{
+    return conn_listening_add_event_slice(base, listening, 0, 1);
+}
+
+// listening sockets opened n times with SO_REUSEPORT, each loop takes 
+// the ones with i % n == idx
+int conn_listening_add_event_slice(event_base_t *base, array_t *listening,
+                                        uint32_t idx, uint32_t n)
 {
     conn_t      *c = NULL;
     event_t     *rev = NULL;
@@ -266,13 +295,13 @@ int conn_listening_add_event(event_base_t *base, array_t *listening)
       
     ls = (listening_t *)listening->elts;
 	
-    for (i = 0; i < listening->nelts; i++) 
+    for (i = idx; i < listening->nelts; i += n) 
 	{
         c = ls[i].connection;
 		
         if (!c) 
 		{
-            c = conn_get_from_mem(ls->fd);
+            c = conn_get_from_mem(ls[i].fd);
             if (!c) 
 			{
                 dfs_log_debug(ls[i].log, DFS_LOG_DEBUG, 0,
@@ -290,7 +319,7 @@ int conn_listening_add_event(event_base_t *base, array_t *listening)
             ls[i].connection = c;
             rev = c->read;
             rev->accepted = DFS_TRUE;
-            rev->handler = ls->handler;
+            rev->handler = ls[i].handler;
         }
 		else 
 		{
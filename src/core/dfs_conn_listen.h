@@ -32,6 +32,7 @@ struct listening_s
     uint32_t               linger:1;
     uint32_t               inherited:1;
     uint32_t               listen:1;
+    uint32_t               reuseport:1;
 };
 
 int conn_listening_open(array_t *listening, log_t *log);
@@ -40,6 +41,8 @@ listening_t * conn_listening_add(array_t *listening, pool_t *pool,
     int rbuff_len, int sbuff_len);
 int conn_listening_close(array_t *listening);
 int conn_listening_add_event(event_base_t *base, array_t *listening);
+int conn_listening_add_event_slice(event_base_t *base, array_t *listening,
+    uint32_t idx, uint32_t n);
 int conn_listening_del_event(event_base_t *base, array_t *listening);
 
 #endif
@@ -1,8 +1,8 @@
+#include <sys/eventfd.h>
+
 #include "dfs_notice.h"
 #include "dfs_conn.h"
 
-#define NOTICE_BUFF_SIZE 1024
-
 static void noice_read_event_handler(event_t *ev);
 
 int notice_init(event_base_t *base, notice_t *n, 
@@ -11,22 +11,22 @@ int notice_init(event_base_t *base, notice_t *n,
     conn_t  *c = NULL;
     event_t *rev = NULL;
     
-    if (pipe_open(&n->channel) != DFS_OK) 
+    n->fd = eventfd(0, EFD_NONBLOCK);
+    if (n->fd == DFS_INVALID_FILE) 
 	{
         return DFS_ERROR;
     }
     
-    c = conn_get_from_mem(n->channel.pfd[0]);
+    c = conn_get_from_mem(n->fd);
     if (!c) 
 	{
         goto error;
     }
 
-    conn_nonblocking(n->channel.pfd[0]);
-    conn_nonblocking(n->channel.pfd[1]);
     n->call_back = handler;
     n->data = data;
     n->wake_up = notice_wake_up;
+    n->parked = DFS_TRUE;
     
     c->ev_base = base;
     c->conn_data = n;
@@ -47,7 +47,8 @@ int notice_init(event_base_t *base, notice_t *n,
     return DFS_OK;
     
 error:
-    pipe_close(&n->channel);
+    close(n->fd);
+    n->fd = DFS_INVALID_FILE;
     
     if (c) 
 	{
@@ -57,9 +58,17 @@ error:
     return DFS_ERROR;
 }
 
+// only the producer that unparks the consumer pays for the syscall
 int notice_wake_up(notice_t *n)
 {
-    if (dfs_write_fd(n->channel.pfd[1], "C", 1) == DFS_ERROR) 
+    uint64_t count = 1;
+	
+    if (!__sync_bool_compare_and_swap(&n->parked, DFS_TRUE, DFS_FALSE)) 
+	{
+        return DFS_OK;
+    }
+	
+    if (dfs_write_fd(n->fd, &count, sizeof(count)) == DFS_ERROR) 
 	{
         if (errno != DFS_EAGAIN) 
 		{
@@ -71,11 +80,24 @@ int notice_wake_up(notice_t *n)
     return DFS_OK;
 }
 
+// the consumer parks before it may block and checks its queues again 
+// afterwards, a push that raced with the check sees parked and signals
+void notice_park(notice_t *n)
+{
+    n->parked = DFS_TRUE;
+    __sync_synchronize();
+}
+
+void notice_unpark(notice_t *n)
+{
+    n->parked = DFS_FALSE;
+}
+
 static void noice_read_event_handler(event_t *ev)
 {
     conn_t   *c = NULL;
     notice_t *nt = NULL;
-    uchar_t   buff[NOTICE_BUFF_SIZE];
+    uint64_t  count = 0;
     int       n = 0;
     char     *errmsg = NULL;
     
@@ -84,7 +106,7 @@ static void noice_read_event_handler(event_t *ev)
     
     while (1) 
 	{
-        n = dfs_read_fd(nt->channel.pfd[0], buff, NOTICE_BUFF_SIZE);
+        n = dfs_read_fd(nt->fd, &count, sizeof(count));
         if (n > 0 || (n < 0 && errno == DFS_EINTR)) 
 		{
             continue;
@@ -105,9 +127,8 @@ static void noice_read_event_handler(event_t *ev)
     if (errmsg) 
 	{
         dfs_log_error(nt->log, DFS_LOG_FATAL, 0,
-                "pipe fd[%d] %s", nt->channel.pfd[0], errmsg);
+                "eventfd[%d] %s", nt->fd, errmsg);
     }
 	
     nt->call_back(nt->data);
 }
-
@@ -3,7 +3,6 @@
 
 #include "dfs_types.h"
 #include "dfs_event.h"
-#include "dfs_pipe.h"
 #include "dfs_epoll.h"
 
 typedef struct notice_s notice_t;
@@ -12,7 +11,8 @@ typedef void (*wake_up_hander)(void *data);
 
 struct notice_s 
 {
-    pipe_t          channel;
+    int             fd;         // eventfd
+    volatile int    parked;     // consumer may block, producers signal fd
     wake_up_ptr     wake_up;
     wake_up_hander  call_back;
     void           *data;
@@ -22,6 +22,8 @@ struct notice_s
 int notice_init(event_base_t *base, notice_t *n, wake_up_hander handler, 
 	void *data);
 int notice_wake_up(notice_t *n);
+void notice_park(notice_t *n);
+void notice_unpark(notice_t *n);
 
 #endif
 
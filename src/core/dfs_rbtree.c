@@ -443,3 +443,36 @@ rbtree_node_t * rbtree_min(rbtree_node_t *node, rbtree_node_t *sentinel)
     return node;
 }
 
+// in order successor of node, NULL after the last one
+rbtree_node_t * rbtree_next(_xvolatile rbtree_t *tree, rbtree_node_t *node)
+{
+    rbtree_node_t *root = NULL;
+    rbtree_node_t *sentinel = NULL;
+    rbtree_node_t *parent = NULL;
+
+    sentinel = tree->sentinel;
+
+    if (node->right != sentinel) 
+	{
+        return rbtree_min(node->right, sentinel);
+    }
+
+    root = tree->root;
+
+    for ( ;; ) 
+	{
+        parent = node->parent;
+
+        if (node == root) 
+		{
+            return NULL;
+        }
+
+        if (node == parent->left) 
+		{
+            return parent;
+        }
+
+        node = parent;
+    }
+}
@@ -37,6 +37,7 @@ void rbtree_insert_value(rbtree_node_t *root,
 void rbtree_insert_timer_value(rbtree_node_t *root,
     rbtree_node_t *node, rbtree_node_t *sentinel);
 rbtree_node_t *rbtree_min(rbtree_node_t *node, rbtree_node_t *sentinel);
+rbtree_node_t *rbtree_next(_xvolatile rbtree_t *tree, rbtree_node_t *node);
 
 #define rbtree_red(node)          ((node)->color = RBTREE_COLOR_RED)
 #define rbtree_black(node)        ((node)->color = RBTREE_COLOR_BLACK)
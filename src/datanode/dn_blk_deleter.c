@@ -0,0 +1,147 @@
+#include <sys/time.h>
+#include "dn_blk_deleter.h"
+#include "dn_cycle.h"
+#include "dn_ns_service.h"
+
+#define DELETER_WAIT_SEC 1
+
+uint32_t blk_deleter_running = DFS_TRUE;
+
+static blk_deleter_t     *g_blk_deleters = NULL;
+static int                g_blk_deleter_n = 0;
+static volatile uint32_t  g_blk_del_pending = 0;
+
+static blk_del_t *blk_del_wait(blk_deleter_t *bd, int second);
+
+int blk_deleter_init(int num)
+{
+    g_blk_deleters = (blk_deleter_t *)calloc(num, sizeof(blk_deleter_t));
+	if (!g_blk_deleters) 
+	{
+        return DFS_ERROR;
+	}
+
+	for (int i = 0; i < num; i++) 
+	{
+	    queue_init(&g_blk_deleters[i].que);
+		pthread_mutex_init(&g_blk_deleters[i].lock, NULL);
+		pthread_cond_init(&g_blk_deleters[i].cond, NULL);
+	}
+
+	g_blk_deleter_n = num;
+
+    return DFS_OK;
+}
+
+// path is already out of the block map, the namenode hears of blk_id 
+// once it is gone from disk
+int notify_blk_delete(int disk_id, long blk_id, char *path)
+{
+    blk_deleter_t *bd = NULL;
+	blk_del_t     *del = NULL;
+
+	if (disk_id < 0 || disk_id >= g_blk_deleter_n) 
+	{
+        return DFS_ERROR;
+	}
+
+	del = (blk_del_t *)malloc(sizeof(blk_del_t));
+	if (!del) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"malloc err");
+
+		return DFS_ERROR;
+	}
+
+	del->blk_id = blk_id;
+	strcpy(del->path, path);
+
+	bd = &g_blk_deleters[disk_id];
+
+    pthread_mutex_lock(&bd->lock);
+
+    queue_insert_tail(&bd->que, &del->me);
+	bd->num++;
+
+	pthread_cond_signal(&bd->cond);
+
+    pthread_mutex_unlock(&bd->lock);
+
+	__sync_add_and_fetch(&g_blk_del_pending, 1);
+
+    return DFS_OK;
+}
+
+// told to the namenode with each heartbeat, it hands out fewer when the 
+// disks fall behind
+uint32_t blk_deleter_pending()
+{
+    return g_blk_del_pending;
+}
+
+// arg is the storage dir id
+void *blk_deleter_start(void *arg)
+{
+    blk_deleter_t *bd = &g_blk_deleters[(long)arg];
+	blk_del_t     *del = NULL;
+
+	while (blk_deleter_running) 
+	{
+        del = blk_del_wait(bd, DELETER_WAIT_SEC);
+		if (!del) 
+		{
+            continue;
+		}
+
+		if (unlink(del->path) != 0 && errno != ENOENT) 
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno, 
+				"unlink %s err", del->path);
+		}
+
+		if (del->blk_id) 
+		{
+            notify_nn_deletedblock(del->blk_id);
+		}
+
+		__sync_sub_and_fetch(&g_blk_del_pending, 1);
+
+		free(del);
+	}
+
+	return NULL;
+}
+
+static blk_del_t *blk_del_wait(blk_deleter_t *bd, int second)
+{
+    queue_t         *cur = NULL;
+    struct timespec  timer;
+	struct timeval   now;
+
+	gettimeofday(&now, NULL);
+	timer.tv_sec = now.tv_sec + second;
+	timer.tv_nsec = now.tv_usec * 1000;
+
+	pthread_mutex_lock(&bd->lock);
+
+    while (bd->num == 0) 
+	{
+        if (pthread_cond_timedwait(&bd->cond, &bd->lock, &timer) 
+			== ETIMEDOUT) 
+		{
+            pthread_mutex_unlock(&bd->lock);
+
+			return NULL;
+		}
+    }
+
+	cur = queue_head(&bd->que);
+	queue_remove(cur);
+	bd->num--;
+
+	pthread_mutex_unlock(&bd->lock);
+
+    return queue_data(cur, blk_del_t, me);
+}
+
@@ -0,0 +1,30 @@
+#ifndef DN_BLK_DELETER_H
+#define DN_BLK_DELETER_H
+
+#include "dfs_types.h"
+#include "dfs_queue.h"
+#include "dn_data_storage.h"
+
+typedef struct blk_del_s
+{
+    queue_t me;
+	long    blk_id;         // 0 for a leftover, nobody waits for it
+	char    path[PATH_LEN];
+} blk_del_t;
+
+// one per storage dir, a slow disk only holds up its own deletions
+typedef struct blk_deleter_s
+{
+    queue_t         que;
+	int             num;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} blk_deleter_t;
+
+int blk_deleter_init(int num);
+int notify_blk_delete(int disk_id, long blk_id, char *path);
+uint32_t blk_deleter_pending();
+void *blk_deleter_start(void *arg);
+
+#endif
+
@@ -67,6 +67,9 @@ static conf_option_t conf_server_option[] =
 	{ string_make("block_report_interval"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, block_report_interval) },
 
+	{ string_make("copy_threads"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, copy_threads) },
+
     { string_null, NULL, OPE_EQUAL, 0 }    
 };
 
@@ -136,6 +139,7 @@ static int conf_server_make_default(void *var)
     set_def_int(sconf->recv_buff_len, 		    DEF_RBUFF_LEN);
     set_def_int(sconf->send_buff_len, 		    DEF_SBUFF_LEN);
     set_def_int(sconf->max_tqueue_len, 		    DEF_MMAX_TQUEUE_LEN);
+    set_def_int(sconf->copy_threads,            DEF_COPY_THREADS);
 	
     return DFS_OK;
 }
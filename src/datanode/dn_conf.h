@@ -24,6 +24,7 @@ struct conf_server_s
     string_t data_dir;
 	uint32_t heartbeat_interval;
 	uint32_t block_report_interval;
+	uint32_t copy_threads;
 };
 
 conf_object_t *get_dn_conf_object(void);
@@ -31,6 +32,7 @@ conf_object_t *get_dn_conf_object(void);
 #define DEF_RBUFF_LEN          64 * 1024
 #define DEF_SBUFF_LEN          64 * 1024
 #define DEF_MMAX_TQUEUE_LEN    1000
+#define DEF_COPY_THREADS       6
 
 #define set_def_string(key, value) do { \
     if (!(key)->len) { \
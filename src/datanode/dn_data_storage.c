@@ -1,3 +1,4 @@
+#include <sys/statvfs.h>
 #include "dn_data_storage.h"
 #include "dfs_types.h"
 #include "dfs_math.h"
@@ -8,14 +9,19 @@
 #include "dn_time.h"
 #include "dn_process.h"
 #include "dn_ns_service.h"
+#include "dn_blk_deleter.h"
 
 #define BLK_NUM_IN_DN 100000
 
+// a block on its way out, the scanner leaves it alone
+#define BLK_DEL_PREFIX "del_"
+
 uint32_t blk_scanner_running = DFS_TRUE;
 
 static queue_t g_storage_dir_q;
 static int     g_storage_dir_n = 0;
 static char    g_last_version[56] = "";
+static int     g_first_scan = DFS_TRUE;
 
 static blk_cache_mgmt_t *g_dn_bcm = NULL;
 
@@ -38,6 +44,7 @@ static int uint64_cmp(const void *s1, const void *s2, size_t sz);
 static size_t req_hash(const void *data, size_t data_size, 
 	size_t hashtable_size);
 static int get_disk_id(long block_id, char *path);
+static int get_path_disk_id(const char *path);
 static int recv_blk_report(dn_request_t *r);
 static int scan_current_dir(char *dir);
 static void get_namespace_id(char *src, char *id);
@@ -45,6 +52,7 @@ static int scan_namespace_dir(char *dir, long namespace_id);
 static int scan_subdir(char *dir, long namespace_id);
 static int scan_subdir_subdir(char *dir, long namespace_id);
 static void get_blk_id(char *src, char *id);
+static int blk_report_entry_cmp(const void *a, const void *b);
 
 int dn_data_storage_master_init(cycle_t *cycle)
 {
@@ -213,6 +221,63 @@ int setup_ns_storage(dfs_thread_t *thread)
     return DFS_OK;
 }
 
+// storage dirs sharing a filesystem are counted once
+int get_storage_usage(uint64_t *capacity, uint64_t *remaining)
+{
+    int            i = 0;
+	int            n = 0;
+    queue_t       *cur = NULL;
+	storage_dir_t *sd = NULL;
+	dev_t          devs[64];
+	struct stat    st;
+	struct statvfs vfs;
+
+	*capacity = 0;
+	*remaining = 0;
+
+	for (cur = queue_head(&g_storage_dir_q); 
+		cur != queue_sentinel(&g_storage_dir_q); cur = queue_next(cur))
+	{
+	    sd = queue_data(cur, storage_dir_t, me);
+
+		if (stat(sd->current, &st) != 0 || statvfs(sd->current, &vfs) != 0)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno, 
+				"statvfs %s err", sd->current);
+			
+            continue;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+            if (devs[i] == st.st_dev)
+			{
+                break;
+			}
+		}
+
+		if (i < n)
+		{
+            continue;
+		}
+
+		if (n < (int)(sizeof(devs) / sizeof(devs[0])))
+		{
+            devs[n++] = st.st_dev;
+		}
+
+		*capacity += (uint64_t)vfs.f_blocks * vfs.f_frsize;
+		*remaining += (uint64_t)vfs.f_bavail * vfs.f_frsize;
+	}
+
+	return n > 0 ? DFS_OK : DFS_ERROR;
+}
+
+int get_storage_dir_num()
+{
+    return g_storage_dir_n;
+}
+
 static int check_version(char *path)
 {
     if (access(path, F_OK) != DFS_OK) 
@@ -636,14 +701,65 @@ int block_object_add(char *path, long ns_id, long blk_id)
 
 	pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
 	
-    notify_blk_report(blk);
+    return DFS_OK;
+}
+
+// every block held, ids ascending, for a full block report
+int block_object_list(blk_report_entry_t **ents, uint32_t *num)
+{
+    uint32_t              i = 0;
+	uint32_t              n = 0;
+	uint32_t              b = 0;
+	block_info_t         *blk = NULL;
+	dfs_hashtable_link_t *ln = NULL;
+	blk_report_entry_t   *list = NULL;
+
+	pthread_rwlock_rdlock(&g_dn_bcm->cache_rwlock);
+
+	n = g_dn_bcm->blk_htable->count;
+	if (n > 0) 
+	{
+	    list = (blk_report_entry_t *)malloc(n * sizeof(blk_report_entry_t));
+		if (!list) 
+		{
+		    pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
+			
+            return DFS_ERROR;
+		}
+	}
+
+	for (b = 0; b < g_dn_bcm->blk_htable->size && i < n; b++) 
+	{
+        for (ln = dfs_hashtable_get_bucket(g_dn_bcm->blk_htable, b); 
+			ln && i < n; ln = ln->next) 
+		{
+            blk = (block_info_t *)ln;
+			list[i].id = blk->id;
+			list[i].size = blk->size;
+			i++;
+		}
+	}
+
+	pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
+
+	if (i > 0) 
+	{
+        qsort(list, i, sizeof(blk_report_entry_t), blk_report_entry_cmp);
+	}
+
+	*ents = list;
+	*num = i;
 	
     return DFS_OK;
 }
 
+// renamed out of the way of the scanner and of a new copy of the same 
+// block, the disk's deleter unlinks it later
 int block_object_del(long blk_id)
 {
     block_info_t *blk = NULL;
+	char         *name = NULL;
+	char          path[PATH_LEN] = "";
 
 	blk = block_object_get(blk_id);
 	if (!blk) 
@@ -651,7 +767,20 @@ int block_object_del(long blk_id)
         return DFS_ERROR;
 	}
 
-	unlink(blk->path);
+	strcpy(path, blk->path);
+	name = strrchr(blk->path, '/');
+	if (name) 
+	{
+	    sprintf(path + (name + 1 - blk->path), BLK_DEL_PREFIX"%s", name + 1);
+	}
+
+	if (rename(blk->path, path) != 0) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno, 
+			"rename %s err", blk->path);
+		
+        strcpy(path, blk->path);
+	}
 	
 	pthread_rwlock_wrlock(&g_dn_bcm->cache_rwlock);
 
@@ -660,6 +789,12 @@ int block_object_del(long blk_id)
 	mem_put(blk);
 
 	pthread_rwlock_unlock(&g_dn_bcm->cache_rwlock);
+
+	if (notify_blk_delete(get_path_disk_id(path), blk_id, path) != DFS_OK) 
+	{
+	    unlink(path);
+        notify_nn_deletedblock(blk_id);
+	}
     
     return DFS_OK;
 }
@@ -745,6 +880,28 @@ int write_block_done(dn_request_t *r)
     return recv_blk_report(r);
 }
 
+// the storage dir path is in, its deleter unlinks it
+static int get_path_disk_id(const char *path)
+{
+    queue_t       *entry = NULL;
+	storage_dir_t *sd = NULL;
+	size_t         len = 0;
+
+	for (entry = queue_next(&g_storage_dir_q); entry != &g_storage_dir_q; 
+		entry = queue_next(entry)) 
+	{
+        sd = queue_data(entry, storage_dir_t, me);
+		len = strlen(sd->current);
+
+		if (!strncmp(path, sd->current, len) && path[len] == '/') 
+		{
+            return sd->id;
+		}
+	}
+
+	return 0;
+}
+
 static int get_disk_id(long block_id, char *path)
 {
     queue_t *head = NULL;
@@ -842,6 +999,11 @@ void *blk_scanner_start(void *arg)
 			scan_current_dir(sd->current);
 		}
 
+		// every block is reported in full after each pass
+		notify_blk_report();
+
+		g_first_scan = DFS_FALSE;
+
 		sleep(blk_report_interval);
 	}
 	
@@ -985,6 +1147,19 @@ static int scan_subdir_subdir(char *dir, long namespace_id)
 			sprintf(path, "%s/%s", dir, ent->d_name);
 			block_object_add(path, namespace_id, atol(blk_id));
 		}
+		else if (g_first_scan && 8 == ent->d_type 
+			&& 0 == strncmp(ent->d_name, BLK_DEL_PREFIX"blk_", 8)) 
+		{
+		    // left by a deleter that did not get to it before a restart
+		    char blk_id[16] = "";
+			get_blk_id(ent->d_name + 4, blk_id);
+
+			if (snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) 
+				< (int)sizeof(path)) 
+			{
+			    notify_blk_delete(get_path_disk_id(path), 0, path);
+			}
+		}
 	}
 
 	closedir(p_dir);
@@ -1002,3 +1177,10 @@ static void get_blk_id(char *src, char *id)
 	}
 }
 
+static int blk_report_entry_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const blk_report_entry_t *)a)->id;
+	uint64_t y = ((const blk_report_entry_t *)b)->id;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
@@ -6,6 +6,7 @@
 #include "dn_thread.h"
 #include "dn_request.h"
 #include "cfs_fio.h"
+#include "dfs_task_cmd.h"
 
 #define PATH_LEN 256
 #define SUBDIR_LEN 64
@@ -60,10 +61,13 @@ int dn_data_storage_worker_release(cycle_t *cycle);
 int dn_data_storage_thread_init(dfs_thread_t *thread);
 
 int setup_ns_storage(dfs_thread_t *thread);
+int get_storage_usage(uint64_t *capacity, uint64_t *remaining);
+int get_storage_dir_num();
 
 block_info_t *block_object_get(long id);
 int block_object_add(char *path, long ns_id, long blk_id);
 int block_object_del(long blk_id);
+int block_object_list(blk_report_entry_t **ents, uint32_t *num);
 int block_read(dn_request_t *r, file_io_t *fio);
 
 void io_lock(volatile uint64_t *lock);
@@ -7,22 +7,42 @@
 #include "dn_cycle.h"
 #include "dn_time.h"
 #include "dn_conf.h"
+#include "dn_replication.h"
+#include "dn_blk_deleter.h"
 
 #define BUF_SZ 4096
 
+// the namenode answers a wait with nothing for it within a minute or so
+#define CMD_WAIT_TIMEOUT 120 // Sec
+#define CMD_RETRY_SEC    1
+
 unsigned long g_last_heartbeat = 0;
+uint32_t      cmd_channel_running = DFS_TRUE;
+
+extern dfs_thread_t *woker_threads;
+extern int           woker_num;
+extern int           ns_service_num;
+
+// a block stored or dropped, not told to the namenode yet
+typedef struct blk_note_s
+{
+    queue_t          me;
+	blk_recv_entry_t e;
+} blk_note_t;
 
+// each namenode is told of every block, on a queue of its own
 typedef struct recv_blk_report_s
 {
-    queue_t         que;
-	int             num;
+    queue_t         que[NS_SRV_MAX];
+	int             num[NS_SRV_MAX];
 	pthread_mutex_t lock;
 	pthread_cond_t  cond;
 } recv_blk_report_t;
 
+// num counts the scans done, each namenode is sent a full block report 
+// after each
 typedef struct blk_report_s
 {
-    queue_t         que;
 	int             num;
 	pthread_mutex_t lock;
 	pthread_cond_t  cond;
@@ -32,11 +52,16 @@ recv_blk_report_t g_recv_blk_report;
 blk_report_t      g_blk_report;
 
 static int ns_srv_init(char* ip, int port);
-static int send_heartbeat(int sockfd);
-static int receivedblock_report(int sockfd);
-static int wait_to_work(int second);
+static int send_heartbeat(int sockfd, int64_t ns_id);
+static int receivedblock_report(int sockfd, int idx);
+static int wait_to_work(int second, int idx);
 static int block_report(int sockfd);
-static int delete_blks(char *p, int len);
+static int send_blk_report_frame(int sockfd, blk_report_head_t *head, 
+	blk_report_entry_t *ents, char *buf);
+static int send_report(int sockfd, cmd_t cmd, char *data, int len);
+static int notify_nn_blk(long blk_id, long blk_sz, uint32_t state);
+static int do_dn_cmds(char *p, int len, int64_t ns_id);
+static int cmd_wait(int sockfd, int64_t ns_id, uint32_t *ack);
 
 int dn_register(dfs_thread_t *thread)
 {
@@ -66,6 +91,7 @@ int dn_register(dfs_thread_t *thread)
 
 	int pLen = 0;
 	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
+	pLen = task_frame_size((char *)&pLen);
 	if (rLen < 0) 
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
@@ -155,6 +181,8 @@ static int ns_srv_init(char* ip, int port)
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
 			"connect(%s: %d) err", ip, port);
+
+		close(sockfd);
 		
 	    return DFS_ERROR;
 	}
@@ -179,22 +207,26 @@ int offer_service(dfs_thread_t *thread)
 		{
 		    g_last_heartbeat = now_time;
 			
-		    if (send_heartbeat(thread->ns_info.sockfd) != DFS_OK) 
+		    if (send_heartbeat(thread->ns_info.sockfd, 
+				thread->ns_info.namespaceID) != DFS_OK) 
 			{
 			    goto out;
 			}
 		}
 
-        if (g_recv_blk_report.num > 0)
+        if (g_recv_blk_report.num[thread->ns_info.idx] > 0)
 		{
-            if (receivedblock_report(thread->ns_info.sockfd) != DFS_OK) 
+            if (receivedblock_report(thread->ns_info.sockfd, 
+				thread->ns_info.idx) != DFS_OK) 
 		    {
                 goto out;
 		    }
 		}
 
-		if (g_blk_report.num > 0) 
+		if ((uint32_t)g_blk_report.num != thread->ns_info.blk_report_gen) 
 		{
+		    thread->ns_info.blk_report_gen = g_blk_report.num;
+			
             if (block_report(thread->ns_info.sockfd) != DFS_OK) 
 		    {
                 goto out;
@@ -204,11 +236,12 @@ int offer_service(dfs_thread_t *thread)
         int ptime = heartbeat_interval - diff;
 		int wtime = ptime > 0 ? ptime : heartbeat_interval;
 		
-		if (wtime > 0 && g_recv_blk_report.num == 0 && g_blk_report.num == 0) 
+		if (wtime > 0 && g_recv_blk_report.num[thread->ns_info.idx] == 0 
+			&& (uint32_t)g_blk_report.num == thread->ns_info.blk_report_gen) 
 		{
 		    g_last_heartbeat = now_time;
 			
-	        wait_to_work(wtime);
+	        wait_to_work(wtime, thread->ns_info.idx);
 		}
 
 		gettimeofday(&now, NULL);
@@ -220,16 +253,36 @@ out:
 	close(thread->ns_info.sockfd);
 	thread->ns_info.sockfd = -1;
 	thread->ns_info.namespaceID = -1;
+	// reported in full again once registered again
+	thread->ns_info.blk_report_gen = 0;
 	
     return DFS_ERROR;
 }
 
-static int send_heartbeat(int sockfd)
+static int send_heartbeat(int sockfd, int64_t ns_id)
 {
+    heartbeat_info_t hbi;
+	bzero(&hbi, sizeof(heartbeat_info_t));
+
+	if (get_storage_usage(&hbi.capacity, &hbi.remaining) == DFS_OK) 
+	{
+        hbi.dfs_used = hbi.capacity - hbi.remaining;
+	}
+
+	for (int i = 0; i < woker_num; i++) 
+	{
+        hbi.active_conn += woker_threads[i].conn_pool.used_n;
+	}
+
+	hbi.del_pending = blk_deleter_pending();
+	hbi.cmd_ver = DN_CMD_VER;
+
     task_t out_t;
 	bzero(&out_t, sizeof(task_t));
 	out_t.cmd = DN_HEARTBEAT;
 	strcpy(out_t.key, dfs_cycle->listening_ip);
+	out_t.data = &hbi;
+	out_t.data_len = sizeof(heartbeat_info_t);
 
 	char sBuf[BUF_SZ] = "";
 	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
@@ -244,6 +297,7 @@ static int send_heartbeat(int sockfd)
 
 	int pLen = 0;
 	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK);
+	pLen = task_frame_size((char *)&pLen);
 	if (rLen < 0) 
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
@@ -261,7 +315,8 @@ static int send_heartbeat(int sockfd)
         return DFS_ERROR;
 	}
 
-	rLen = read(sockfd, pNext, pLen);
+	// a reply with many deletions comes in more than one piece
+	rLen = recv(sockfd, pNext, pLen, MSG_WAITALL);
 	if (rLen < 0) 
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
@@ -289,7 +344,7 @@ static int send_heartbeat(int sockfd)
 	} 
 	else if (NULL != in_t.data && in_t.data_len > 0) 
 	{
-	    delete_blks((char *)in_t.data, in_t.data_len);
+	    do_dn_cmds((char *)in_t.data, in_t.data_len, ns_id);
 	}
 
 	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
@@ -301,74 +356,195 @@ static int send_heartbeat(int sockfd)
     return DFS_OK;
 }
 
-static int receivedblock_report(int sockfd)
+// commands from the namenode of thread as soon as it has them, on a 
+// connection of their own. heartbeats only carry them until this is up
+void *cmd_channel_start(void *arg)
 {
-    queue_t           *cur = NULL;
-	block_info_t      *blk = NULL;
-	report_blk_info_t  rbi;
+    dfs_thread_t  *thread = (dfs_thread_t *)arg;
+	int            sockfd = -1;
+	uint32_t       ack = 0;
+	struct timeval tv;
+
+	while (cmd_channel_running) 
+	{
+	    // registered first
+	    if (thread->ns_info.namespaceID <= 0) 
+		{
+            sleep(CMD_RETRY_SEC);
+
+			continue;
+		}
+
+		sockfd = ns_srv_init(thread->ns_info.ip, thread->ns_info.port);
+		if (sockfd < 0) 
+		{
+            sleep(CMD_RETRY_SEC);
+
+			continue;
+		}
+
+		tv.tv_sec = CMD_WAIT_TIMEOUT;
+		tv.tv_usec = 0;
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		while (cmd_channel_running 
+			&& cmd_wait(sockfd, thread->ns_info.namespaceID, &ack) == DFS_OK) 
+		{
+		}
+
+		close(sockfd);
+		sockfd = -1;
+
+		// the namenode may have to see it register again first
+		sleep(CMD_RETRY_SEC);
+	}
+
+	return NULL;
+}
+
+// one wait, answered with a batch of commands or with none. ack is the 
+// seq of the last batch done, sent with the next wait
+static int cmd_wait(int sockfd, int64_t ns_id, uint32_t *ack)
+{
+    cmd_wait_info_t  cwi;
+	cmd_batch_head_t head;
+
+	cwi.ack = *ack;
+	cwi.del_pending = blk_deleter_pending();
 
-	pthread_mutex_lock(&g_recv_blk_report.lock);
-    
-	cur = queue_head(&g_recv_blk_report.que);
-    queue_remove(cur);
-    blk = queue_data(cur, block_info_t, me);
-	g_recv_blk_report.num--;
-    
-    pthread_mutex_unlock(&g_recv_blk_report.lock);
-	
     task_t out_t;
 	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = DN_RECV_BLK_REPORT;
+	out_t.cmd = DN_CMD_WAIT;
 	strcpy(out_t.key, dfs_cycle->listening_ip);
-
-	memset(&rbi, 0x00, sizeof(report_blk_info_t));
-	rbi.blk_id = blk->id;
-	rbi.blk_sz = blk->size;
-	strcpy(rbi.dn_ip, dfs_cycle->listening_ip);
-
-	out_t.data_len = sizeof(report_blk_info_t);
-	out_t.data = &rbi;
+	out_t.data = &cwi;
+	out_t.data_len = sizeof(cmd_wait_info_t);
 
 	char sBuf[BUF_SZ] = "";
 	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
 	int ws = write(sockfd, sBuf, sLen);
 	if (ws != sLen) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
 			"write err, ws: %d, sLen: %d", ws, sLen);
 
         return DFS_ERROR;
 	}
 
-	char rBuf[BUF_SZ] = "";
-	int rLen = read(sockfd, rBuf, sizeof(rBuf));
-	if (rLen < 0) 
+	int pLen = 0;
+	int rLen = recv(sockfd, &pLen, sizeof(int), MSG_PEEK | MSG_WAITALL);
+	if (rLen != sizeof(int)) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
-			"read err, rLen: %d", rLen);
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"recv err, rLen: %d", rLen);
 		
         return DFS_ERROR;
 	}
-	
+
+	pLen = task_frame_size((char *)&pLen);
+
+	char *pNext = (char *)malloc(pLen);
+	if (NULL == pNext) 
+	{
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno,
+			"malloc err, pLen: %d", pLen);
+		
+        return DFS_ERROR;
+	}
+
+	rLen = recv(sockfd, pNext, pLen, MSG_WAITALL);
+	if (rLen != pLen) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"recv err, rLen: %d, pLen: %d", rLen, pLen);
+
+		free(pNext);
+		
+        return DFS_ERROR;
+	}
+
 	task_t in_t;
 	bzero(&in_t, sizeof(task_t));
-	task_decodefstr(rBuf, rLen, &in_t);
+	task_decodefstr(pNext, rLen, &in_t);
 
     if (in_t.ret != DFS_OK) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"receivedblock_report err, ret: %d", in_t.ret);
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0, 
+			"cmd_wait err, ret: %d", in_t.ret);
+
+		free(pNext);
 		
         return DFS_ERROR;
+	} 
+	
+	if (NULL != in_t.data && in_t.data_len >= (int)sizeof(head)) 
+	{
+	    memcpy(&head, in_t.data, sizeof(head));
+
+	    do_dn_cmds((char *)in_t.data + sizeof(head), 
+			in_t.data_len - sizeof(head), ns_id);
+
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"cmd_wait got batch %ud, %ud commands", head.seq, head.num);
+
+		*ack = head.seq;
 	}
 
-	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"receivedblock_report ok, ret: %d", in_t.ret);
+	free(pNext);
 	
     return DFS_OK;
 }
 
-static int wait_to_work(int second)
+// everything stored or dropped since the last one, in one report
+static int receivedblock_report(int sockfd, int idx)
+{
+    int               n = 0;
+	int               rs = DFS_OK;
+    queue_t          *cur = NULL;
+	blk_note_t       *note = NULL;
+	blk_recv_entry_t *ents = NULL;
+
+	ents = (blk_recv_entry_t *)malloc(BLK_RECV_REPORT_MAX 
+		* sizeof(blk_recv_entry_t));
+	if (!ents) 
+	{
+        return DFS_OK;
+	}
+
+	pthread_mutex_lock(&g_recv_blk_report.lock);
+
+	while (n < BLK_RECV_REPORT_MAX 
+		&& !queue_empty(&g_recv_blk_report.que[idx])) 
+	{
+	    cur = queue_head(&g_recv_blk_report.que[idx]);
+        queue_remove(cur);
+		g_recv_blk_report.num[idx]--;
+
+        note = queue_data(cur, blk_note_t, me);
+		ents[n++] = note->e;
+		free(note);
+	}
+    
+    pthread_mutex_unlock(&g_recv_blk_report.lock);
+
+	if (n > 0) 
+	{
+        rs = send_report(sockfd, DN_RECV_BLK_REPORT, (char *)ents, 
+			n * sizeof(blk_recv_entry_t));
+	}
+
+	if (DFS_OK == rs) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"receivedblock_report ok, %d blocks", n);
+	}
+
+	free(ents);
+
+	// the ones refused are in the next full report
+	return rs == DFS_ERROR ? DFS_ERROR : DFS_OK;
+}
+
+static int wait_to_work(int second, int idx)
 {
     struct timespec timer;
 	struct timeval now;
@@ -378,7 +554,7 @@ static int wait_to_work(int second)
 
 	pthread_mutex_lock(&g_recv_blk_report.lock);
     
-    while (g_recv_blk_report.num == 0) 
+    while (g_recv_blk_report.num[idx] == 0) 
 	{   
         int rs = pthread_cond_timedwait(&g_recv_blk_report.cond, 
 			&g_recv_blk_report.lock, &timer); 
@@ -395,13 +571,15 @@ static int wait_to_work(int second)
 
 int blk_report_queue_init()
 {
-    queue_init(&g_recv_blk_report.que);
-	g_recv_blk_report.num = 0;
+    for (int i = 0; i < NS_SRV_MAX; i++) 
+	{
+        queue_init(&g_recv_blk_report.que[i]);
+		g_recv_blk_report.num[i] = 0;
+	}
 
 	pthread_mutex_init(&g_recv_blk_report.lock, NULL);
 	pthread_cond_init(&g_recv_blk_report.cond, NULL);
 
-	queue_init(&g_blk_report.que);
 	g_blk_report.num = 0;
 
 	pthread_mutex_init(&g_blk_report.lock, NULL);
@@ -412,9 +590,22 @@ int blk_report_queue_init()
 
 int blk_report_queue_release()
 {
+    queue_t *cur = NULL;
+	
+    for (int i = 0; i < NS_SRV_MAX; i++) 
+	{
+        while (!queue_empty(&g_recv_blk_report.que[i])) 
+	    {
+	        cur = queue_head(&g_recv_blk_report.que[i]);
+            queue_remove(cur);
+		    free(queue_data(cur, blk_note_t, me));
+	    }
+
+		g_recv_blk_report.num[i] = 0;
+	}
+	
     pthread_mutex_destroy(&g_recv_blk_report.lock);
 	pthread_cond_destroy(&g_recv_blk_report.cond);
-	g_recv_blk_report.num = 0;
 
 	pthread_mutex_destroy(&g_blk_report.lock);
 	pthread_cond_destroy(&g_blk_report.cond);
@@ -425,48 +616,134 @@ int blk_report_queue_release()
 
 int notify_nn_receivedblock(block_info_t *blk)
 {
+    return notify_nn_blk(blk->id, blk->size, BLK_RECEIVED);
+}
+
+int notify_nn_deletedblock(long blk_id)
+{
+    return notify_nn_blk(blk_id, 0, BLK_DELETED);
+}
+
+// a note for each namenode, one missed is in the next full report
+static int notify_nn_blk(long blk_id, long blk_sz, uint32_t state)
+{
+    int         i = 0;
+	int         n = ns_service_num < NS_SRV_MAX ? ns_service_num : NS_SRV_MAX;
+    blk_note_t *note = NULL;
+	
     pthread_mutex_lock(&g_recv_blk_report.lock);
+
+	for (i = 0; i < n; i++) 
+	{
+        note = (blk_note_t *)calloc(1, sizeof(blk_note_t));
+	    if (!note) 
+	    {
+            break;
+	    }
+
+	    note->e.id = blk_id;
+	    note->e.size = blk_sz;
+	    note->e.state = state;
     
-    queue_insert_tail(&g_recv_blk_report.que, &blk->me);
-	g_recv_blk_report.num++;
+        queue_insert_tail(&g_recv_blk_report.que[i], &note->me);
+	    g_recv_blk_report.num[i]++;
+	}
 
-	pthread_cond_signal(&g_recv_blk_report.cond);
+	pthread_cond_broadcast(&g_recv_blk_report.cond);
     
     pthread_mutex_unlock(&g_recv_blk_report.lock);
 	
-    return DFS_OK;
+    return i == n ? DFS_OK : DFS_ERROR;
 }
 
+// all blocks held, in frames of up to BLK_REPORT_MAX sorted entries
 static int block_report(int sockfd)
 {
-    queue_t           *cur = NULL;
-	block_info_t      *blk = NULL;
-	report_blk_info_t  rbi;
+    int                 rs = DFS_OK;
+    uint32_t            num = 0;
+	uint32_t            done = 0;
+	char               *buf = NULL;
+	blk_report_entry_t *ents = NULL;
+	blk_report_head_t   head;
+	struct timeval      now;
+
+	if (block_object_list(&ents, &num) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0, 
+			"no memory to list blocks for block_report");
+		
+        return DFS_OK;
+	}
 
-	pthread_mutex_lock(&g_blk_report.lock);
-    
-	cur = queue_head(&g_blk_report.que);
-    queue_remove(cur);
-    blk = queue_data(cur, block_info_t, me);
-	g_blk_report.num--;
-    
-    pthread_mutex_unlock(&g_blk_report.lock);
+	buf = (char *)malloc(sizeof(head) 
+		+ BLK_REPORT_MAX * sizeof(blk_report_entry_t));
+	if (!buf) 
+	{
+	    free(ents);
+		
+        return DFS_OK;
+	}
+
+	gettimeofday(&now, NULL);
+	
+	memset(&head, 0x00, sizeof(blk_report_head_t));
+	head.report_id = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+
+	do 
+	{
+	    head.num = num - done > BLK_REPORT_MAX ? BLK_REPORT_MAX : num - done;
+		head.last = done + head.num == num;
+
+		rs = send_blk_report_frame(sockfd, &head, ents + done, buf);
+		if (rs != DFS_OK) 
+		{
+            break;
+		}
+
+		done += head.num;
+		head.seq++;
+	} while (done < num);
+
+	if (DFS_OK == rs) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"block_report ok, %ud blocks in %ud frames", num, head.seq);
+	}
+
+	free(buf);
+	free(ents);
+
+	// one the namenode refused is sent again after the next scan
+	return rs == DFS_ERROR ? DFS_ERROR : DFS_OK;
+}
+
+// DFS_ERROR when the connection is broken, DFS_DECLINED when the 
+// namenode refused the frame
+static int send_blk_report_frame(int sockfd, blk_report_head_t *head, 
+	blk_report_entry_t *ents, char *buf)
+{
+    int len = sizeof(*head) + head->num * sizeof(blk_report_entry_t);
 	
+	memcpy(buf, head, sizeof(*head));
+	memcpy(buf + sizeof(*head), ents, len - sizeof(*head));
+
+	return send_report(sockfd, DN_BLK_REPORT, buf, len);
+}
+
+// DFS_ERROR when the connection is broken, DFS_DECLINED when the 
+// namenode refused the report
+static int send_report(int sockfd, cmd_t cmd, char *data, int len)
+{
     task_t out_t;
 	bzero(&out_t, sizeof(task_t));
-	out_t.cmd = DN_BLK_REPORT;
+	out_t.cmd = cmd;
 	strcpy(out_t.key, dfs_cycle->listening_ip);
+	out_t.data_len = len;
+	out_t.data = data;
 
-	memset(&rbi, 0x00, sizeof(report_blk_info_t));
-	rbi.blk_id = blk->id;
-	rbi.blk_sz = blk->size;
-	strcpy(rbi.dn_ip, dfs_cycle->listening_ip);
-
-	out_t.data_len = sizeof(report_blk_info_t);
-	out_t.data = &rbi;
-
+	// the data goes out after the header, it is too big to copy
 	char sBuf[BUF_SZ] = "";
-	int sLen = task_encode2str(&out_t, sBuf, sizeof(sBuf));
+	int sLen = task_encode2hdr(&out_t, sBuf, sizeof(sBuf));
 	int ws = write(sockfd, sBuf, sLen);
 	if (ws != sLen) 
 	{
@@ -476,6 +753,18 @@ static int block_report(int sockfd)
         return DFS_ERROR;
 	}
 
+	for (int off = 0; off < len; off += ws) 
+	{
+        ws = write(sockfd, data + off, len - off);
+		if (ws <= 0) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, errno, 
+				"write err, ws: %d, len: %d", ws, len - off);
+			
+            return DFS_ERROR;
+		}
+	}
+
 	char rBuf[BUF_SZ] = "";
 	int rLen = read(sockfd, rBuf, sizeof(rBuf));
 	if (rLen < 0) 
@@ -492,23 +781,19 @@ static int block_report(int sockfd)
 
     if (in_t.ret != DFS_OK) 
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"block_report err, ret: %d", in_t.ret);
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0, 
+			"report %d refused, ret: %d", cmd, in_t.ret);
 		
-        return DFS_ERROR;
+        return DFS_DECLINED;
 	}
-
-	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"block_report ok, ret: %d", in_t.ret);
 	
     return DFS_OK;
 }
 
-int notify_blk_report(block_info_t *blk)
+int notify_blk_report()
 {
     pthread_mutex_lock(&g_blk_report.lock);
     
-    queue_insert_tail(&g_blk_report.que, &blk->me);
 	g_blk_report.num++;
     
     pthread_mutex_unlock(&g_blk_report.lock);
@@ -516,16 +801,24 @@ int notify_blk_report(block_info_t *blk)
     return DFS_OK;
 }
 
-static int delete_blks(char *p, int len)
+// the work a heartbeat reply or a command batch hands over, see dn_cmd_t
+static int do_dn_cmds(char *p, int len, int64_t ns_id)
 {
-    uint64_t blk_id = 0;
-	int      pLen = sizeof(uint64_t);
+    dn_cmd_t cmd;
+	int      pLen = sizeof(dn_cmd_t);
 	
-    while (len > 0) 
+    while (len >= pLen) 
 	{
-        memcpy(&blk_id, p, pLen);
+        memcpy(&cmd, p, pLen);
 
-		block_object_del(blk_id);
+		if (OP_DELETE_BLOCK == cmd.op) 
+		{
+		    block_object_del(cmd.blk_id);
+		}
+		else if (OP_COPY_BLOCK == cmd.op) 
+		{
+            notify_blk_copy(cmd.blk_id, ns_id, cmd.target, cmd.rate);
+		}
 
 		p += pLen;
 		len -= pLen;
@@ -9,7 +9,9 @@ int offer_service(dfs_thread_t *thread);
 int blk_report_queue_init();
 int blk_report_queue_release();
 int notify_nn_receivedblock(block_info_t *blk);
-int notify_blk_report(block_info_t *blk);
+int notify_nn_deletedblock(long blk_id);
+int notify_blk_report();
+void *cmd_channel_start(void *arg);
 
 #endif
 
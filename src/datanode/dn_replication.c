@@ -0,0 +1,303 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include "dn_replication.h"
+#include "dn_cycle.h"
+#include "dn_conf.h"
+#include "dn_data_storage.h"
+#include "dfs_task_cmd.h"
+
+#define COPIER_WAIT_SEC 1
+#define COPY_RATE_CHUNK (64 * 1024)  // sent between checks on a held rate
+#define COPY_IO_TIMEOUT 60           // Sec, a hung target fails the copy
+
+uint32_t blk_copier_running = DFS_TRUE;
+
+static blk_copier_t g_blk_copier;
+
+static blk_copy_t *blk_copy_wait(int second);
+static int blk_copy(blk_copy_t *bc);
+static int copy_connect(char *ip, int port);
+static int copy_recv_rsp(int sockfd);
+static void copy_hold_rate(struct timeval *start, loff_t sent, int rate);
+
+int blk_copier_init()
+{
+    queue_init(&g_blk_copier.que);
+	g_blk_copier.num = 0;
+
+	pthread_mutex_init(&g_blk_copier.lock, NULL);
+	pthread_cond_init(&g_blk_copier.cond, NULL);
+
+    return DFS_OK;
+}
+
+// the namenode wants blk_id on target too
+int notify_blk_copy(uint64_t blk_id, int64_t ns_id, char *target, 
+	int rate)
+{
+    blk_copy_t *bc = (blk_copy_t *)malloc(sizeof(blk_copy_t));
+	if (!bc)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0,
+			"malloc err");
+
+		return DFS_ERROR;
+	}
+
+	bc->blk_id = blk_id;
+	bc->ns_id = ns_id;
+	bc->rate = rate;
+	strcpy(bc->target, target);
+
+    pthread_mutex_lock(&g_blk_copier.lock);
+
+    queue_insert_tail(&g_blk_copier.que, &bc->me);
+	g_blk_copier.num++;
+
+	pthread_cond_signal(&g_blk_copier.cond);
+
+    pthread_mutex_unlock(&g_blk_copier.lock);
+
+    return DFS_OK;
+}
+
+// one copy at a time per thread, server.copy_threads of them
+void *blk_copier_start(void *arg)
+{
+    blk_copy_t *bc = NULL;
+
+	while (blk_copier_running)
+	{
+        bc = blk_copy_wait(COPIER_WAIT_SEC);
+		if (!bc)
+		{
+            continue;
+		}
+
+		if (blk_copy(bc) != DFS_OK)
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+				"copy blk %uL to %s failed", bc->blk_id, bc->target);
+		}
+
+		free(bc);
+	}
+
+	return NULL;
+}
+
+static blk_copy_t *blk_copy_wait(int second)
+{
+    queue_t         *cur = NULL;
+    struct timespec  timer;
+	struct timeval   now;
+
+	gettimeofday(&now, NULL);
+	timer.tv_sec = now.tv_sec + second;
+	timer.tv_nsec = now.tv_usec * 1000;
+
+	pthread_mutex_lock(&g_blk_copier.lock);
+
+    while (g_blk_copier.num == 0)
+	{
+        if (pthread_cond_timedwait(&g_blk_copier.cond, &g_blk_copier.lock,
+			&timer) == ETIMEDOUT)
+		{
+            pthread_mutex_unlock(&g_blk_copier.lock);
+
+			return NULL;
+		}
+    }
+
+	cur = queue_head(&g_blk_copier.que);
+	queue_remove(cur);
+	g_blk_copier.num--;
+
+	pthread_mutex_unlock(&g_blk_copier.lock);
+
+    return queue_data(cur, blk_copy_t, me);
+}
+
+// written to the target as a client would, the target reports it to the
+// namenode once it is done
+static int blk_copy(blk_copy_t *bc)
+{
+    int            sockfd = -1;
+	int            datafd = -1;
+	int            rs = DFS_ERROR;
+	long           size = 0;
+	loff_t         off = 0;
+	ssize_t        n = 0;
+	size_t         chunk = 0;
+	block_info_t  *blk = NULL;
+	conf_server_t *sconf = NULL;
+	server_bind_t *bind = NULL;
+	char           path[PATH_LEN] = "";
+	struct timeval start;
+
+	data_transfer_header_t header;
+
+	blk = block_object_get(bc->blk_id);
+	if (!blk)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+			"blk %uL to copy is not here", bc->blk_id);
+
+		return DFS_ERROR;
+	}
+
+	strcpy(path, blk->path);
+	size = blk->size;
+
+	datafd = open(path, O_RDONLY);
+	if (datafd < 0)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+			"open %s err", path);
+
+		return DFS_ERROR;
+	}
+
+	// datanodes all listen on the same port
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+	bind = (server_bind_t *)sconf->bind_for_cli.elts;
+
+	sockfd = copy_connect(bc->target, bind[0].port);
+	if (sockfd < 0)
+	{
+        goto out;
+	}
+
+	memset(&header, 0x00, sizeof(data_transfer_header_t));
+	header.op_type = OP_WRITE_BLOCK;
+	header.namespace_id = bc->ns_id;
+	header.block_id = bc->blk_id;
+	header.len = size;
+
+	if (send(sockfd, &header, sizeof(header), 0) != sizeof(header)
+		|| copy_recv_rsp(sockfd) != DFS_OK)
+	{
+        goto out;
+	}
+
+	gettimeofday(&start, NULL);
+
+	while (off < size)
+	{
+	    chunk = size - off;
+		if (bc->rate > 0 && chunk > COPY_RATE_CHUNK) 
+		{
+            chunk = COPY_RATE_CHUNK;
+		}
+		
+        // EAGAIN is COPY_IO_TIMEOUT running out
+        n = sendfile(sockfd, datafd, &off, chunk);
+		if (n < 0 && errno != EINTR)
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+				"sendfile to %s err", bc->target);
+
+            goto out;
+		}
+
+		if (0 == n)
+		{
+            goto out;
+		}
+
+		if (bc->rate > 0) 
+		{
+            copy_hold_rate(&start, off, bc->rate);
+		}
+	}
+
+	rs = copy_recv_rsp(sockfd);
+	if (DFS_OK == rs)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0,
+			"copied blk %uL to %s", bc->blk_id, bc->target);
+	}
+
+out:
+	if (sockfd >= 0)
+	{
+        close(sockfd);
+	}
+
+	close(datafd);
+
+	return rs;
+}
+
+static int copy_connect(char *ip, int port)
+{
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (-1 == sockfd)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+			"socket() err");
+
+	    return DFS_ERROR;
+	}
+
+	// the connect too is held to the send timeout
+	struct timeval tv;
+	tv.tv_sec = COPY_IO_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	struct sockaddr_in servaddr;
+	bzero(&servaddr, sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_port = htons(port);
+	servaddr.sin_addr.s_addr = inet_addr(ip);
+
+	if (connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, errno,
+			"connect(%s: %d) err", ip, port);
+
+		close(sockfd);
+
+	    return DFS_ERROR;
+	}
+
+	return sockfd;
+}
+
+// sleeps off whatever sent got ahead of rate KB/s since start
+static void copy_hold_rate(struct timeval *start, loff_t sent, int rate)
+{
+    long           ahead = 0;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	// microseconds sent should have taken, less those it did
+	ahead = (long)(sent * 1000000 / ((long)rate * 1024))
+		- ((now.tv_sec - start->tv_sec) * 1000000 
+		+ (now.tv_usec - start->tv_usec));
+	if (ahead > 0) 
+	{
+        usleep(ahead);
+	}
+}
+
+static int copy_recv_rsp(int sockfd)
+{
+    data_transfer_header_rsp_t rsp;
+
+	memset(&rsp, 0x00, sizeof(data_transfer_header_rsp_t));
+
+	if (recv(sockfd, &rsp, sizeof(rsp), MSG_WAITALL) != sizeof(rsp)
+		|| rsp.op_status != OP_STATUS_SUCCESS || rsp.err != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
@@ -0,0 +1,30 @@
+#ifndef DN_REPLICATION_H
+#define DN_REPLICATION_H
+
+#include "dfs_types.h"
+#include "dfs_queue.h"
+
+typedef struct blk_copy_s
+{
+    queue_t  me;
+	uint64_t blk_id;
+	int64_t  ns_id;
+	int      rate;        // KB/s, 0 as fast as it goes
+	char     target[32];
+} blk_copy_t;
+
+typedef struct blk_copier_s
+{
+    queue_t         que;
+	int             num;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} blk_copier_t;
+
+int blk_copier_init();
+int notify_blk_copy(uint64_t blk_id, int64_t ns_id, char *target, 
+	int rate);
+void *blk_copier_start(void *arg);
+
+#endif
+
@@ -14,12 +14,16 @@
 typedef void *(*TREAD_FUNC)(void *);
 typedef struct dfs_thread_s dfs_thread_t;
 
+#define NS_SRV_MAX 16 // namenodes a datanode serves
+
 typedef struct ns_srv_info_s
 {
     char    ip[32];
 	int     port;
-    int64_t namespaceID;
-	int     sockfd;
+	int     idx;              // of its queue of blocks stored or dropped
+    int64_t  namespaceID;
+	int      sockfd;
+	uint32_t blk_report_gen;  // the scan last reported in full
 } ns_srv_info_t;
 
 struct dfs_thread_s 
@@ -11,6 +11,8 @@
 #include "dn_process.h"
 #include "dn_ns_service.h"
 #include "dn_data_storage.h"
+#include "dn_replication.h"
+#include "dn_blk_deleter.h"
 
 #define PATH_LEN  256
 
@@ -18,6 +20,9 @@
 
 extern uint32_t process_type;
 extern uint32_t blk_scanner_running;
+extern uint32_t blk_copier_running;
+extern uint32_t blk_deleter_running;
+extern uint32_t cmd_channel_running;
 
 static int total_threads = 0;
 static pthread_mutex_t init_lock;
@@ -56,6 +61,9 @@ static void *thread_ns_service_cycle(void * args);
 static void stop_ns_service_thread();
 static void dio_event_handler(event_t * ev);
 static int create_data_blk_scanner(cycle_t *cycle);
+static int create_blk_copier(cycle_t *cycle);
+static int create_cmd_channels(cycle_t *cycle);
+static int create_blk_deleters(cycle_t *cycle);
 
 static int thread_setup(dfs_thread_t *thread, int type)
 {
@@ -197,6 +205,14 @@ void worker_processer(cycle_t *cycle, void *data)
         exit(PROCESS_FATAL_EXIT);
     }
 
+	if (create_cmd_channels(cycle) != DFS_OK) 
+	{
+        dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno, 
+            "create_cmd_channels failed");
+		
+        exit(PROCESS_FATAL_EXIT);
+	}
+
 	if (create_data_blk_scanner(cycle) != DFS_OK) 
 	{
         dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno, 
@@ -204,6 +220,22 @@ void worker_processer(cycle_t *cycle, void *data)
 		
         exit(PROCESS_FATAL_EXIT);
 	}
+
+	if (create_blk_copier(cycle) != DFS_OK) 
+	{
+        dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno, 
+            "create_blk_copier failed");
+		
+        exit(PROCESS_FATAL_EXIT);
+	}
+
+	if (create_blk_deleters(cycle) != DFS_OK) 
+	{
+        dfs_log_error(cycle->error_log, DFS_LOG_ALERT, errno, 
+            "create_blk_deleters failed");
+		
+        exit(PROCESS_FATAL_EXIT);
+	}
     
     if (create_worker_thread(cycle) != DFS_OK) 
 	{
@@ -228,6 +260,9 @@ void worker_processer(cycle_t *cycle, void *data)
             stop_worker_thread();
 			stop_ns_service_thread();
 			blk_scanner_running = DFS_FALSE;
+			blk_copier_running = DFS_FALSE;
+			blk_deleter_running = DFS_FALSE;
+			cmd_channel_running = DFS_FALSE;
 			
             break;
         }
@@ -519,7 +554,7 @@ static int create_ns_service_thread(cycle_t *cycle)
     conf_server_t *sconf = (conf_server_t *)cycle->sconf;
 
 	int i = 0;
-	uchar_t names[16][64];
+	uchar_t names[NS_SRV_MAX][64];
 	
 	ns_service_num = get_ns_srv_names(sconf->ns_srv.data, names);
 
@@ -542,6 +577,7 @@ static int create_ns_service_thread(cycle_t *cycle)
             return DFS_ERROR;
         }
 
+		ns_service_threads[i].ns_info.idx = i;
 		ns_service_threads[i].run_func = thread_ns_service_cycle;
         ns_service_threads[i].running = DFS_TRUE;
         ns_service_threads[i].state = THREAD_ST_UNSTART;
@@ -580,7 +616,8 @@ static int get_ns_srv_names(uchar_t *path, uchar_t names[][64])
     uchar_t *token = NULL;
     int      i = 0;
 
-    for (str = path ; ; str = NULL, token = NULL, i++)
+    // the ones past NS_SRV_MAX are left out
+    for (str = path ; i < NS_SRV_MAX; str = NULL, token = NULL, i++)
     {
         token = (uchar_t *)strtok_r((char *)str, ",", &saveptr);
         if (token == NULL)
@@ -588,8 +625,8 @@ static int get_ns_srv_names(uchar_t *path, uchar_t names[][64])
             break;
         }
 
-        memset(names[i], 0x00, PATH_LEN);
-		strcpy((char *)names[i], (const char *)token);
+        memset(names[i], 0x00, 64);
+		strncpy((char *)names[i], (const char *)token, 63);
     }
 
     return i;
@@ -647,3 +684,72 @@ static int create_data_blk_scanner(cycle_t *cycle)
     return DFS_OK;
 }
 
+// as many as the namenode lets a datanode have in flight
+static int create_blk_copier(cycle_t *cycle)
+{
+    pthread_t      pid;
+	uint32_t       i = 0;
+	conf_server_t *sconf = (conf_server_t *)cycle->sconf;
+
+	blk_copier_init();
+
+	for (i = 0; i < sconf->copy_threads; i++) 
+	{
+	    if (pthread_create(&pid, NULL, &blk_copier_start, NULL) != DFS_OK) 
+        {
+	        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
+			    "create blk_copier thread failed");
+
+		    return DFS_ERROR;
+	    }
+	}
+
+    return DFS_OK;
+}
+
+// one per namenode, beside its ns service thread
+static int create_cmd_channels(cycle_t *cycle)
+{
+    pthread_t pid;
+
+	for (int i = 0; i < ns_service_num; i++) 
+	{
+        if (pthread_create(&pid, NULL, &cmd_channel_start, 
+			&ns_service_threads[i]) != DFS_OK) 
+        {
+	        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
+			    "create cmd_channel thread failed");
+
+		    return DFS_ERROR;
+	    }
+	}
+
+    return DFS_OK;
+}
+
+// one per storage dir
+static int create_blk_deleters(cycle_t *cycle)
+{
+    pthread_t pid;
+	int       n = get_storage_dir_num();
+
+	if (blk_deleter_init(n) != DFS_OK) 
+	{
+        return DFS_ERROR;
+	}
+
+	for (long i = 0; i < n; i++) 
+	{
+        if (pthread_create(&pid, NULL, &blk_deleter_start, (void *)i) 
+			!= DFS_OK) 
+        {
+	        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, errno, 
+			    "create blk_deleter thread failed");
+
+		    return DFS_ERROR;
+	    }
+	}
+
+    return DFS_OK;
+}
+
@@ -0,0 +1,375 @@
+#include <stdlib.h>
+
+#include "nn_balancer.h"
+#include "nn_blk_index.h"
+#include "nn_dn_index.h"
+#include "nn_paxos.h"
+#include "nn_conf.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+
+#define BALANCE_DN_MAX 1024  // datanodes looked at in a pass
+
+typedef struct balance_dn_s
+{
+    uint16_t idx;
+	int      permille;  // of its capacity in use, moves planned included
+	uint64_t capacity;
+	uint64_t used;
+} balance_dn_t;
+
+static balancer_t *g_bal = NULL;
+
+static int balance_key_cmp(const void *arg1, const void *arg2, size_t size);
+static int balance_dn_cmp(const void *a, const void *b);
+static void balance_expire(rb_msec_t now);
+static int balance_plan(balance_dn_t *dns, int n, conf_server_t *sconf, 
+	rb_msec_t now);
+static int balance_move(balance_dn_t *src, balance_dn_t *target, 
+	conf_server_t *sconf, rb_msec_t now);
+static void balance_move_del(balance_move_t *bm);
+static void balance_move_free(void *data);
+
+int nn_balancer_worker_init(cycle_t *cycle)
+{
+    balancer_t *bal = NULL;
+
+	bal = (balancer_t *)memory_calloc(sizeof(balancer_t));
+	if (!bal) 
+	{
+        return DFS_ERROR;
+	}
+
+	bal->moves = dfs_hashtable_create(balance_key_cmp, BALANCE_HASH_SIZE, 
+		dfs_hashtable_hash_key8, NULL);
+	bal->out = (uint16_t *)memory_calloc((DN_INDEX_MAX + 1) 
+		* sizeof(uint16_t));
+	bal->in = (uint16_t *)memory_calloc((DN_INDEX_MAX + 1) 
+		* sizeof(uint16_t));
+	bal->pos = (uint32_t *)memory_calloc((DN_INDEX_MAX + 1) 
+		* sizeof(uint32_t));
+	if (!bal->moves || !bal->out || !bal->in || !bal->pos) 
+	{
+        return DFS_ERROR;
+	}
+
+	queue_init(&bal->pending);
+	pthread_mutex_init(&bal->lock, NULL);
+	bal->balanced = DFS_TRUE;
+
+	g_bal = bal;
+
+    return DFS_OK;
+}
+
+int nn_balancer_worker_release(cycle_t *cycle)
+{
+    balancer_t *bal = g_bal;
+
+	if (!bal) 
+	{
+        return DFS_OK;
+	}
+
+	g_bal = NULL;
+
+	dfs_hashtable_free_items(bal->moves, balance_move_free, NULL);
+	dfs_hashtable_free_memory(bal->moves);
+	memory_free(bal->out, (DN_INDEX_MAX + 1) * sizeof(uint16_t));
+	memory_free(bal->in, (DN_INDEX_MAX + 1) * sizeof(uint16_t));
+	memory_free(bal->pos, (DN_INDEX_MAX + 1) * sizeof(uint32_t));
+	pthread_mutex_destroy(&bal->lock);
+	memory_free(bal, sizeof(balancer_t));
+
+    return DFS_OK;
+}
+
+// datanode dn reported block id, if it is the target of a move the 
+// replica on the source goes
+void balance_replica_added(long id, uint16_t dn)
+{
+    uint16_t        src = 0;
+    balance_move_t *bm = NULL;
+
+	if (!g_bal || dfs_hashtable_empty(g_bal->moves)) 
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&g_bal->lock);
+
+	bm = (balance_move_t *)dfs_hashtable_lookup(g_bal->moves, 
+		&id, sizeof(id));
+	if (!bm || bm->target != dn) 
+	{
+	    pthread_mutex_unlock(&g_bal->lock);
+
+		return;
+	}
+
+	src = bm->src;
+	balance_move_del(bm);
+
+	pthread_mutex_unlock(&g_bal->lock);
+
+	if (drop_blk_replica(id, src) == DFS_OK) 
+	{
+        notify_dn_2_delete_blk(id, src);
+	}
+}
+
+// called from the task threads, one of them runs a pass every 
+// balance_interval on the leader namenode
+void balancer_run(rb_msec_t now)
+{
+    int            n = 0;
+	int            planned = 0;
+	conf_server_t *sconf = NULL;
+	balance_dn_t  *dns = NULL;
+	dn_usage_t    *usage = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	if (!g_bal || !sconf->balance_threshold
+		|| now - g_bal->last_run < (rb_msec_t)sconf->balance_interval * 1000
+		|| pthread_mutex_trylock(&g_bal->lock) != 0) 
+	{
+        return;
+	}
+
+	if (now - g_bal->last_run < (rb_msec_t)sconf->balance_interval * 1000)
+	{
+	    pthread_mutex_unlock(&g_bal->lock);
+
+        return;
+	}
+
+	g_bal->last_run = now;
+
+	balance_expire(now);
+
+	if (!nn_paxos_is_leader()) 
+	{
+	    pthread_mutex_unlock(&g_bal->lock);
+
+        return;
+	}
+
+	usage = (dn_usage_t *)malloc(BALANCE_DN_MAX * sizeof(dn_usage_t));
+	dns = (balance_dn_t *)malloc(BALANCE_DN_MAX * sizeof(balance_dn_t));
+	if (usage && dns) 
+	{
+	    n = get_dn_usage(usage, BALANCE_DN_MAX);
+		
+        for (int i = 0; i < n; i++) 
+		{
+		    dns[i].idx = usage[i].idx;
+			dns[i].capacity = usage[i].capacity;
+			dns[i].used = usage[i].used;
+		}
+
+		planned = balance_plan(dns, n, sconf, now);
+	}
+
+	// logged as the cluster goes out of and back into balance
+	if ((planned > 0 || g_bal->pending_n > 0) == g_bal->balanced) 
+	{
+	    g_bal->balanced = !g_bal->balanced;
+		
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			g_bal->balanced ? "datanodes are balanced" 
+			: "balancing datanodes, %d moves", planned);
+	}
+
+	pthread_mutex_unlock(&g_bal->lock);
+
+	free(usage);
+	free(dns);
+}
+
+// moves from the fullest datanodes to the emptiest, until each is 
+// within balance_threshold percent of the cluster's use or runs out of 
+// balance_moves. returns the moves sent off
+static int balance_plan(balance_dn_t *dns, int n, conf_server_t *sconf, 
+	rb_msec_t now)
+{
+    int      i = 0;
+	int      j = 0;
+	int      lo = 0;
+	int      hi = 0;
+	int      planned = 0;
+	int      moves = sconf->balance_moves;
+	uint64_t used = 0;
+	uint64_t capacity = 0;
+
+	if (n < 2) 
+	{
+        return 0;
+	}
+
+	for (i = 0; i < n; i++) 
+	{
+        used += dns[i].used;
+		capacity += dns[i].capacity;
+		dns[i].permille = dns[i].used / (dns[i].capacity / 1000 + 1);
+	}
+
+	lo = used / (capacity / 1000 + 1);
+	hi = lo + sconf->balance_threshold * 10;
+	lo = lo > (int)sconf->balance_threshold * 10 
+		? lo - sconf->balance_threshold * 10 : 0;
+
+	qsort(dns, n, sizeof(balance_dn_t), balance_dn_cmp);
+
+	// the fullest are last, the emptiest first
+	for (i = n - 1; i >= 0 && dns[i].permille > hi; i--) 
+	{
+        for (j = 0; j < i && dns[j].permille < lo; j++) 
+		{
+		    while (dns[i].permille > hi && dns[j].permille < lo
+				&& g_bal->out[dns[i].idx] < moves 
+				&& g_bal->in[dns[j].idx] < moves) 
+			{
+                if (balance_move(&dns[i], &dns[j], sconf, now) != DFS_OK) 
+				{
+                    break;
+				}
+
+				planned++;
+			}
+
+			if (dns[i].permille <= hi || g_bal->out[dns[i].idx] >= moves) 
+			{
+                break;
+			}
+		}
+	}
+
+	return planned;
+}
+
+// one block from src to target, counted as moved right away so a pass 
+// does not overshoot
+static int balance_move(balance_dn_t *src, balance_dn_t *target, 
+	conf_server_t *sconf, rb_msec_t now)
+{
+    long            id = 0;
+	uint64_t        size = 0;
+	balance_move_t *bm = NULL;
+
+	if (pick_blk_to_move(src->idx, target->idx, &g_bal->pos[src->idx], 
+		&id, &size) != DFS_OK) 
+	{
+        return DFS_DECLINED;
+	}
+
+	// a block already on its way somewhere waits for that move
+	if (dfs_hashtable_lookup(g_bal->moves, &id, sizeof(id))) 
+	{
+        return DFS_DECLINED;
+	}
+
+	bm = (balance_move_t *)calloc(1, sizeof(balance_move_t));
+	if (!bm) 
+	{
+        return DFS_ERROR;
+	}
+
+	if (notify_dn_2_copy_blk(id, src->idx, target->idx, 
+		sconf->balance_bandwidth * 1024) != DFS_OK) 
+	{
+	    free(bm);
+		
+        return DFS_ERROR;
+	}
+
+	bm->id = id;
+	bm->ln.key = &bm->id;
+	bm->ln.len = sizeof(bm->id);
+	bm->src = src->idx;
+	bm->target = target->idx;
+	bm->expire = now + (rb_msec_t)sconf->replication_timeout * 1000;
+
+	dfs_hashtable_join(g_bal->moves, &bm->ln);
+	queue_insert_tail(&g_bal->pending, &bm->me);
+	g_bal->pending_n++;
+	g_bal->out[bm->src]++;
+	g_bal->in[bm->target]++;
+
+	src->used = src->used > size ? src->used - size : 0;
+	src->permille = src->used / (src->capacity / 1000 + 1);
+	target->used += size;
+	target->permille = target->used / (target->capacity / 1000 + 1);
+
+	return DFS_OK;
+}
+
+// a move not reported in time is given up, a later pass picks again
+// a move whose copy got to the target unseen is finished, the replica 
+// on the source goes. g_bal->lock held
+static void balance_expire(rb_msec_t now)
+{
+    int             i = 0;
+	int             n = 0;
+	uint64_t        sz = 0;
+	uint16_t        holders[BLK_LOC_DN_MAX];
+    balance_move_t *bm = NULL;
+
+	while (!queue_empty(&g_bal->pending)) 
+	{
+	    bm = queue_data(queue_head(&g_bal->pending), balance_move_t, me);
+		if (bm->expire > now) 
+		{
+            break;
+		}
+
+		n = get_blk_replicas(bm->id, &sz, NULL, holders, BLK_LOC_DN_MAX);
+		for (i = 0; i < n && holders[i] != bm->target; i++) 
+		{
+		}
+
+		if (i < n) 
+		{
+		    if (drop_blk_replica(bm->id, bm->src) == DFS_OK) 
+			{
+                notify_dn_2_delete_blk(bm->id, bm->src);
+			}
+		}
+		else 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0, 
+			    "move of blk %l from datanode %d to %d timed out", 
+			    bm->id, bm->src, bm->target);
+		}
+
+		balance_move_del(bm);
+	}
+}
+
+static void balance_move_del(balance_move_t *bm)
+{
+    queue_remove(&bm->me);
+	dfs_hashtable_remove_link(g_bal->moves, &bm->ln);
+	g_bal->pending_n--;
+	g_bal->out[bm->src]--;
+	g_bal->in[bm->target]--;
+
+	free(bm);
+}
+
+static int balance_key_cmp(const void *arg1, const void *arg2, size_t size)
+{
+    return memcmp(arg1, arg2, sizeof(long)) ? DFS_ERROR : DFS_OK;
+}
+
+static int balance_dn_cmp(const void *a, const void *b)
+{
+    return ((const balance_dn_t *)a)->permille 
+		- ((const balance_dn_t *)b)->permille;
+}
+
+static void balance_move_free(void *data)
+{
+    free(data);
+}
+
@@ -0,0 +1,42 @@
+#ifndef NN_BALANCER_H
+#define NN_BALANCER_H
+
+#include "dfs_types.h"
+#include "dfs_queue.h"
+#include "dfs_hashtable.h"
+#include "nn_cycle.h"
+
+#define BALANCE_HASH_SIZE 4096
+
+// a replica being moved, copied to target first and then dropped on src
+typedef struct balance_move_s
+{
+    dfs_hashtable_link_t ln;
+	queue_t              me;       // on pending, oldest first
+	long                 id;
+	uint16_t             src;
+	uint16_t             target;
+	rb_msec_t            expire;
+} balance_move_t;
+
+typedef struct balancer_s
+{
+    pthread_mutex_t  lock;
+	dfs_hashtable_t *moves;        // by block id
+	queue_t          pending;
+	uint32_t         pending_n;
+	uint16_t        *out;          // moves off each datanode
+	uint16_t        *in;           // and onto it, by datanode index
+	uint32_t        *pos;          // where picking resumes, by index
+	rb_msec_t        last_run;
+	int              balanced;
+} balancer_t;
+
+int nn_balancer_worker_init(cycle_t *cycle);
+int nn_balancer_worker_release(cycle_t *cycle);
+
+void balance_replica_added(long id, uint16_t dn);
+void balancer_run(rb_msec_t now);
+
+#endif
+
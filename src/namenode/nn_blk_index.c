@@ -5,8 +5,13 @@
 #include "dfs_commpool.h"
 #include "dfs_mblks.h"
 #include "nn_time.h"
+#include "nn_dn_index.h"
+#include "nn_replication.h"
+#include "nn_balancer.h"
+#include "nn_paxos.h"
 
 #define BLK_NUM_IN_DN 100000
+#define BLK_MOVE_SCAN 64     // blocks of a datanode looked at for one move
 
 typedef struct my_uid_s 
 {
@@ -20,9 +25,25 @@ typedef struct uid_context_s
     dfs_atomic_lock_t seq_lock;
 } uid_context_t;
 
+typedef struct lost_blk_s
+{
+    long     id;
+	uint16_t held;
+	uint16_t live; // of held, on datanodes in service
+	uint16_t want;
+} lost_blk_t;
+
+typedef struct blk_list_s
+{
+    lost_blk_t *blks;
+	uint32_t    num;
+	uint32_t    cap;
+} blk_list_t;
+
 static uid_context_t g_uid_ctx;
 
 static blk_cache_mgmt_t *g_nn_bcm = NULL;
+static dn_blks_t        *g_dn_blks = NULL; // by datanode index
 
 static blk_cache_mgmt_t *blk_cache_mgmt_new_init();
 static blk_cache_mgmt_t *blk_cache_mgmt_create(size_t index_num);
@@ -37,6 +58,20 @@ static void blk_cache_mgmt_release(blk_cache_mgmt_t *bcm);
 static int uint64_cmp(const void *s1, const void *s2, size_t sz);
 static size_t req_hash(const void *data, size_t data_size, 
 	size_t hashtable_size);
+static blk_replica_t *blk_replica(blk_store_t *blk, int i);
+static int blk_replica_add(blk_store_t *blk, uint16_t dn);
+static void blk_replica_del(blk_store_t *blk, int i);
+static int blk_replica_find(blk_store_t *blk, uint16_t dn);
+static blk_store_t *blk_store_get(long id, long size);
+static void blk_store_free(void *data);
+static uint64_t *blk_report_ids(uint16_t dn, uint32_t *num);
+static void blk_report_end(dn_blks_t *dl);
+static void blk_report_gone(uint16_t dn, long id, blk_list_t *gone, 
+	const dn_serving_t *ds);
+static int blk_list_add(blk_list_t *l, long id, blk_store_t *blk, 
+	const dn_serving_t *ds);
+static int blk_in_service(blk_store_t *blk, const dn_serving_t *ds);
+static int uint64_sort_cmp(const void *a, const void *b);
 
 int nn_blk_index_worker_init(cycle_t *cycle)
 {
@@ -46,6 +81,13 @@ int nn_blk_index_worker_init(cycle_t *cycle)
         return DFS_ERROR;
     }
 
+	g_dn_blks = (dn_blks_t *)memory_calloc((DN_INDEX_MAX + 1) 
+		* sizeof(dn_blks_t));
+	if (!g_dn_blks) 
+	{
+        return DFS_ERROR;
+	}
+
 	dfs_atomic_lock_init(&g_uid_ctx.seq_lock);
 	
     return DFS_OK;
@@ -55,6 +97,15 @@ int nn_blk_index_worker_release(cycle_t *cycle)
 {
     blk_cache_mgmt_release(g_nn_bcm);
 	g_nn_bcm = NULL;
+
+	for (int i = 0; i <= DN_INDEX_MAX; i++) 
+	{
+        free(g_dn_blks[i].blks);
+		free(g_dn_blks[i].report);
+	}
+
+	memory_free(g_dn_blks, (DN_INDEX_MAX + 1) * sizeof(dn_blks_t));
+	g_dn_blks = NULL;
 	
     return DFS_OK;
 }
@@ -197,6 +248,8 @@ static void blk_cache_mgmt_release(blk_cache_mgmt_t *bcm)
 {
     assert(bcm);
 
+	dfs_hashtable_free_items(bcm->blk_htable, blk_store_free, NULL);
+
 	pthread_rwlock_destroy(&bcm->cache_rwlock);
 
     blk_mem_mgmt_destroy(&bcm->mem_mgmt);
@@ -230,49 +283,755 @@ blk_store_t *get_blk_store_obj(long id)
 
 int block_object_del(long id)
 {
+    int          i = 0;
+	int          n = 0;
     blk_store_t *blk = NULL;
+	uint16_t     dns[BLK_INLINE_REPS];
+	uint16_t    *pdns = dns;
 	
-	blk = get_blk_store_obj(id);
+    pthread_rwlock_wrlock(&g_nn_bcm->cache_rwlock);
+
+	blk = (blk_store_t *)dfs_hashtable_lookup(g_nn_bcm->blk_htable, 
+		&id, sizeof(id));
 	if (!blk) 
 	{
+	    pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+		
         return DFS_OK;
 	}
 
-	notify_dn_2_delete_blk(id, blk->dn_ip);
+	if (blk->rep_num > BLK_INLINE_REPS) 
+	{
+        pdns = (uint16_t *)malloc(blk->rep_num * sizeof(uint16_t));
+		if (!pdns) 
+		{
+            pdns = dns;
+		}
+	}
 
-	queue_remove(&blk->dn_me);
-	
-    pthread_rwlock_wrlock(&g_nn_bcm->cache_rwlock);
+	// the ones not copied for lack of memory are left on their datanodes
+	while (blk->rep_num > 0) 
+	{
+	    if (pdns != dns || n < BLK_INLINE_REPS) 
+		{
+            pdns[n++] = blk_replica(blk, blk->rep_num - 1)->dn;
+		}
+		
+        blk_replica_del(blk, blk->rep_num - 1);
+	}
 
     dfs_hashtable_remove_link(g_nn_bcm->blk_htable, &blk->ln);
 
+	free(blk->more);
 	mem_put(blk);
 
 	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	repl_blk_removed(id);
+
+	for (i = 0; i < n; i++) 
+	{
+        notify_dn_2_delete_blk(id, pdns[i]);
+	}
+
+	if (pdns != dns) 
+	{
+        free(pdns);
+	}
     
     return DFS_OK;
 }
 
-blk_store_t *add_block(long blk_id, long blk_sz, char dn_ip[32])
+// what datanode dn stored and dropped lately, in one pass under the lock. 
+// a block is created on the first report of it, each datanode holding 
+// it is recorded once
+int blk_recv_apply(uint16_t dn, const blk_recv_entry_t *ents, int num)
+{
+    int                     i = 0;
+	int                     rs = DFS_OK;
+	uint16_t                rep_num = 0;
+    blk_store_t            *blk = NULL;
+	const blk_recv_entry_t *e = NULL;
+	blk_list_t              gone;
+	blk_list_t              found;
+	dn_serving_t            ds;
+
+	if (!dn) 
+	{
+        return DFS_ERROR;
+	}
+
+	memset(&gone, 0x00, sizeof(blk_list_t));
+	memset(&found, 0x00, sizeof(blk_list_t));
+
+	// taken before the block index, cache_rwlock is not to nest in it
+	get_dn_serving(&ds);
+
+	pthread_rwlock_wrlock(&g_nn_bcm->cache_rwlock);
+
+	for (i = 0; i < num; i++) 
+	{
+	    e = &ents[i];
+		
+        if (BLK_DELETED == e->state) 
+		{
+            blk_report_gone(dn, e->id, &gone, &ds);
+
+			continue;
+		}
+
+		blk = blk_store_get(e->id, e->size);
+		if (!blk) 
+		{
+		    rs = DFS_ERROR;
+			
+            break;
+		}
+
+		if (!blk->size) 
+		{
+            blk->size = e->size;
+		}
+
+		rep_num = blk->rep_num;
+
+		if (blk_replica_add(blk, dn) != DFS_OK) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+				"no memory to record blk %l on datanode %d", blk->id, dn);
+		}
+		else if (blk->rep_num > rep_num) 
+		{
+            blk_list_add(&found, blk->id, blk, &ds);
+		}
+	}
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	for (i = 0; i < (int)gone.num; i++) 
+	{
+        repl_check_blk(gone.blks[i].id, gone.blks[i].held, 
+			gone.blks[i].live, 
+			gone.blks[i].want);
+	}
+
+	for (i = 0; i < (int)found.num; i++) 
+	{
+        repl_replica_added(found.blks[i].id, dn, found.blks[i].held, 
+			found.blks[i].live, 
+			found.blks[i].want);
+		balance_replica_added(found.blks[i].id, dn);
+	}
+
+	free(gone.blks);
+	free(found.blks);
+	
+    return rs;
+}
+
+// the replication a block was allocated with, it has no replica yet
+int set_blk_replication(long id, short rep)
+{
+    blk_store_t *blk = NULL;
+
+	pthread_rwlock_wrlock(&g_nn_bcm->cache_rwlock);
+
+	blk = blk_store_get(id, 0);
+	if (blk) 
+	{
+        blk->rep_want = rep > 0 ? rep : BLK_DEF_REPLICATION;
+	}
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	return blk ? DFS_OK : DFS_ERROR;
+}
+
+// the datanodes holding block id, at most max of them, DFS_ERROR if the 
+// block is unknown
+int get_blk_replicas(long id, uint64_t *size, int *want, 
+	uint16_t *dns, int max)
 {
+    int          i = 0;
     blk_store_t *blk = NULL;
 
+    pthread_rwlock_rdlock(&g_nn_bcm->cache_rwlock);
+
+	blk = (blk_store_t *)dfs_hashtable_lookup(g_nn_bcm->blk_htable, 
+		&id, sizeof(id));
+	if (!blk) 
+	{
+	    pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+		
+        return DFS_ERROR;
+	}
+
+	*size = blk->size;
+
+	if (want) 
+	{
+        *want = blk->rep_want ? blk->rep_want : BLK_DEF_REPLICATION;
+	}
+	
+	for (i = 0; i < blk->rep_num && i < max; i++) 
+	{
+        dns[i] = blk_replica(blk, i)->dn;
+	}
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	return i;
+}
+
+// a datanode is gone, forget every replica it held, the blocks stay and 
+// the ones left short are handed to the replication monitor
+uint32_t remove_dn_blocks(uint16_t dn)
+{
+    int          i = 0;
+    uint32_t     num = 0;
+	uint32_t     lost_n = 0;
+    dn_blks_t   *dl = NULL;
+	blk_store_t *blk = NULL;
+	lost_blk_t  *lost = NULL;
+	dn_serving_t ds;
+
+	get_dn_serving(&ds);
+
+	pthread_rwlock_wrlock(&g_nn_bcm->cache_rwlock);
+
+	dl = &g_dn_blks[dn];
+	num = dl->num;
+
+	if (num > 0) 
+	{
+        lost = (lost_blk_t *)malloc(num * sizeof(lost_blk_t));
+		if (!lost) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+				"no memory to queue the %ud blocks of datanode %d", 
+				num, dn);
+		}
+	}
+
+	while (dl->num > 0) 
+	{
+	    blk = dl->blks[dl->num - 1];
+		
+        i = blk_replica_find(blk, dn);
+		if (i >= 0) 
+		{
+            blk_replica_del(blk, i);
+		}
+		else 
+		{
+		    // not recorded on the block, should never be
+            dl->num--;
+		}
+
+		if (lost) 
+		{
+		    lost[lost_n].id = blk->id;
+			lost[lost_n].held = blk->rep_num;
+			lost[lost_n].live = blk_in_service(blk, &ds);
+			lost[lost_n].want = blk->rep_want ? blk->rep_want 
+				: BLK_DEF_REPLICATION;
+			lost_n++;
+		}
+	}
+
+	free(dl->blks);
+	dl->blks = NULL;
+	dl->cap = 0;
+
+	blk_report_end(dl);
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	for (i = 0; i < (int)lost_n; i++) 
+	{
+        repl_check_blk(lost[i].id, lost[i].held, lost[i].live, 
+			lost[i].want);
+	}
+
+	free(lost);
+
+	return num;
+}
+
+// a block on src that target could take a copy of, looked for from *pos 
+// on in src's blocks. only fully replicated ones are moved, the short 
+// ones are the replication monitor's
+int pick_blk_to_move(uint16_t src, uint16_t target, uint32_t *pos, 
+	long *id, uint64_t *size)
+{
+    int          i = 0;
+	int          want = 0;
+	dn_blks_t   *dl = NULL;
+	blk_store_t *blk = NULL;
+
+	pthread_rwlock_rdlock(&g_nn_bcm->cache_rwlock);
+
+	dl = &g_dn_blks[src];
+
+	for (i = 0; i < BLK_MOVE_SCAN && i < (int)dl->num; i++) 
+	{
+	    if (*pos >= dl->num) 
+		{
+            *pos = 0;
+		}
+		
+        blk = dl->blks[(*pos)++];
+		want = blk->rep_want ? blk->rep_want : BLK_DEF_REPLICATION;
+
+		if (blk->size > 0 && blk->rep_num >= want 
+			&& blk_replica_find(blk, target) < 0) 
+		{
+		    *id = blk->id;
+			*size = blk->size;
+
+			pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+			
+            return DFS_OK;
+		}
+	}
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	return DFS_DECLINED;
+}
+
+// forget the replica on dn of a block moved off it, only while the 
+// others still make up its replication
+int drop_blk_replica(long id, uint16_t dn)
+{
+    int          i = -1;
+	int          want = 0;
+	blk_store_t *blk = NULL;
+
+	pthread_rwlock_wrlock(&g_nn_bcm->cache_rwlock);
+
+	blk = (blk_store_t *)dfs_hashtable_lookup(g_nn_bcm->blk_htable, 
+		&id, sizeof(id));
+	if (blk) 
+	{
+	    want = blk->rep_want ? blk->rep_want : BLK_DEF_REPLICATION;
+		i = blk->rep_num > want ? blk_replica_find(blk, dn) : -1;
+		
+        if (i >= 0) 
+		{
+            blk_replica_del(blk, i);
+		}
+	}
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	return i >= 0 ? DFS_OK : DFS_DECLINED;
+}
+
+// up to max of the blocks on leaving datanode dn from *pos on, the ones 
+// the datanodes in service do not make up the replication of are counted 
+// in shorts and handed to the replication monitor. DFS_OK once the end 
+// of dn's blocks is reached, *pos starts over then
+int drain_dn_blks(uint16_t dn, uint32_t *pos, uint32_t max, 
+	uint32_t *shorts)
+{
+    int          rs = DFS_AGAIN;
+    uint32_t     i = 0;
+	dn_blks_t   *dl = NULL;
+	blk_store_t *blk = NULL;
+	blk_list_t   drain;
+	dn_serving_t ds;
+
+	memset(&drain, 0x00, sizeof(blk_list_t));
+
+	get_dn_serving(&ds);
+
+	pthread_rwlock_rdlock(&g_nn_bcm->cache_rwlock);
+
+	dl = &g_dn_blks[dn];
+
+	for (i = 0; i < max; i++) 
+	{
+	    if (*pos >= dl->num) 
+		{
+		    *pos = 0;
+            rs = DFS_OK;
+
+			break;
+		}
+		
+        blk = dl->blks[(*pos)++];
+
+		if (blk_in_service(blk, &ds) < (blk->rep_want ? blk->rep_want 
+			: BLK_DEF_REPLICATION)) 
+		{
+		    (*shorts)++;
+			
+            blk_list_add(&drain, blk->id, blk, &ds);
+		}
+	}
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	for (i = 0; i < drain.num; i++) 
+	{
+        repl_drain_blk(drain.blks[i].id);
+	}
+
+	free(drain.blks);
+
+	return rs;
+}
+
+// one frame of a full block report, merged in a single pass with the 
+// ids the datanode was known to hold when the report began. replicas 
+// missing from the report are dropped, new ones recorded, and unknown or 
+// mis-sized ones are deleted on the datanode. DFS_ERROR drops the report, 
+// the datanode sends a new one later
+int blk_report_apply(uint16_t dn, const blk_report_head_t *head, 
+	const blk_report_entry_t *ents, blk_report_stat_t *stat)
+{
+    int                       rs = DFS_OK;
+	int                       known = DFS_FALSE;
+    uint32_t                  i = 0;
+	uint32_t                  ids_n = 0;
+	int                       ready = DFS_FALSE;
+	uint16_t                  rep_num = 0;
+	uint64_t                 *ids = NULL;
+	dn_blks_t                *dl = NULL;
+	blk_store_t              *blk = NULL;
+	const blk_report_entry_t *e = NULL;
+	blk_list_t                gone;
+	blk_list_t                found;
+	blk_list_t                invalid;
+	dn_serving_t              ds;
+
+	if (!dn) 
+	{
+        return DFS_ERROR;
+	}
+
+	memset(&gone, 0x00, sizeof(blk_list_t));
+	memset(&found, 0x00, sizeof(blk_list_t));
+	memset(&invalid, 0x00, sizeof(blk_list_t));
+
+	// a block only a lagging namenode does not know of is not invalid
+	ready = nn_paxos_leader_ready();
+	get_dn_serving(&ds);
+
+	// sorted outside the write lock, what changes meanwhile is either 
+	// reported again or already off the datanode
+	if (0 == head->seq) 
+	{
+        ids = blk_report_ids(dn, &ids_n);
+		if (!ids && ids_n > 0) 
+		{
+            return DFS_ERROR;
+		}
+	}
+
 	pthread_rwlock_wrlock(&g_nn_bcm->cache_rwlock);
 
+	dl = &g_dn_blks[dn];
+
+	if (0 == head->seq) 
+	{
+	    blk_report_end(dl);
+		
+        dl->report = ids;
+		dl->report_n = ids_n;
+		dl->report_id = head->report_id;
+		dl->reporting = DFS_TRUE;
+	}
+	else if (!dl->reporting || dl->report_id != head->report_id 
+		|| dl->report_seq != head->seq) 
+	{
+	    blk_report_end(dl);
+		
+        pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+		return DFS_ERROR;
+	}
+
+	for (i = 0; i < head->num; i++) 
+	{
+	    e = &ents[i];
+
+		if ((dl->report_seq > 0 || i > 0) && e->id <= dl->report_last) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0, 
+				"block report of datanode %d is out of order at %uL", 
+				dn, e->id);
+
+		    blk_report_end(dl);
+			rs = DFS_ERROR;
+
+			goto out;
+		}
+
+		dl->report_last = e->id;
+
+		while (dl->report_pos < dl->report_n 
+			&& dl->report[dl->report_pos] < e->id) 
+		{
+            blk_report_gone(dn, dl->report[dl->report_pos++], &gone, &ds);
+		}
+
+		known = dl->report_pos < dl->report_n 
+			&& dl->report[dl->report_pos] == e->id;
+		if (known) 
+		{
+            dl->report_pos++;
+		}
+
+		blk = (blk_store_t *)dfs_hashtable_lookup(g_nn_bcm->blk_htable, 
+			&e->id, sizeof(long));
+		if (!blk || (blk->size && blk->size != e->size)) 
+		{
+		    if (!ready) 
+			{
+                continue;
+			}
+			
+		    if (blk) 
+			{
+                blk_report_gone(dn, blk->id, &gone, &ds);
+			}
+
+			blk_list_add(&invalid, e->id, NULL, NULL);
+
+			continue;
+		}
+
+		if (known) 
+		{
+            continue;
+		}
+
+		if (!blk->size) 
+		{
+            blk->size = e->size;
+		}
+
+		rep_num = blk->rep_num;
+		
+		if (blk_replica_add(blk, dn) != DFS_OK) 
+		{
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+				"no memory to record blk %l on datanode %d", blk->id, dn);
+		}
+		else if (blk->rep_num > rep_num) 
+		{
+            blk_list_add(&found, blk->id, blk, &ds);
+		}
+	}
+
+	if (head->last) 
+	{
+	    while (dl->report_pos < dl->report_n) 
+		{
+            blk_report_gone(dn, dl->report[dl->report_pos++], &gone, &ds);
+		}
+	}
+	else 
+	{
+        dl->report_seq++;
+	}
+
+	dl->report_stat.added += found.num;
+	dl->report_stat.removed += gone.num;
+	dl->report_stat.invalid += invalid.num;
+	*stat = dl->report_stat;
+
+	if (head->last) 
+	{
+        blk_report_end(dl);
+	}
+
+out:
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	for (i = 0; i < gone.num; i++) 
+	{
+        repl_check_blk(gone.blks[i].id, gone.blks[i].held, 
+			gone.blks[i].live, 
+			gone.blks[i].want);
+	}
+
+	for (i = 0; i < found.num; i++) 
+	{
+        repl_replica_added(found.blks[i].id, dn, found.blks[i].held, 
+			found.blks[i].live, 
+			found.blks[i].want);
+		balance_replica_added(found.blks[i].id, dn);
+	}
+
+	for (i = 0; i < invalid.num; i++) 
+	{
+        notify_dn_2_delete_blk(invalid.blks[i].id, dn);
+	}
+
+	free(gone.blks);
+	free(found.blks);
+	free(invalid.blks);
+
+	return rs;
+}
+
+static blk_replica_t *blk_replica(blk_store_t *blk, int i)
+{
+    return i < BLK_INLINE_REPS ? &blk->reps[i] 
+		: &blk->more[i - BLK_INLINE_REPS];
+}
+
+static int blk_replica_add(blk_store_t *blk, uint16_t dn)
+{
+    int            more = 0;
+	uint32_t       cap = 0;
+	dn_blks_t     *dl = NULL;
+	blk_replica_t *r = NULL;
+	blk_replica_t *rs = NULL;
+	blk_store_t  **blks = NULL;
+
+	if (blk_replica_find(blk, dn) >= 0) 
+	{
+        return DFS_OK;
+	}
+
+	if (blk->rep_num == blk->rep_cap) 
+	{
+	    more = blk->rep_cap - BLK_INLINE_REPS;
+		more = more ? more * 2 : 2;
+		
+        rs = (blk_replica_t *)realloc(blk->more, 
+			more * sizeof(blk_replica_t));
+		if (!rs) 
+		{
+            return DFS_ERROR;
+		}
+
+		blk->more = rs;
+		blk->rep_cap = BLK_INLINE_REPS + more;
+	}
+
+	dl = &g_dn_blks[dn];
+	
+	if (dl->num == dl->cap) 
+	{
+	    cap = dl->cap ? dl->cap * 2 : 1024;
+		
+        blks = (blk_store_t **)realloc(dl->blks, 
+			cap * sizeof(blk_store_t *));
+		if (!blks) 
+		{
+            return DFS_ERROR;
+		}
+
+		dl->blks = blks;
+		dl->cap = cap;
+	}
+
+	r = blk_replica(blk, blk->rep_num++);
+	r->dn = dn;
+	r->pos = dl->num;
+	
+	dl->blks[dl->num++] = blk;
+
+	return DFS_OK;
+}
+
+static void blk_replica_del(blk_store_t *blk, int i)
+{
+    int            j = 0;
+    blk_replica_t *r = NULL;
+	blk_store_t   *last = NULL;
+	dn_blks_t     *dl = NULL;
+
+	r = blk_replica(blk, i);
+	dl = &g_dn_blks[r->dn];
+
+	// the datanode's last block takes the hole
+	last = dl->blks[--dl->num];
+	if (r->pos != dl->num) 
+	{
+        dl->blks[r->pos] = last;
+
+		for (j = 0; j < last->rep_num; j++) 
+		{
+            if (blk_replica(last, j)->dn == r->dn) 
+			{
+                blk_replica(last, j)->pos = r->pos;
+
+				break;
+			}
+		}
+	}
+
+	// and the block's last replica takes this one's slot
+	*r = *blk_replica(blk, --blk->rep_num);
+}
+
+// the replicas of blk on datanodes in service as of ds
+static int blk_in_service(blk_store_t *blk, const dn_serving_t *ds)
+{
+    int i = 0;
+	int n = 0;
+
+	for (i = 0; i < blk->rep_num; i++) 
+	{
+	    if (dn_serving_has(ds, blk_replica(blk, i)->dn)) 
+		{
+            n++;
+		}
+	}
+
+	return n;
+}
+
+static int blk_replica_find(blk_store_t *blk, uint16_t dn)
+{
+    int i = 0;
+
+	for (i = 0; i < blk->rep_num; i++) 
+	{
+        if (blk_replica(blk, i)->dn == dn) 
+		{
+            return i;
+		}
+	}
+
+	return -1;
+}
+
+// bcm locked for writing
+static blk_store_t *blk_store_get(long id, long size)
+{
+    blk_store_t *blk = NULL;
+
+	blk = (blk_store_t *)dfs_hashtable_lookup(g_nn_bcm->blk_htable, 
+		&id, sizeof(id));
+	if (blk) 
+	{
+        return blk;
+	}
+
 	blk = (blk_store_t *)mem_get0(g_nn_bcm->mem_mgmt.free_mblks);
 	if (!blk)
 	{
-	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "mem_get0 err");
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+			"mem_get0 err");
 
 		return NULL;
 	}
 
 	queue_init(&blk->fi_me);
-	queue_init(&blk->dn_me);
 	
-	blk->id = blk_id;
-	blk->size = blk_sz;
-	strcpy(blk->dn_ip, dn_ip);
+	blk->id = id;
+	blk->size = size;
+	blk->rep_num = 0;
+	blk->rep_cap = BLK_INLINE_REPS;
+	blk->rep_want = 0;
+	blk->more = NULL;
 
 	blk->ln.key = &blk->id;
     blk->ln.len = sizeof(blk->id);
@@ -280,9 +1039,15 @@ blk_store_t *add_block(long blk_id, long blk_sz, char dn_ip[32])
 
 	dfs_hashtable_join(g_nn_bcm->blk_htable, &blk->ln);
 
-	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
-	
-    return blk;
+	return blk;
+}
+
+static void blk_store_free(void *data)
+{
+    blk_store_t *blk = (blk_store_t *)data;
+
+	free(blk->more);
+	blk->more = NULL;
 }
 
 uint64_t generate_uid()
@@ -303,4 +1068,113 @@ uint64_t generate_uid()
     return uid;
 }
 
+// the ids recorded on datanode dn, ascending
+static uint64_t *blk_report_ids(uint16_t dn, uint32_t *num)
+{
+    uint32_t   i = 0;
+	uint64_t  *ids = NULL;
+	dn_blks_t *dl = NULL;
+
+	pthread_rwlock_rdlock(&g_nn_bcm->cache_rwlock);
+
+	dl = &g_dn_blks[dn];
+	*num = dl->num;
+
+	if (dl->num > 0) 
+	{
+        ids = (uint64_t *)malloc(dl->num * sizeof(uint64_t));
+	}
+
+	for (i = 0; ids && i < dl->num; i++) 
+	{
+        ids[i] = dl->blks[i]->id;
+	}
+
+	pthread_rwlock_unlock(&g_nn_bcm->cache_rwlock);
+
+	if (ids) 
+	{
+        qsort(ids, *num, sizeof(uint64_t), uint64_sort_cmp);
+	}
+
+	return ids;
+}
+
+// bcm locked for writing
+static void blk_report_end(dn_blks_t *dl)
+{
+    free(dl->report);
+
+	dl->report = NULL;
+	dl->report_n = 0;
+	dl->report_pos = 0;
+	dl->report_id = 0;
+	dl->report_last = 0;
+	dl->report_seq = 0;
+	dl->reporting = DFS_FALSE;
+	memset(&dl->report_stat, 0x00, sizeof(blk_report_stat_t));
+}
+
+// bcm locked for writing, the replica of block id on dn is no more
+static void blk_report_gone(uint16_t dn, long id, blk_list_t *gone, 
+	const dn_serving_t *ds)
+{
+    int          i = 0;
+    blk_store_t *blk = NULL;
+
+	blk = (blk_store_t *)dfs_hashtable_lookup(g_nn_bcm->blk_htable, 
+		&id, sizeof(id));
+	if (!blk) 
+	{
+        return;
+	}
+
+	i = blk_replica_find(blk, dn);
+	if (i < 0) 
+	{
+        return;
+	}
+
+	blk_replica_del(blk, i);
+	blk_list_add(gone, id, blk, ds);
+}
+
+// with the replicas in service blk has left or now has, if any
+static int blk_list_add(blk_list_t *l, long id, blk_store_t *blk, 
+	const dn_serving_t *ds)
+{
+    uint32_t    cap = 0;
+    lost_blk_t *blks = NULL;
+
+	if (l->num == l->cap) 
+	{
+	    cap = l->cap ? l->cap * 2 : 64;
+		
+        blks = (lost_blk_t *)realloc(l->blks, cap * sizeof(lost_blk_t));
+		if (!blks) 
+		{
+            return DFS_ERROR;
+		}
+
+		l->blks = blks;
+		l->cap = cap;
+	}
+
+	l->blks[l->num].id = id;
+	l->blks[l->num].held = blk ? blk->rep_num : 0;
+	l->blks[l->num].live = blk ? blk_in_service(blk, ds) : 0;
+	l->blks[l->num].want = blk && blk->rep_want ? blk->rep_want 
+		: BLK_DEF_REPLICATION;
+
+	l->num++;
+
+	return DFS_OK;
+}
+
+static int uint64_sort_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
 
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
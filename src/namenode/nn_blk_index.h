@@ -3,6 +3,7 @@
 
 #include "dfs_queue.h"
 #include "dfs_hashtable.h"
+#include "dfs_task_cmd.h"
 #include "nn_cycle.h"
 
 #define PATH_LEN 256
@@ -21,16 +22,56 @@
 #define BLK_POOL_SIZE(count) (BLK_HASH_BUF(count) \
         + BLK_STORE_BUF(count) + BLK_POOL_REMAIN_MEM) 
 
+#define BLK_INLINE_REPS     3
+#define BLK_DEF_REPLICATION 3  // for blocks only known from reports
+
+// a datanode holding a block, dn is its index in the datanode table
+typedef struct blk_replica_s
+{
+    uint16_t dn;
+	uint16_t pad;
+	uint32_t pos;    // of the block in that datanode's dn_blks_t
+} blk_replica_t;
+
 typedef struct blk_store_s
 {
     dfs_hashtable_link_t ln;
     queue_t              fi_me;
-	queue_t              dn_me;
     long                 id;
 	uint64_t             size;
-	char                 dn_ip[32];
+	uint16_t             rep_num;
+	uint16_t             rep_cap;
+	uint16_t             rep_want;
+	uint16_t             pad;
+	blk_replica_t        reps[BLK_INLINE_REPS];
+	blk_replica_t       *more;    // replicas past the inline ones
 } blk_store_t;
 
+typedef struct blk_report_stat_s
+{
+    uint32_t added;
+	uint32_t removed;
+	uint32_t invalid;
+} blk_report_stat_t;
+
+// the blocks one datanode holds, unordered
+typedef struct dn_blks_s
+{
+    blk_store_t     **blks;
+	uint32_t          num;
+	uint32_t          cap;
+	// the full block report being received, report holds the ids known 
+	// on the datanode when it began, ascending
+	uint64_t         *report;
+	uint32_t          report_n;
+	uint32_t          report_pos;
+	uint64_t          report_id;
+	uint64_t          report_last;  // the highest id reported so far
+	uint32_t          report_seq;   // the frame expected next
+	uint32_t          reporting;
+	blk_report_stat_t report_stat;
+} dn_blks_t;
+
 typedef struct blk_cache_mem_s 
 {
     void                *mem;
@@ -52,11 +93,22 @@ int nn_blk_index_worker_release(cycle_t *cycle);
 blk_store_t *get_blk_store_obj(long id);
 int block_object_del(long id);
 
-blk_store_t *add_block(long blk_id, long blk_sz, char dn_ip[32]);
+int blk_recv_apply(uint16_t dn, const blk_recv_entry_t *ents, int num);
+int set_blk_replication(long id, short rep);
+int get_blk_replicas(long id, uint64_t *size, int *want, 
+	uint16_t *dns, int max);
+uint32_t remove_dn_blocks(uint16_t dn);
+int pick_blk_to_move(uint16_t src, uint16_t target, uint32_t *pos, 
+	long *id, uint64_t *size);
+int drop_blk_replica(long id, uint16_t dn);
+int drain_dn_blks(uint16_t dn, uint32_t *pos, uint32_t max, 
+	uint32_t *shorts);
+int blk_report_apply(uint16_t dn, const blk_report_head_t *head, 
+	const blk_report_entry_t *ents, blk_report_stat_t *stat);
 
 uint64_t generate_uid();
 
-int notify_dn_2_delete_blk(long blk_id, char dn_ip[32]);
+int notify_dn_2_delete_blk(long blk_id, uint16_t dn);
 
 #endif
 
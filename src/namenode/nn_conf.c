@@ -28,6 +28,12 @@ static conf_option_t conf_server_option[] =
     { string_make("workers"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, worker_n) },
         
+    { string_make("dn_io_threads"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, dn_io_thread_n) },
+
+    { string_make("cli_io_threads"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, cli_io_thread_n) },
+
     { string_make("bind_for_cli"), conf_parse_bind,
         OPE_EQUAL, offsetof(conf_server_t, bind_for_cli) },
 
@@ -58,6 +64,66 @@ static conf_option_t conf_server_option[] =
     { string_make("max_tqueue_len"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, max_tqueue_len) },
 
+    { string_make("cli_conn_inflight"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, cli_conn_inflight) },
+
+    { string_make("max_inflight"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, max_inflight) },
+
+    { string_make("retry_after"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, retry_after) },
+
+    { string_make("fair_by_group"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, fair_by_group) },
+
+    { string_make("fair_weights"), conf_parse_string,
+        OPE_EQUAL, offsetof(conf_server_t, fair_weights) },
+
+    { string_make("fair_stat_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, fair_stat_interval) },
+
+    { string_make("forward_writes"), conf_parse_nn_macro,
+        OPE_EQUAL, offsetof(conf_server_t, forward_writes) },
+
+    { string_make("retry_cache_size"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, retry_cache_size) },
+
+    { string_make("retry_cache_expiry"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, retry_cache_expiry) },
+
+    { string_make("topology"), conf_parse_string,
+        OPE_EQUAL, offsetof(conf_server_t, topology) },
+
+    { string_make("decommission"), conf_parse_string,
+        OPE_EQUAL, offsetof(conf_server_t, decommission) },
+
+    { string_make("replication_streams"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, replication_streams) },
+
+    { string_make("replication_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, replication_interval) },
+
+    { string_make("replication_timeout"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, replication_timeout) },
+
+    { string_make("invalidate_blks_min"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, invalidate_blks_min) },
+
+    { string_make("invalidate_blks_max"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, invalidate_blks_max) },
+
+    { string_make("balance_threshold"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, balance_threshold) },
+
+    { string_make("balance_interval"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, balance_interval) },
+
+    { string_make("balance_moves"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, balance_moves) },
+
+    { string_make("balance_bandwidth"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, balance_bandwidth) },
+
     { string_make("my_paxos"), conf_parse_string,
         OPE_EQUAL, offsetof(conf_server_t, my_paxos) },
 
@@ -76,12 +142,18 @@ static conf_option_t conf_server_option[] =
     { string_make("checkpoint_num"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, checkpoint_num) },
 
+    { string_make("paxos_hold_log_num"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, paxos_hold_log_num) },
+
     { string_make("index_num"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, index_num) },
 
 	{ string_make("dn_timeout"), conf_parse_int,
         OPE_EQUAL, offsetof(conf_server_t, dn_timeout) },
 
+	{ string_make("dn_stale_timeout"), conf_parse_int,
+        OPE_EQUAL, offsetof(conf_server_t, dn_stale_timeout) },
+
     { string_null, NULL, OPE_EQUAL, 0 }    
 };
 
@@ -151,12 +223,30 @@ static void *conf_server_init(pool_t *pool)
 
 static int conf_server_make_default(void *var)
 {
-    conf_server_t *sconf = (conf_server_t *)var;
+    conf_server_t *sconf = (conf_server_t *)((conf_variable_t *)var)->conf;
     
     set_def_string(&sconf->pid_file,            PID_FILE);
     set_def_int(sconf->recv_buff_len, 		    DEF_RBUFF_LEN);
     set_def_int(sconf->send_buff_len, 		    DEF_SBUFF_LEN);
     set_def_int(sconf->max_tqueue_len, 		    DEF_MMAX_TQUEUE_LEN);
+    set_def_int(sconf->paxos_hold_log_num, 	    DEF_PAXOS_HOLD_LOG_NUM);
+    set_def_int(sconf->dn_io_thread_n, 	        DEF_IO_THREAD_N);
+    set_def_int(sconf->cli_io_thread_n, 	    DEF_IO_THREAD_N);
+    set_def_int(sconf->cli_conn_inflight, 	    DEF_CLI_CONN_INFLIGHT);
+    set_def_int(sconf->max_inflight, 	        DEF_MAX_INFLIGHT);
+    set_def_int(sconf->retry_after, 	        DEF_RETRY_AFTER);
+    set_def_int(sconf->retry_cache_size, 	    DEF_RETRY_CACHE_SIZE);
+    set_def_int(sconf->retry_cache_expiry, 	    DEF_RETRY_CACHE_EXPIRY);
+    set_def_int(sconf->replication_streams, 	DEF_REPLICATION_STREAMS);
+    set_def_int(sconf->replication_interval, 	DEF_REPLICATION_INTERVAL);
+    set_def_int(sconf->replication_timeout, 	DEF_REPLICATION_TIMEOUT);
+    set_def_int(sconf->invalidate_blks_min, 	DEF_INVALIDATE_BLKS_MIN);
+    set_def_int(sconf->invalidate_blks_max, 	DEF_INVALIDATE_BLKS_MAX);
+    set_def_int(sconf->dn_stale_timeout, 	    DEF_DN_STALE_TIMEOUT);
+    set_def_int(sconf->balance_threshold, 	    DEF_BALANCE_THRESHOLD);
+    set_def_int(sconf->balance_interval, 	    DEF_BALANCE_INTERVAL);
+    set_def_int(sconf->balance_moves, 	        DEF_BALANCE_MOVES);
+    set_def_int(sconf->balance_bandwidth, 	    DEF_BALANCE_BANDWIDTH);
 	
     return DFS_OK;
 }
@@ -11,6 +11,8 @@ struct conf_server_s
 {
     int      daemon;
     int      worker_n;
+    int      dn_io_thread_n;
+    int      cli_io_thread_n;
     array_t  bind_for_cli;
     array_t  bind_for_dn;
     uint32_t connection_n;
@@ -21,14 +23,36 @@ struct conf_server_s
     uint32_t recv_buff_len;
     uint32_t send_buff_len;
     uint32_t max_tqueue_len;
+    uint32_t cli_conn_inflight;
+    uint32_t max_inflight;
+    uint32_t retry_after;
+    uint32_t fair_by_group;
+    string_t fair_weights;
+    uint32_t fair_stat_interval;
+    uint32_t forward_writes;
+    uint32_t retry_cache_size;
+    uint32_t retry_cache_expiry;
+    string_t topology;
+    string_t decommission;
+    uint32_t replication_streams;
+    uint32_t replication_interval;
+    uint32_t replication_timeout;
+    uint32_t invalidate_blks_min;
+    uint32_t invalidate_blks_max;
+    uint32_t balance_threshold;
+    uint32_t balance_interval;
+    uint32_t balance_moves;
+    uint32_t balance_bandwidth;
     string_t my_paxos;
     string_t ot_paxos;
     string_t editlog_dir;
     string_t fsimage_dir;
     uint32_t paxos_group_num;
     uint32_t checkpoint_num;
+    uint32_t paxos_hold_log_num;
 	uint64_t index_num;
 	uint32_t dn_timeout;
+	uint32_t dn_stale_timeout;
 };
 
 conf_object_t *get_nn_conf_object(void);
@@ -36,6 +60,23 @@ conf_object_t *get_nn_conf_object(void);
 #define DEF_RBUFF_LEN          64 * 1024
 #define DEF_SBUFF_LEN          64 * 1024
 #define DEF_MMAX_TQUEUE_LEN    1000
+#define DEF_PAXOS_HOLD_LOG_NUM 100000
+#define DEF_IO_THREAD_N        1
+#define DEF_CLI_CONN_INFLIGHT  256
+#define DEF_MAX_INFLIGHT       20000
+#define DEF_RETRY_AFTER        100
+#define DEF_RETRY_CACHE_SIZE   100000
+#define DEF_RETRY_CACHE_EXPIRY 600
+#define DEF_REPLICATION_STREAMS  2
+#define DEF_REPLICATION_INTERVAL 3
+#define DEF_REPLICATION_TIMEOUT  300
+#define DEF_INVALIDATE_BLKS_MIN  100
+#define DEF_INVALIDATE_BLKS_MAX  2000
+#define DEF_DN_STALE_TIMEOUT     30
+#define DEF_BALANCE_THRESHOLD    10
+#define DEF_BALANCE_INTERVAL     30
+#define DEF_BALANCE_MOVES        4
+#define DEF_BALANCE_BANDWIDTH    10
 
 #define set_def_string(key, value) do { \
     if (!(key)->len) { \
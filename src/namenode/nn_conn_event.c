@@ -20,86 +20,45 @@
 #define CONF_SERVER_UNLIMITED_ACCEPT_N 0
 #define ADDR_MAX_LEN                   16
 
+static int listening_init(cycle_t *cycle, array_t *listening, 
+	array_t *binds, int n);
 static void listen_rev_handler(event_t *ev);
 
 int conn_listening_init(cycle_t *cycle)
 {
-    listening_t   *ls = NULL;
     conf_server_t *sconf = NULL;
-    uint32_t       i = 0;
-    server_bind_t *bind_for_cli = NULL;
-    server_bind_t *bind_for_dn = NULL;
     
     sconf = (conf_server_t *)dfs_cycle->sconf;
-	bind_for_dn = (server_bind_t *)sconf->bind_for_dn.elts;
-	bind_for_cli = (server_bind_t *)sconf->bind_for_cli.elts;
 
-	cycle->listening_for_dn.elts = pool_calloc(cycle->pool,
-        sizeof(listening_t) * sconf->bind_for_dn.nelts);
-    if (!cycle->listening_for_dn.elts) 
+#ifndef SO_REUSEPORT
+    if (sconf->dn_io_thread_n > 1 || sconf->cli_io_thread_n > 1) 
 	{
-         dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
-            "no space to alloc listen_for_dn pool");
-		 
-        return DFS_ERROR;
-    }
-
-	cycle->listening_for_cli.elts = pool_calloc(cycle->pool,
-        sizeof(listening_t) * sconf->bind_for_cli.nelts);
-    if (!cycle->listening_for_cli.elts) 
-	{
-         dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
-            "no space to alloc listen_for_cli pool");
-		 
-        return DFS_ERROR;
+        dfs_log_error(cycle->error_log, DFS_LOG_WARN, 0,
+            "SO_REUSEPORT not supported, use one io thread per listener");
+		
+        sconf->dn_io_thread_n = 1;
+        sconf->cli_io_thread_n = 1;
     }
+#endif
 
-	cycle->listening_for_dn.nelts = 0;
-    cycle->listening_for_dn.size = sizeof(listening_t);
-    cycle->listening_for_dn.nalloc = sconf->bind_for_dn.nelts;
-    cycle->listening_for_dn.pool = cycle->pool;
-	
-    cycle->listening_for_cli.nelts = 0;
-    cycle->listening_for_cli.size = sizeof(listening_t);
-    cycle->listening_for_cli.nalloc = sconf->bind_for_cli.nelts;
-    cycle->listening_for_cli.pool = cycle->pool;
-
-	for (i = 0; i < sconf->bind_for_dn.nelts; i++) 
+    if (sconf->dn_io_thread_n < 1) 
 	{
-        ls = conn_listening_add(&cycle->listening_for_dn, cycle->pool,
-            cycle->error_log, inet_addr((char *)bind_for_dn[i].addr.data), 
-            bind_for_dn[i].port, listen_rev_handler, 
-            ((conf_server_t*)cycle->sconf)->recv_buff_len, 
-            ((conf_server_t*)cycle->sconf)->recv_buff_len);
-		
-        if (!ls) 
-		{
-            return DFS_ERROR;
-        }
+        sconf->dn_io_thread_n = 1;
     }
 
-	for (i = 0; i < sconf->bind_for_cli.nelts; i++) 
+    if (sconf->cli_io_thread_n < 1) 
 	{
-        ls = conn_listening_add(&cycle->listening_for_cli, cycle->pool,
-            cycle->error_log, inet_addr((char *)bind_for_cli[i].addr.data), 
-            bind_for_cli[i].port, listen_rev_handler, 
-            ((conf_server_t*)cycle->sconf)->recv_buff_len, 
-            ((conf_server_t*)cycle->sconf)->recv_buff_len);
-		
-        if (!ls) 
-		{
-            return DFS_ERROR;
-        }
+        sconf->cli_io_thread_n = 1;
     }
 
-	if (conn_listening_open(&cycle->listening_for_dn,
-        cycle->error_log) != DFS_OK) 
+	if (listening_init(cycle, &cycle->listening_for_dn, &sconf->bind_for_dn,
+        sconf->dn_io_thread_n) != DFS_OK) 
     {
         return DFS_ERROR;
     }
 
-    if (conn_listening_open(&cycle->listening_for_cli,
-        cycle->error_log) != DFS_OK) 
+    if (listening_init(cycle, &cycle->listening_for_cli, &sconf->bind_for_cli,
+        sconf->cli_io_thread_n) != DFS_OK) 
     {
         return DFS_ERROR;
     }
@@ -107,6 +66,56 @@ int conn_listening_init(cycle_t *cycle)
     return DFS_OK;
 }
 
+// every bind is opened n times, io thread idx owns the sockets 
+// with i % n == idx
+static int listening_init(cycle_t *cycle, array_t *listening, 
+	                            array_t *binds, int n)
+{
+    listening_t   *ls = NULL;
+    conf_server_t *sconf = NULL;
+    uint32_t       i = 0;
+    int            j = 0;
+    server_bind_t *bind = NULL;
+    
+    sconf = (conf_server_t *)cycle->sconf;
+	bind = (server_bind_t *)binds->elts;
+
+	listening->elts = pool_calloc(cycle->pool,
+        sizeof(listening_t) * binds->nelts * n);
+    if (!listening->elts) 
+	{
+         dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
+            "no space to alloc listening pool");
+		 
+        return DFS_ERROR;
+    }
+
+	listening->nelts = 0;
+    listening->size = sizeof(listening_t);
+    listening->nalloc = binds->nelts * n;
+    listening->pool = cycle->pool;
+
+	for (i = 0; i < binds->nelts; i++) 
+	{
+	    for (j = 0; j < n; j++) 
+		{
+            ls = conn_listening_add(listening, cycle->pool,
+                cycle->error_log, inet_addr((char *)bind[i].addr.data), 
+                bind[i].port, listen_rev_handler, 
+                sconf->recv_buff_len, sconf->recv_buff_len);
+		
+            if (!ls) 
+		    {
+                return DFS_ERROR;
+            }
+
+            ls->reuseport = n > 1;
+	    }
+    }
+
+	return conn_listening_open(listening, cycle->error_log);
+}
+
 static void listen_rev_handler(event_t *ev)
 {
     int           s = DFS_INVALID_FILE;
@@ -7,15 +7,46 @@
 #include "nn_conf.h"
 #include "nn_net_response_handler.h"
 #include "nn_blk_index.h"
+#include "nn_paxos.h"
+#include "nn_replication.h"
 
 #define DN_NUM_IN_CLUSTER 5120
 #define SEC2MSEC(X) ((X) * 1000)
 
+#define DN_REP_MAX         3
+#define DN_HOLDERS_MAX     16
+#define PLACE_UNKNOWN_USED 500 // permille, no heartbeat has told yet
+#define PLACE_CONN_COST    4   // per active connection
+#define PLACE_BLK_COST     50  // per block recently handed out
+#define PLACE_STALE_COST   1000000 // behind every datanode heard from
+
+// how far a replica is from its reader
+#define LOC_LOCAL  0
+#define LOC_RACK   1
+#define LOC_REMOTE 2
+#define LOC_AVOID  3 // stale or leaving, read only when nothing else is
+
+#define dn_of_place(n) \
+	((dn_store_t *)((char *)(n) - offsetof(dn_store_t, place)))
+
+// a leaving datanode as one sweep of its blocks goes
+typedef struct dn_drain_s
+{
+    uint16_t idx;
+	uint32_t pos;
+	uint32_t shorts;
+	int      rs;
+} dn_drain_t;
+
 extern _xvolatile rb_msec_t dfs_current_msec;
 
 static dn_cache_mgmt_t *g_dcm = NULL;
 static queue_t          g_dn_q;
 static int              g_dn_n = 0;
+static rbtree_t         g_place_tree;
+static rbtree_node_t    g_place_sentinel;
+static dn_store_t      *g_dn_tab[DN_INDEX_MAX + 1];
+static uint16_t         g_dn_tab_next = 1;
 
 static dn_cache_mgmt_t *dn_cache_mgmt_new_init(conf_server_t *conf);
 static dn_cache_mgmt_t *dn_cache_mgmt_create(size_t index_num);
@@ -26,17 +57,31 @@ static struct mem_mblks *dn_mblks_create(dn_cache_mem_t *mem_mgmt,
 static void *allocator_malloc(void *priv, size_t mem_size);
 static void allocator_free(void *priv, void *mem_addr);
 static void dn_mem_mgmt_destroy(dn_cache_mem_t *mem_mgmt);
-static int dn_cache_mgmt_timer_new(dn_cache_mgmt_t *dcm, 
+static int dn_cache_mgmt_wheel_new(dn_cache_mgmt_t *dcm, 
 	conf_server_t *conf);
 static int dn_hash_keycmp(const void *arg1, const void *arg2, 
 	size_t size);
 static void dn_cache_mgmt_release(dn_cache_mgmt_t *dcm);
-static void dn_timer_destroy(void *args);
 static void dn_store_destroy(dn_store_t *dns);
-static dn_store_t *get_dn_store_obj(uchar_t *key);
-static dn_timer_t *dn_timer_create(dn_store_t *dns);
-static void dn_timeout_handler(event_t *ev);
-static void dn_timer_update(dn_store_t *dns);
+static uint16_t get_dn_idx(uchar_t *key);
+static void dn_wheel_add(dn_store_t *dns);
+static void dn_wheel_check(dn_store_t *dns, rb_msec_t now, queue_t *dead, 
+	queue_t *idle);
+static void dn_dead(dn_store_t *dns);
+static void dn_rack(const char *ip, char *rack);
+static int dn_decommission_listed(const char *ip);
+static uint16_t dn_tab_add(dn_store_t *dns);
+static void place_update(dn_store_t *dns);
+static int place_fits(dn_store_t *dns, uint64_t blk_sz);
+static int place_taken(dn_store_t **picked, int n, dn_store_t *dns, 
+	int by_rack);
+static int dn_cmds_take(dn_store_t *dns, int off, void **data, 
+	int *data_len);
+static int dn_cmds_take_ids(dn_store_t *dns, void **data, int *data_len);
+static int dn_cmd_batch_new(dn_store_t *dns);
+static task_queue_node_t *dn_cmd_ready(dn_store_t *dns);
+static uint64_t dn_del_limit(dn_store_t *dns);
+static void dn_cmds_free(dn_store_t *dns);
 	
 int nn_dn_index_worker_init(cycle_t *cycle)
 {
@@ -48,13 +93,14 @@ int nn_dn_index_worker_init(cycle_t *cycle)
         return DFS_ERROR;
     }
 
-	if (dn_cache_mgmt_timer_new(g_dcm, conf) != DFS_OK) 
+	if (dn_cache_mgmt_wheel_new(g_dcm, conf) != DFS_OK) 
 	{
         return DFS_ERROR;
     }
 
 	queue_init(&g_dn_q);
 	g_dn_n = 0;
+	rbtree_init(&g_place_tree, &g_place_sentinel, rbtree_insert_value);
 	
     return DFS_OK;
 }
@@ -79,6 +125,8 @@ static dn_cache_mgmt_t *dn_cache_mgmt_new_init(conf_server_t *conf)
     }
 
     pthread_rwlock_init(&dcm->cache_rwlock, NULL);
+	pthread_mutex_init(&dcm->drain_lock, NULL);
+	dcm->drain_last = 0;
 
     return dcm;
 }
@@ -202,20 +250,20 @@ static void dn_mem_mgmt_destroy(dn_cache_mem_t *mem_mgmt)
     memory_free(mem_mgmt->mem, mem_mgmt->mem_size);
 }
 
-static int dn_cache_mgmt_timer_new(dn_cache_mgmt_t *dcm, 
+static int dn_cache_mgmt_wheel_new(dn_cache_mgmt_t *dcm, 
 	conf_server_t *conf)
 {
     assert(dcm);
 
-    dcm->dn_timer_htable = dfs_hashtable_create(dn_hash_keycmp, 
-		DN_NUM_IN_CLUSTER, dfs_hashtable_hash_key8, NULL);
-    if (!dcm->dn_timer_htable)
+    for (int i = 0; i < DN_WHEEL_SLOTS; i++) 
 	{
-        return DFS_ERROR;
-    }
+        queue_init(&dcm->wheel[i]);
+	}
 
+	dcm->wheel_tick = dfs_current_msec / DN_WHEEL_TICK;
     dcm->timeout = SEC2MSEC(conf->dn_timeout);
-    pthread_rwlock_init(&dcm->timer_rwlock, NULL);
+	dcm->stale_timeout = SEC2MSEC(conf->dn_stale_timeout);
+    pthread_mutex_init(&dcm->wheel_lock, NULL);
 
     return DFS_OK;
 }
@@ -230,25 +278,14 @@ static void dn_cache_mgmt_release(dn_cache_mgmt_t *dcm)
 {
     assert(dcm);
 
-    pthread_rwlock_wrlock(&dcm->timer_rwlock);
-    dfs_hashtable_free_items(dcm->dn_timer_htable, dn_timer_destroy, NULL);
-    pthread_rwlock_unlock(&dcm->timer_rwlock);
-
 	pthread_rwlock_destroy(&dcm->cache_rwlock);
-	pthread_rwlock_destroy(&dcm->timer_rwlock);
+	pthread_mutex_destroy(&dcm->wheel_lock);
+	pthread_mutex_destroy(&dcm->drain_lock);
 
     dn_mem_mgmt_destroy(&dcm->mem_mgmt);
     memory_free(dcm, sizeof(*dcm));
 }
 
-static void dn_timer_destroy(void *args)
-{
-    assert(args);
-	
-    dn_timer_t *dt = (dn_timer_t *)args;
-    memory_free(dt, sizeof(*dt));
-}
-
 static void dn_store_destroy(dn_store_t *dns)
 {
     assert(dns);
@@ -260,16 +297,17 @@ int nn_dn_register(task_t *task)
 {
     task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
 
-	dn_store_t *dns = get_dn_store_obj((uchar_t *)task->key);
+	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+
+	dn_store_t *dns = (dn_store_t *)dfs_hashtable_lookup(g_dcm->dn_htable, 
+		(void *)task->key, string_strlen(task->key));
 	if (dns) 
 	{
-	    dn_timer_update(dns);
+	    dns->last_beat = dfs_current_msec;
 	    
 		goto out;
 	}
 
-	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
-
 	dns = (dn_store_t *)mem_get0(g_dcm->mem_mgmt.free_mblks);
 	if (!dns)
 	{
@@ -277,12 +315,14 @@ int nn_dn_register(task_t *task)
 	}
 
 	queue_init(&dns->me);
-	queue_init(&dns->blk);
 	queue_init(&dns->del_blk);
+	queue_init(&dns->copy_blk);
 
 	dns->del_blk_num = 0;
+	dns->copy_blk_num = 0;
 
 	strcpy(dns->dni.id, task->key);
+	dn_rack(dns->dni.id, dns->dni.rack);
 
 	dns->ln.key = dns->dni.id;
     dns->ln.len = string_strlen(dns->dni.id);
@@ -290,16 +330,46 @@ int nn_dn_register(task_t *task)
 
 	dfs_hashtable_join(g_dcm->dn_htable, &dns->ln);
 
+	dns->idx = dn_tab_add(dns);
+	if (!dns->idx) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+			"datanode table is full, %s holds no blocks", dns->dni.id);
+	}
+
 	queue_insert_tail(&g_dn_q, &dns->me);
 	g_dn_n++;
 
-	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+	dns->place.key = PLACE_UNKNOWN_USED;
+	rbtree_insert(&g_place_tree, &dns->place);
+
+	dns->last_beat = dfs_current_msec;
+	dns->stale = DFS_FALSE;
+	dn_wheel_add(dns);
+
+	dns->decommission = dn_decommission_listed(dns->dni.id) 
+		? DN_DECOMMISSIONING : DN_IN_SERVICE;
+	dns->drain_pos = 0;
+	dns->drain_short = 0;
 
-	dn_timer_create(dns);
+	// a restarted namenode does not take an ack meant for an older batch
+	dns->cmd_wait = NULL;
+	dns->cmd_channel = DFS_FALSE;
+	dns->cmd_seq = (uint32_t)dfs_current_msec;
+	dns->cmd_batch = NULL;
+	dns->cmd_batch_len = 0;
+
+	if (dns->decommission == DN_DECOMMISSIONING) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"datanode %s is decommissioning", dns->dni.id);
+	}
 
 out:
 	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"datanode %s register", dns->dni.id);
+		"datanode %s register, rack %s", dns->dni.id, dns->dni.rack);
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
 	
     task->ret = DFS_OK;
 
@@ -315,16 +385,25 @@ out:
     return write_back(node);
 }
 
-static dn_store_t *get_dn_store_obj(uchar_t *key)
+// the index blocks name the datanode at key by, 0 if it has none. the 
+// store itself is not to be used once the lock is let go
+static uint16_t get_dn_idx(uchar_t *key)
 {
+    uint16_t    idx = 0;
+	dn_store_t *dns = NULL;
+
     pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
 
-	dn_store_t *dns = (dn_store_t *)dfs_hashtable_lookup(g_dcm->dn_htable, 
+	dns = (dn_store_t *)dfs_hashtable_lookup(g_dcm->dn_htable, 
 		(void *)key, string_strlen(key));
+	if (dns) 
+	{
+        idx = dns->idx;
+	}
 
 	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
 	
-    return dns;
+    return idx;
 }
 
 int nn_dn_heartbeat(task_t *task)
@@ -333,56 +412,80 @@ int nn_dn_heartbeat(task_t *task)
 			0, "Got datanode %s heartbeat", task->key);
 	
     task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+	task_queue_node_t *ready = NULL;
+
+	heartbeat_info_t hbi;
+	int has_hbi = task->data && task->data_len >= (int)sizeof(hbi);
+	if (has_hbi) 
+	{
+        memcpy(&hbi, task->data, sizeof(hbi));
+	}
+
+	task->data = NULL;
+	task->data_len = 0;
+
+	// looked up under the lock it is used under, the liveness check may 
+	// take a dead one away meanwhile
+	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
 
-	dn_store_t *dns = get_dn_store_obj((uchar_t *)task->key);
+	dn_store_t *dns = (dn_store_t *)dfs_hashtable_lookup(g_dcm->dn_htable, 
+		(void *)task->key, string_strlen(task->key));
 	if (dns) 
 	{
-	    dn_timer_update(dns);
+		dns->last_beat = dfs_current_msec;
 
-		if (dns->del_blk_num > 0) 
+		// its next check is a dead one, make it a stale one again
+		if (dns->stale) 
 		{
-            int del_blk_num = dns->del_blk_num > DELETING_BLK_FOR_ONCE 
-				? DELETING_BLK_FOR_ONCE : dns->del_blk_num;
+		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+				"datanode %s is back", dns->dni.id);
+			
+            dns->stale = DFS_FALSE;
+			queue_remove(&dns->wheel);
+			dn_wheel_add(dns);
+		}
 
-			task->data_len = del_blk_num * sizeof(uint64_t);
-			task->data = malloc(task->data_len);
-			if (NULL == task->data) 
-			{
-                dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
-					"malloc err");
-			}
+		if (has_hbi) 
+		{
+            dns->dni.capacity = hbi.capacity;
+			dns->dni.dfs_used = hbi.dfs_used;
+			dns->dni.remaining = hbi.remaining;
+			dns->dni.active_conn = hbi.active_conn;
+			dns->dni.del_pending = hbi.del_pending;
+		}
 
-			void *pData = task->data;
+		dns->dni.last_update = dfs_current_msec;
+		dns->dni.recent_blks >>= 1;
+		place_update(dns);
 
-			queue_t *cur = NULL;
-			del_blk_t *dblk = NULL;
+		// one on its command channel has them pushed there
+		if (!dns->cmd_channel && has_hbi && hbi.cmd_ver >= DN_CMD_VER) 
+		{
+            dn_cmds_take(dns, 0, &task->data, &task->data_len);
+		}
+		else if (!dns->cmd_channel) 
+		{
+            dn_cmds_take_ids(dns, &task->data, &task->data_len);
+		}
+		else 
+		{
+		    // deletions held back while its queue was full can go now
+            ready = dn_cmd_ready(dns);
+		}
 
-			pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
+		pthread_rwlock_unlock(&g_dcm->cache_rwlock);
 
-			while (del_blk_num > 0) 
-			{
-				cur = queue_head(&dns->del_blk);
-				queue_remove(cur);
-				dns->del_blk_num--;
-				
-				dblk = queue_data(cur, del_blk_t, me);
-				
-				memcpy(pData, &dblk->id, sizeof(dblk->id));
-				pData += sizeof(dblk->id);
-
-				free(dblk);
-				dblk = NULL;
-
-				del_blk_num--;
-			}
-			
-			pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+		if (ready) 
+		{
+            write_back(ready);
 		}
 		
 		task->ret = DFS_OK;
 	}
     else 
 	{
+	    pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+		
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 
 			0, "datanode %s haven't registered yet", task->key);
 		
@@ -392,241 +495,1259 @@ int nn_dn_heartbeat(task_t *task)
     return write_back(node);
 }
 
-static dn_timer_t *dn_timer_create(dn_store_t *dns)
-{    
-    dn_timer_t *dt = (dn_timer_t *)memory_calloc(sizeof(dn_timer_t));
-    if (!dt) 
+// a datanode waiting on its command channel, answered as soon as there 
+// are commands for it or empty after DN_CMD_WAIT_IDLE. the batch it got 
+// last is acked with the next wait, one not acked is sent again
+int nn_dn_cmd_wait(task_t *task)
+{
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+	task_queue_node_t *old = NULL;
+	task_queue_node_t *ready = NULL;
+	dn_store_t        *dns = NULL;
+	cmd_wait_info_t    cwi;
+
+	memset(&cwi, 0x00, sizeof(cmd_wait_info_t));
+	if (task->data && task->data_len >= (int)sizeof(cwi)) 
 	{
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 
-			errno, "dn_timer_create: memory error! ");
-		
-        return NULL;
-    }
+        memcpy(&cwi, task->data, sizeof(cwi));
+	}
 
-    dt->ln.key = dns->dni.id;
-    dt->ln.len = string_strlen(dns->dni.id);
-    dt->ln.next = NULL;
-	
-    dt->ev.data = (void *)dt;
-	dt->ev.handler = dn_timeout_handler;
+	task->data = NULL;
+	task->data_len = 0;
+	task->ret = DFS_OK;
 
-	dt->thread = get_local_thread();
-	dt->dns = dns;
+	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
 
-    pthread_rwlock_wrlock(&g_dcm->timer_rwlock);
-	
-	dfs_hashtable_join(g_dcm->dn_timer_htable, &dt->ln);
+	dns = (dn_store_t *)dfs_hashtable_lookup(g_dcm->dn_htable, 
+		(void *)task->key, string_strlen(task->key));
+	if (!dns) 
+	{
+	    pthread_rwlock_unlock(&g_dcm->cache_rwlock);
 
-	pthread_rwlock_unlock(&g_dcm->timer_rwlock);
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 
+			0, "datanode %s haven't registered yet", task->key);
+		
+        task->ret = DFS_ERROR;
 
-	event_timer_add(&dt->thread->event_timer, &dt->ev, g_dcm->timeout);
+		return write_back(node);
+	}
 
-    return dt;
-}
+	if (!dns->cmd_channel) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"datanode %s takes commands on its channel", dns->dni.id);
+		
+        dns->cmd_channel = DFS_TRUE;
+	}
 
-static void dn_timeout_handler(event_t *ev)
-{
-    assert(ev);
+	dns->dni.del_pending = cwi.del_pending;
 
-    dn_timer_t *dt = (dn_timer_t *)ev->data;
-	dn_store_t *dns = (dn_store_t *)dt->dns;
+	if (dns->cmd_batch && cwi.ack == dns->cmd_seq) 
+	{
+        free(dns->cmd_batch);
+		dns->cmd_batch = NULL;
+		dns->cmd_batch_len = 0;
+	}
 
-	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"datanode %s is dead", dns->dni.id);
+	// one from a connection since broken
+	old = dns->cmd_wait;
 
-	pthread_rwlock_wrlock(&g_dcm->timer_rwlock);
-	
-	dfs_hashtable_remove_link(g_dcm->dn_timer_htable, &dt->ln);
-	
-	pthread_rwlock_unlock(&g_dcm->timer_rwlock);
+	dns->cmd_wait = node;
+	dns->cmd_wait_since = dfs_current_msec;
+	ready = dn_cmd_ready(dns);
 
-	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
-	
-	dfs_hashtable_remove_link(g_dcm->dn_htable, &dns->ln);
-	queue_remove(&dns->me);
-	g_dn_n--;
-	
 	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
 
-    dn_store_destroy(dns);
-	dn_timer_destroy(dt);
-}
+	if (old) 
+	{
+	    old->tk.ret = DFS_OK;
+        write_back(old);
+	}
 
-static void dn_timer_update(dn_store_t *dns)
-{
-    pthread_rwlock_wrlock(&g_dcm->timer_rwlock);
-	
-	dn_timer_t *dt = (dn_timer_t *)dfs_hashtable_lookup(g_dcm->dn_timer_htable, 
-		(void *)dns->dni.id, string_strlen(dns->dni.id));
+	if (ready) 
+	{
+        write_back(ready);
+	}
 
-	event_timer_add(&dt->thread->event_timer, &dt->ev, g_dcm->timeout);
-	
-	pthread_rwlock_unlock(&g_dcm->timer_rwlock);
+	return DFS_OK;
 }
 
-int nn_dn_recv_blk_report(task_t *task)
+// called from the task threads, one of them turns the wheel up to now
+void dn_liveness_run(rb_msec_t now)
 {
-	int          rs = DFS_OK;
-	dn_store_t  *dns = NULL;
-	blk_store_t *blk = NULL;
+    rb_msec_t   tick = now / DN_WHEEL_TICK;
+	queue_t     slot;
+	queue_t     dead;
+	queue_t     idle;
+	queue_t    *cur = NULL;
+	dn_store_t *dns = NULL;
 
-	report_blk_info_t rbi;
-	memset(&rbi, 0x00, sizeof(report_blk_info_t));
-	memcpy(&rbi, task->data, sizeof(report_blk_info_t));
+	task_queue_node_t *node = NULL;
 
-	task->data = NULL;
-	task->data_len = 0;
+	if (!g_dcm || tick <= g_dcm->wheel_tick 
+		|| pthread_mutex_trylock(&g_dcm->wheel_lock) != 0) 
+	{
+        return;
+	}
 
-	task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+	queue_init(&dead);
+	queue_init(&idle);
 
-	dns = get_dn_store_obj((uchar_t*)task->key);
-	if (!dns) 
+	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+
+	// a wheel behind by more than a turn has every slot due
+	if (tick - g_dcm->wheel_tick > DN_WHEEL_SLOTS) 
 	{
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"blk %d is from dead or unregistered node %s", 
-			rbi.blk_id, rbi.dn_ip);
+        g_dcm->wheel_tick = tick - DN_WHEEL_SLOTS;
+	}
 
-		rs = DFS_ERROR;
+	while (g_dcm->wheel_tick < tick) 
+	{
+	    g_dcm->wheel_tick++;
 
-		goto out;
+		// taken off first, a datanode may go back into the same slot
+		queue_init(&slot);
+		cur = &g_dcm->wheel[g_dcm->wheel_tick % DN_WHEEL_SLOTS];
+		if (!queue_empty(cur)) 
+		{
+		    queue_add_queue(&slot, cur);
+			queue_init(cur);
+		}
+
+		while (!queue_empty(&slot)) 
+		{
+		    dns = queue_data(queue_head(&slot), dn_store_t, wheel);
+			queue_remove(&dns->wheel);
+			
+            dn_wheel_check(dns, now, &dead, &idle);
+		}
 	}
 
-	blk = add_block(rbi.blk_id, rbi.blk_sz, rbi.dn_ip);
-    if (!blk) 
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	pthread_mutex_unlock(&g_dcm->wheel_lock);
+
+	// waits with nothing for them are answered empty and come back
+	while (!queue_empty(&idle)) 
 	{
-        rs = DFS_ERROR;
+	    node = queue_data(queue_head(&idle), task_queue_node_t, qe);
+		queue_remove(&node->qe);
+
+		node->tk.ret = DFS_OK;
+		write_back(node);
 	}
 
-    pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
-	
-	queue_insert_tail(&dns->blk, &blk->dn_me);
+	if (queue_empty(&dead)) 
+	{
+        return;
+	}
 
-	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
-	
-out:
-	task->ret = rs;
+	while (!queue_empty(&dead)) 
+	{
+	    dns = queue_data(queue_head(&dead), dn_store_t, wheel);
+		queue_remove(&dns->wheel);
 
-    return write_back(node);
-}
+		dn_dead(dns);
+	}
 
-int nn_dn_del_blk_report(task_t *task)
-{
-    return DFS_OK;
+	// their blocks are copied now, not at the next replication_interval
+	repl_kick();
 }
 
-int nn_dn_blk_report(task_t *task)
+// into the slot of its next check, stale or dead, no more than a turn 
+// ahead. cache_rwlock held
+static void dn_wheel_add(dn_store_t *dns)
 {
-	int          rs = DFS_OK;
-	dn_store_t  *dns = NULL;
-	blk_store_t *blk = NULL;
+    rb_msec_t due = dns->last_beat 
+		+ (dns->stale ? g_dcm->timeout : g_dcm->stale_timeout);
+	rb_msec_t tick = (due + DN_WHEEL_TICK - 1) / DN_WHEEL_TICK;
 
-	report_blk_info_t rbi;
-	memset(&rbi, 0x00, sizeof(report_blk_info_t));
-	memcpy(&rbi, task->data, sizeof(report_blk_info_t));
+	if (tick <= g_dcm->wheel_tick) 
+	{
+        tick = g_dcm->wheel_tick + 1;
+	}
+	else if (tick > g_dcm->wheel_tick + DN_WHEEL_SLOTS) 
+	{
+        tick = g_dcm->wheel_tick + DN_WHEEL_SLOTS;
+	}
 
-	task->data = NULL;
-	task->data_len = 0;
+	queue_insert_tail(&g_dcm->wheel[tick % DN_WHEEL_SLOTS], &dns->wheel);
+}
 
-	task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+// cache_rwlock held, the dead ones are only taken out of the index here. 
+// a command wait parked too long goes to idle
+static void dn_wheel_check(dn_store_t *dns, rb_msec_t now, queue_t *dead, 
+	queue_t *idle)
+{
+    rb_msec_t quiet = now > dns->last_beat ? now - dns->last_beat : 0;
 
-	dns = get_dn_store_obj((uchar_t*)task->key);
-	if (!dns) 
+	if (dns->cmd_wait && (quiet >= (rb_msec_t)g_dcm->timeout 
+		|| now - dns->cmd_wait_since >= DN_CMD_WAIT_IDLE)) 
 	{
-        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"blk %d is from dead or unregistered node %s", 
-			rbi.blk_id, rbi.dn_ip);
-
-		rs = DFS_ERROR;
+	    queue_insert_tail(idle, &dns->cmd_wait->qe);
+		dns->cmd_wait = NULL;
+		dns->cmd_wait_since = now;
+	}
+	else if (!dns->cmd_wait && dns->cmd_channel 
+		&& now - dns->cmd_wait_since >= (rb_msec_t)g_dcm->stale_timeout) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0, 
+			"datanode %s left its command channel", dns->dni.id);
 
-		goto out;
+		// its heartbeats carry the commands again
+	    dns->cmd_channel = DFS_FALSE;
 	}
 
-	blk = get_blk_store_obj(rbi.blk_id);
-	if (blk) 
+	if (quiet >= (rb_msec_t)g_dcm->timeout) 
 	{
-	    // check diff
-	    
-        rs = DFS_OK;
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"datanode %s is dead", dns->dni.id);
+		
+        dfs_hashtable_remove_link(g_dcm->dn_htable, &dns->ln);
+		queue_remove(&dns->me);
+		rbtree_delete(&g_place_tree, &dns->place);
+		g_dn_n--;
+		dn_cmds_free(dns);
 
-		goto out;
+		queue_insert_tail(dead, &dns->wheel);
+
+		return;
 	}
 
-	blk = add_block(rbi.blk_id, rbi.blk_sz, rbi.dn_ip);
-    if (!blk) 
+	if (!dns->stale && quiet >= (rb_msec_t)g_dcm->stale_timeout) 
 	{
-        rs = DFS_ERROR;
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0, 
+			"datanode %s is stale, no heartbeat for %l ms", 
+			dns->dni.id, quiet);
+		
+        dns->stale = DFS_TRUE;
+		place_update(dns);
 	}
 
-    pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
-	
-	queue_insert_tail(&dns->blk, &blk->dn_me);
+	dn_wheel_add(dns);
+}
 
-	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
-	
-out:
-	task->ret = rs;
+static void dn_dead(dn_store_t *dns)
+{
+	// the index is free again only once no block names it
+	if (dns->idx) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"datanode %s held %ud replicas", dns->dni.id, 
+			remove_dn_blocks(dns->idx));
 
-    return write_back(node);
+		pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+		g_dn_tab[dns->idx] = NULL;
+		pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+	}
+
+    dn_store_destroy(dns);
 }
 
-int generate_dns(short blk_rep, create_resp_info_t *resp_info)
+// called from the task threads, one of them sweeps the blocks of the 
+// leaving datanodes every replication_interval on the leader namenode. 
+// the short ones go to the replication monitor, which copies them from 
+// whichever holder is least busy. a datanode is done after a sweep 
+// finds none of its blocks short
+void dn_decommission_run(rb_msec_t now)
 {
-    queue_t    *cur = NULL;
-	dn_store_t *dns = NULL;
-	
-    pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
-	
-	if (0 == g_dn_n) 
+    int            i = 0;
+	int            n = 0;
+	queue_t       *cur = NULL;
+	dn_store_t    *dns = NULL;
+	conf_server_t *sconf = NULL;
+	dn_drain_t     drain[DN_DRAIN_MAX];
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	if (!g_dcm || !sconf->decommission.len 
+		|| now - g_dcm->drain_last < (rb_msec_t)sconf->replication_interval * 1000
+		|| pthread_mutex_trylock(&g_dcm->drain_lock) != 0) 
 	{
-        pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+        return;
+	}
 
-		dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"no avalable datanode");
+	if (now - g_dcm->drain_last < (rb_msec_t)sconf->replication_interval * 1000 
+		|| !nn_paxos_is_leader()) 
+	{
+	    pthread_mutex_unlock(&g_dcm->drain_lock);
+		
+        return;
+	}
 
-		return DFS_ERROR;
+	g_dcm->drain_last = now;
+
+	pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
+
+	for (cur = queue_head(&g_dn_q); 
+		cur != queue_sentinel(&g_dn_q) && n < DN_DRAIN_MAX; 
+		cur = queue_next(cur)) 
+	{
+	    dns = queue_data(cur, dn_store_t, me);
+		if (!dns->idx || dns->decommission != DN_DECOMMISSIONING) 
+		{
+            continue;
+		}
+
+		drain[n].idx = dns->idx;
+		drain[n].pos = dns->drain_pos;
+		drain[n].shorts = 0;
+		n++;
 	}
 
-	cur = queue_head(&g_dn_q);
-	dns = queue_data(cur, dn_store_t, me);
-	
-	resp_info->dn_num = 1;
-	strcpy(resp_info->dn_ips[0], dns->dni.id);
-	strcpy(resp_info->dn_ips[1], "");
-	strcpy(resp_info->dn_ips[2], "");
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	// the block index is not to be taken under cache_rwlock
+	for (i = 0; i < n; i++) 
+	{
+        drain[i].rs = drain_dn_blks(drain[i].idx, &drain[i].pos, 
+			DN_DRAIN_SCAN, &drain[i].shorts);
+	}
+
+	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+
+	for (i = 0; i < n; i++) 
+	{
+	    dns = g_dn_tab[drain[i].idx];
+		if (!dns || dns->decommission != DN_DECOMMISSIONING) 
+		{
+            continue;
+		}
+
+		dns->drain_pos = drain[i].pos;
+		dns->drain_short += drain[i].shorts;
+
+		if (drain[i].rs != DFS_OK) 
+		{
+            continue;
+		}
+
+		if (!dns->drain_short) 
+		{
+		    dns->decommission = DN_DECOMMISSIONED;
+			
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+				"datanode %s is decommissioned, safe to remove", 
+				dns->dni.id);
+		}
+		else 
+		{
+            dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+				"datanode %s has %ud blocks left to drain", 
+				dns->dni.id, dns->drain_short);
+		}
+
+		dns->drain_short = 0;
+	}
 
 	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
-	
-    return DFS_OK;
+
+	pthread_mutex_unlock(&g_dcm->drain_lock);
 }
 
-int notify_dn_2_delete_blk(long blk_id, char dn_ip[32])
+// the blocks a datanode stored or dropped since its last report
+int nn_dn_recv_blk_report(task_t *task)
 {
-    dn_store_t *dns = get_dn_store_obj((uchar_t *)dn_ip);
-	if (!dns) 
+	int               rs = DFS_OK;
+	int               num = 0;
+	uint16_t          idx = 0;
+	blk_recv_entry_t *ents = NULL;
+
+	task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+	num = task->data ? task->data_len / (int)sizeof(blk_recv_entry_t) : 0;
+	if (num <= 0 || num > BLK_RECV_REPORT_MAX) 
 	{
-	    return DFS_ERROR;
+	    rs = DFS_ERROR;
+		
+        goto out;
 	}
 
-	del_blk_t *dblk = (del_blk_t *)malloc(sizeof(del_blk_t));
-	if (!dblk) 
+	idx = get_dn_idx((uchar_t *)task->key);
+	if (!idx) 
 	{
         dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
-			"malloc err");
+			"%d blks are from dead or unregistered node %s", 
+			num, task->key);
 
-		return DFS_ERROR;
+		rs = DFS_ERROR;
+
+		goto out;
 	}
 
-	queue_init(&dblk->me);
-	dblk->id = blk_id;
-	
-    pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+	// copied out of the receive buffer, it may be unaligned
+	ents = (blk_recv_entry_t *)malloc(num * sizeof(blk_recv_entry_t));
+	if (!ents) 
+	{
+	    rs = DFS_ERROR;
+		
+        goto out;
+	}
 
-	queue_insert_tail(&dns->del_blk, &dblk->me);
-	
-	dns->del_blk_num++;
+	memcpy(ents, task->data, num * sizeof(blk_recv_entry_t));
 
-	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+	rs = blk_recv_apply(idx, ents, num);
 	
-    return DFS_OK;
-}
-
+out:
+	free(ents);
+	
+	task->data = NULL;
+	task->data_len = 0;
+	task->ret = rs;
+
+    return write_back(node);
+}
+
+int nn_dn_del_blk_report(task_t *task)
+{
+    return DFS_OK;
+}
+
+// a frame of a full block report, see blk_report_head_t
+int nn_dn_blk_report(task_t *task)
+{
+	int                 rs = DFS_OK;
+	uint16_t            idx = 0;
+	blk_report_head_t   head;
+	blk_report_stat_t   stat;
+	blk_report_entry_t *ents = NULL;
+
+	task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+	memset(&head, 0x00, sizeof(blk_report_head_t));
+	memset(&stat, 0x00, sizeof(blk_report_stat_t));
+
+	if (!task->data || task->data_len < (int)sizeof(head)) 
+	{
+        rs = DFS_ERROR;
+
+		goto out;
+	}
+
+	memcpy(&head, task->data, sizeof(head));
+	
+	if (head.num > BLK_REPORT_MAX || task->data_len 
+		< (int)(sizeof(head) + head.num * sizeof(blk_report_entry_t))) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0, 
+			"bad block report frame from %s", task->key);
+		
+        rs = DFS_ERROR;
+
+		goto out;
+	}
+
+	idx = get_dn_idx((uchar_t *)task->key);
+	if (!idx) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"block report from dead or unregistered node %s", task->key);
+
+		rs = DFS_ERROR;
+
+		goto out;
+	}
+
+	// the entries follow the head, maybe unaligned in the receive buffer
+	if (head.num > 0) 
+	{
+	    ents = (blk_report_entry_t *)malloc(head.num 
+			* sizeof(blk_report_entry_t));
+		if (!ents) 
+		{
+            rs = DFS_ERROR;
+
+		    goto out;
+		}
+
+		memcpy(ents, (char *)task->data + sizeof(head), 
+			head.num * sizeof(blk_report_entry_t));
+	}
+
+	rs = blk_report_apply(idx, &head, ents, &stat);
+
+	if (DFS_OK == rs && head.last) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"block report of %s done, %ud added, %ud removed, %ud invalid", 
+			task->key, stat.added, stat.removed, stat.invalid);
+	}
+	
+out:
+	free(ents);
+	
+	task->data = NULL;
+	task->data_len = 0;
+	task->ret = rs;
+
+    return write_back(node);
+}
+
+// blk_rep distinct datanodes, the least loaded first and each on a rack 
+// of its own while the racks last
+int generate_dns(short blk_rep, uint64_t blk_sz, 
+	create_resp_info_t *resp_info)
+{
+    int            i = 0;
+	int            n = 0;
+	int            want = 0;
+	int            pass = 0;
+	rbtree_node_t *cur = NULL;
+	dn_store_t    *dns = NULL;
+	dn_store_t    *picked[DN_REP_MAX];
+
+	want = blk_rep < 1 ? 1 : blk_rep;
+	want = want > DN_REP_MAX ? DN_REP_MAX : want;
+
+	memset(resp_info->dn_ips, 0x00, sizeof(resp_info->dn_ips));
+	
+    pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+	
+	if (0 == g_dn_n) 
+	{
+        pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"no avalable datanode");
+
+		return DFS_ERROR;
+	}
+
+	for (pass = 0; pass < 2 && n < want; pass++) 
+	{
+	    cur = rbtree_min(g_place_tree.root, g_place_tree.sentinel);
+		
+        for ( ; cur && n < want; cur = rbtree_next(&g_place_tree, cur)) 
+		{
+		    dns = dn_of_place(cur);
+			
+            if (!place_fits(dns, blk_sz) 
+				|| place_taken(picked, n, dns, pass == 0)) 
+			{
+                continue;
+			}
+
+			picked[n++] = dns;
+		}
+	}
+
+	for (i = 0; i < n; i++) 
+	{
+	    strcpy(resp_info->dn_ips[i], picked[i]->dni.id);
+		
+        picked[i]->dni.recent_blks++;
+		place_update(picked[i]);
+	}
+
+	resp_info->dn_num = n;
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	if (0 == n) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"no datanode has room for a block of %uL", blk_sz);
+
+		return DFS_ERROR;
+	}
+
+	if (n < want) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0, 
+			"only %d of %d replicas placed", n, want);
+	}
+	
+    return DFS_OK;
+}
+
+// sent at once to a datanode waiting on its command channel, else with 
+// its next wait or heartbeat reply
+int notify_dn_2_delete_blk(long blk_id, uint16_t dn)
+{
+    task_queue_node_t *node = NULL;
+	
+	del_blk_t *dblk = (del_blk_t *)malloc(sizeof(del_blk_t));
+	if (!dblk) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"malloc err");
+
+		return DFS_ERROR;
+	}
+
+	queue_init(&dblk->me);
+	dblk->id = blk_id;
+	
+    pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+
+	dn_store_t *dns = g_dn_tab[dn];
+	if (!dns) 
+	{
+	    pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+		free(dblk);
+		
+	    return DFS_ERROR;
+	}
+
+	queue_insert_tail(&dns->del_blk, &dblk->me);
+	
+	dns->del_blk_num++;
+
+	node = dn_cmd_ready(dns);
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	if (node) 
+	{
+        write_back(node);
+	}
+	
+    return DFS_OK;
+}
+
+// src copies blk_id to target, told as notify_dn_2_delete_blk tells
+int notify_dn_2_copy_blk(long blk_id, uint16_t src, uint16_t target, 
+	int rate)
+{
+    task_queue_node_t *node = NULL;
+	
+	copy_blk_t *cblk = (copy_blk_t *)malloc(sizeof(copy_blk_t));
+	if (!cblk) 
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+			"malloc err");
+
+		return DFS_ERROR;
+	}
+
+	queue_init(&cblk->me);
+	cblk->id = blk_id;
+	cblk->rate = rate;
+	
+    pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+
+	dn_store_t *dns = g_dn_tab[src];
+	if (!dns || !g_dn_tab[target]) 
+	{
+	    pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+		free(cblk);
+		
+	    return DFS_ERROR;
+	}
+
+	strcpy(cblk->target, g_dn_tab[target]->dni.id);
+	queue_insert_tail(&dns->copy_blk, &cblk->me);
+	
+	dns->copy_blk_num++;
+
+	node = dn_cmd_ready(dns);
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	if (node) 
+	{
+        write_back(node);
+	}
+	
+    return DFS_OK;
+}
+
+// the cheapest datanode without the block that still takes a copy in, 
+// on a rack none of the holders is on if there is one
+uint16_t choose_copy_target(const uint16_t *holders, int n, 
+	uint64_t blk_sz, const uint16_t *in, int max_in)
+{
+    int            i = 0;
+	int            pass = 0;
+	rbtree_node_t *cur = NULL;
+	dn_store_t    *dns = NULL;
+	dn_store_t    *picked[DN_HOLDERS_MAX];
+	int            picked_n = 0;
+	uint16_t       target = 0;
+
+	pthread_rwlock_wrlock(&g_dcm->cache_rwlock);
+
+	for (i = 0; i < n && picked_n < DN_HOLDERS_MAX; i++) 
+	{
+        if (g_dn_tab[holders[i]]) 
+		{
+            picked[picked_n++] = g_dn_tab[holders[i]];
+		}
+	}
+
+	for (pass = 0; pass < 2 && !target; pass++) 
+	{
+	    cur = rbtree_min(g_place_tree.root, g_place_tree.sentinel);
+		
+        for ( ; cur && !target; cur = rbtree_next(&g_place_tree, cur)) 
+		{
+		    dns = dn_of_place(cur);
+
+			if (!dns->idx || in[dns->idx] >= max_in 
+				|| !place_fits(dns, blk_sz)
+				|| place_taken(picked, picked_n, dns, pass == 0)) 
+			{
+                continue;
+			}
+
+			target = dns->idx;
+		}
+	}
+
+	if (target) 
+	{
+	    dns = g_dn_tab[target];
+        dns->dni.recent_blks++;
+		place_update(dns);
+	}
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	return target;
+}
+
+int get_dn_num()
+{
+    return g_dn_n;
+}
+
+// whether a replica on datanode idx counts toward its block's replication
+int dn_in_service(uint16_t idx)
+{
+    int rs = DFS_FALSE;
+
+    pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
+
+	if (g_dn_tab[idx] && g_dn_tab[idx]->decommission == DN_IN_SERVICE) 
+	{
+        rs = DFS_TRUE;
+	}
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	return rs;
+}
+
+void get_dn_serving(dn_serving_t *ds)
+{
+    queue_t    *cur = NULL;
+	dn_store_t *dns = NULL;
+
+	memset(ds, 0x00, sizeof(dn_serving_t));
+
+	pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
+
+	for (cur = queue_head(&g_dn_q); cur != queue_sentinel(&g_dn_q); 
+		cur = queue_next(cur)) 
+	{
+	    dns = queue_data(cur, dn_store_t, me);
+		if (dns->idx && dns->decommission == DN_IN_SERVICE) 
+		{
+            ds->map[dns->idx >> 3] |= 1 << (dns->idx & 7);
+		}
+	}
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+}
+
+// the live datanodes that have told their capacity, stale ones left out
+int get_dn_usage(dn_usage_t *usage, int max)
+{
+    int         n = 0;
+	queue_t    *cur = NULL;
+	dn_store_t *dns = NULL;
+
+	pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
+
+	for (cur = queue_head(&g_dn_q); 
+		cur != queue_sentinel(&g_dn_q) && n < max; cur = queue_next(cur)) 
+	{
+	    dns = queue_data(cur, dn_store_t, me);
+		if (!dns->idx || dns->stale || !dns->dni.capacity 
+			|| dns->decommission != DN_IN_SERVICE) 
+		{
+            continue;
+		}
+
+		usage[n].idx = dns->idx;
+		usage[n].capacity = dns->dni.capacity;
+		usage[n].used = dns->dni.remaining < dns->dni.capacity 
+			? dns->dni.capacity - dns->dni.remaining : 0;
+		n++;
+	}
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	return n;
+}
+
+int get_dn_ip(uint16_t idx, char ip[32])
+{
+    int rs = DFS_ERROR;
+
+    pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
+
+	if (g_dn_tab[idx]) 
+	{
+        strcpy(ip, g_dn_tab[idx]->dni.id);
+		rs = DFS_OK;
+	}
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	return rs;
+}
+
+void get_dn_reader(const char *ip, dn_reader_t *reader)
+{
+    snprintf(reader->ip, sizeof(reader->ip), "%s", ip ? ip : "");
+	dn_rack(reader->ip, reader->rack);
+}
+
+// the ips of the live datanodes among dns by how close they are to 
+// reader, on it then on its rack then the rest, the least loaded first 
+// of each. at most max, the number put in ips
+int get_dn_locations(const dn_reader_t *reader, const uint16_t *dns, 
+	int n, char (*ips)[32], int max)
+{
+    int         i = 0;
+	int         j = 0;
+	int         m = 0;
+	int         dist = 0;
+	dn_store_t *dns_obj = NULL;
+	dn_store_t *found[DN_HOLDERS_MAX];
+	int         far[DN_HOLDERS_MAX];
+
+	pthread_rwlock_rdlock(&g_dcm->cache_rwlock);
+
+	for (i = 0; i < n && m < DN_HOLDERS_MAX; i++) 
+	{
+	    dns_obj = g_dn_tab[dns[i]];
+		if (!dns_obj) 
+		{
+            continue;
+		}
+
+		if (dns_obj->stale || dns_obj->decommission != DN_IN_SERVICE) 
+		{
+            dist = LOC_AVOID;
+		}
+		else if (!strcmp(dns_obj->dni.id, reader->ip)) 
+		{
+            dist = LOC_LOCAL;
+		}
+		else if (!strcmp(dns_obj->dni.rack, reader->rack)) 
+		{
+            dist = LOC_RACK;
+		}
+		else 
+		{
+            dist = LOC_REMOTE;
+		}
+
+		// a handful of holders, insertion keeps it ordered
+		for (j = m; j > 0 && (far[j - 1] > dist || (far[j - 1] == dist 
+			&& found[j - 1]->place.key > dns_obj->place.key)); j--) 
+		{
+		    found[j] = found[j - 1];
+            far[j] = far[j - 1];
+		}
+
+		found[j] = dns_obj;
+		far[j] = dist;
+		m++;
+	}
+
+	for (i = 0; i < m && i < max; i++) 
+	{
+        strcpy(ips[i], found[i]->dni.id);
+	}
+
+	pthread_rwlock_unlock(&g_dcm->cache_rwlock);
+
+	return i;
+}
+
+// cache_rwlock held, 0 when every index is taken
+static uint16_t dn_tab_add(dn_store_t *dns)
+{
+    uint32_t i = 0;
+	uint16_t idx = 0;
+
+	for (i = 0; i < DN_INDEX_MAX; i++) 
+	{
+	    idx = g_dn_tab_next;
+		g_dn_tab_next = g_dn_tab_next == DN_INDEX_MAX ? 1 : g_dn_tab_next + 1;
+		
+        if (!g_dn_tab[idx]) 
+		{
+            g_dn_tab[idx] = dns;
+
+			return idx;
+		}
+	}
+
+	return 0;
+}
+
+// server.topology = "10.0.0.1:/rack1,10.0.0.2:/rack2"
+static void dn_rack(const char *ip, char *rack)
+{
+    size_t         len = 0;
+	size_t         rlen = 0;
+    char          *p = NULL;
+	char          *end = NULL;
+	char          *next = NULL;
+	conf_server_t *sconf = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+	len = strlen(ip);
+	p = (char *)sconf->topology.data;
+	end = p + sconf->topology.len;
+
+	while (p && p < end)
+	{
+	    next = (char *)memchr(p, ',', end - p);
+		
+	    if ((size_t)(end - p) > len && !strncmp(p, ip, len) && p[len] == ':')
+		{
+		    p += len + 1;
+            rlen = (next ? next : end) - p;
+			rlen = rlen < RACK_LEN - 1 ? rlen : RACK_LEN - 1;
+
+			if (rlen > 0) 
+			{
+                memcpy(rack, p, rlen);
+				rack[rlen] = '\0';
+
+				return;
+			}
+
+			break;
+		}
+
+		p = next;
+		while (p && p < end && (*p == ',' || *p == ' '))
+		{
+            p++;
+		}
+	}
+
+	strcpy(rack, DEFAULT_RACK);
+}
+
+// server.decommission = "10.0.0.1,10.0.0.2"
+static int dn_decommission_listed(const char *ip)
+{
+    size_t         len = 0;
+    char          *p = NULL;
+	char          *end = NULL;
+	char          *next = NULL;
+	conf_server_t *sconf = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+	len = strlen(ip);
+	p = (char *)sconf->decommission.data;
+	end = p + sconf->decommission.len;
+
+	while (p && p < end)
+	{
+	    next = (char *)memchr(p, ',', end - p);
+		
+	    if ((size_t)((next ? next : end) - p) == len && !strncmp(p, ip, len))
+		{
+            return DFS_TRUE;
+		}
+
+		p = next;
+		while (p && p < end && (*p == ',' || *p == ' '))
+		{
+            p++;
+		}
+	}
+
+	return DFS_FALSE;
+}
+
+// the share of the disk in use, in permille, plus what is being written;
+// cache_rwlock held
+static void place_update(dn_store_t *dns)
+{
+    dn_info_t   *dni = &dns->dni;
+	rbtree_key   cost = PLACE_UNKNOWN_USED;
+
+	if (dni->capacity > 0) 
+	{
+	    uint64_t used = dni->remaining < dni->capacity 
+			? dni->capacity - dni->remaining : 0;
+		
+        cost = used / (dni->capacity / 1000 + 1);
+	}
+
+	cost += (rbtree_key)dni->active_conn * PLACE_CONN_COST;
+	cost += (rbtree_key)dni->recent_blks * PLACE_BLK_COST;
+
+	if (dns->stale) 
+	{
+        cost += PLACE_STALE_COST;
+	}
+
+	rbtree_delete(&g_place_tree, &dns->place);
+	dns->place.key = cost;
+	rbtree_insert(&g_place_tree, &dns->place);
+}
+
+// the blocks handed out since the last heartbeat are not in remaining yet
+static int place_fits(dn_store_t *dns, uint64_t blk_sz)
+{
+    if (dns->decommission != DN_IN_SERVICE) 
+	{
+        return DFS_FALSE;
+	}
+
+    if (!dns->dni.capacity) 
+	{
+        return DFS_TRUE;
+	}
+
+	return dns->dni.remaining >= blk_sz * (dns->dni.recent_blks + 1);
+}
+
+static int place_taken(dn_store_t **picked, int n, dn_store_t *dns, 
+	int by_rack)
+{
+    for (int i = 0; i < n; i++) 
+	{
+        if (picked[i] == dns 
+			|| (by_rack && !strcmp(picked[i]->dni.rack, dns->dni.rack))) 
+		{
+            return DFS_TRUE;
+		}
+	}
+
+	return DFS_FALSE;
+}
+
+// a share of the deletions and every copy waiting, after off bytes left 
+// for a head. DFS_DECLINED when there are none. cache_rwlock held
+static int dn_cmds_take(dn_store_t *dns, int off, void **data, 
+	int *data_len)
+{
+    int         n = 0;
+	int         del_n = 0;
+	queue_t    *cur = NULL;
+	del_blk_t  *dblk = NULL;
+	copy_blk_t *cblk = NULL;
+	dn_cmd_t   *cmds = NULL;
+	char       *buf = NULL;
+
+	del_n = (int)dn_del_limit(dns);
+	n = del_n + dns->copy_blk_num;
+	if (n <= 0) 
+	{
+        return DFS_DECLINED;
+	}
+
+	buf = (char *)calloc(1, off + n * sizeof(dn_cmd_t));
+	if (!buf) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, "calloc err");
+		
+        return DFS_ERROR;
+	}
+
+	*data = buf;
+	*data_len = off + n * sizeof(dn_cmd_t);
+	cmds = (dn_cmd_t *)(buf + off);
+
+	while (del_n-- > 0) 
+	{
+		cur = queue_head(&dns->del_blk);
+		queue_remove(cur);
+		dns->del_blk_num--;
+		
+		dblk = queue_data(cur, del_blk_t, me);
+		cmds->op = OP_DELETE_BLOCK;
+		cmds->blk_id = dblk->id;
+		cmds++;
+
+		free(dblk);
+	}
+
+	while (!queue_empty(&dns->copy_blk)) 
+	{
+		cur = queue_head(&dns->copy_blk);
+		queue_remove(cur);
+		dns->copy_blk_num--;
+		
+		cblk = queue_data(cur, copy_blk_t, me);
+		cmds->op = OP_COPY_BLOCK;
+		cmds->rate = cblk->rate;
+		cmds->blk_id = cblk->id;
+		strcpy(cmds->target, cblk->target);
+		cmds++;
+
+		free(cblk);
+	}
+
+	return DFS_OK;
+}
+
+// the heartbeat reply of a datanode that only reads block ids to delete, 
+// its copies are dropped and the replication monitor sends them elsewhere 
+// once they expire. cache_rwlock held
+static int dn_cmds_take_ids(dn_store_t *dns, void **data, int *data_len)
+{
+    int         n = 0;
+	queue_t    *cur = NULL;
+	del_blk_t  *dblk = NULL;
+	uint64_t   *ids = NULL;
+
+	while (!queue_empty(&dns->copy_blk)) 
+	{
+		cur = queue_head(&dns->copy_blk);
+		queue_remove(cur);
+		dns->copy_blk_num--;
+		
+		free(queue_data(cur, copy_blk_t, me));
+	}
+
+	n = (int)dn_del_limit(dns);
+	if (n <= 0) 
+	{
+        return DFS_DECLINED;
+	}
+
+	ids = (uint64_t *)malloc(n * sizeof(uint64_t));
+	if (!ids) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, "malloc err");
+		
+        return DFS_ERROR;
+	}
+
+	*data = ids;
+	*data_len = n * sizeof(uint64_t);
+
+	while (n-- > 0) 
+	{
+		cur = queue_head(&dns->del_blk);
+		queue_remove(cur);
+		dns->del_blk_num--;
+		
+		dblk = queue_data(cur, del_blk_t, me);
+		*ids++ = dblk->id;
+
+		free(dblk);
+	}
+
+	return DFS_OK;
+}
+
+// the next batch for the command channel, kept until the datanode acks 
+// its seq. cache_rwlock held
+static int dn_cmd_batch_new(dn_store_t *dns)
+{
+    int               rs = DFS_OK;
+	void             *data = NULL;
+	int               data_len = 0;
+	cmd_batch_head_t *head = NULL;
+
+	rs = dn_cmds_take(dns, sizeof(cmd_batch_head_t), &data, &data_len);
+	if (rs != DFS_OK) 
+	{
+        return rs;
+	}
+
+	head = (cmd_batch_head_t *)data;
+	head->seq = ++dns->cmd_seq;
+	head->num = (data_len - sizeof(cmd_batch_head_t)) / sizeof(dn_cmd_t);
+
+	dns->cmd_batch = (char *)data;
+	dns->cmd_batch_len = data_len;
+
+	return DFS_OK;
+}
+
+// the wait parked by dns filled with the batch not acked yet, or else a 
+// new one, to be written back once cache_rwlock is let go. NULL when 
+// there is no wait or nothing to send. cache_rwlock held
+static task_queue_node_t *dn_cmd_ready(dn_store_t *dns)
+{
+    task_queue_node_t *node = dns->cmd_wait;
+
+	if (!node || (!dns->cmd_batch && dn_cmd_batch_new(dns) != DFS_OK)) 
+	{
+        return NULL;
+	}
+
+	node->tk.data = malloc(dns->cmd_batch_len);
+	if (!node->tk.data) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, "malloc err");
+		
+        return NULL;
+	}
+
+	memcpy(node->tk.data, dns->cmd_batch, dns->cmd_batch_len);
+	node->tk.data_len = dns->cmd_batch_len;
+	node->tk.ret = DFS_OK;
+
+	dns->cmd_wait = NULL;
+	dns->cmd_wait_since = dfs_current_msec;
+
+	return node;
+}
+
+// a big backlog drains over a few heartbeats, no faster than the 
+// datanode's unlinkers keep up with. cache_rwlock held
+static uint64_t dn_del_limit(dn_store_t *dns)
+{
+    uint64_t       n = 0;
+	uint64_t       room = 0;
+	conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	n = dns->del_blk_num / INVALIDATE_DRAIN_BEATS;
+	if (n < sconf->invalidate_blks_min) 
+	{
+        n = sconf->invalidate_blks_min;
+	}
+
+	room = sconf->invalidate_blks_max > dns->dni.del_pending
+		? sconf->invalidate_blks_max - dns->dni.del_pending : 0;
+	if (n > room) 
+	{
+        n = room;
+	}
+
+	return n < dns->del_blk_num ? n : dns->del_blk_num;
+}
+
+// cache_rwlock held
+static void dn_cmds_free(dn_store_t *dns)
+{
+    queue_t *cur = NULL;
+
+	while (!queue_empty(&dns->del_blk)) 
+	{
+		cur = queue_head(&dns->del_blk);
+		queue_remove(cur);
+		free(queue_data(cur, del_blk_t, me));
+	}
+
+	while (!queue_empty(&dns->copy_blk)) 
+	{
+		cur = queue_head(&dns->copy_blk);
+		queue_remove(cur);
+		free(queue_data(cur, copy_blk_t, me));
+	}
+
+	dns->del_blk_num = 0;
+	dns->copy_blk_num = 0;
+
+	free(dns->cmd_batch);
+	dns->cmd_batch = NULL;
+	dns->cmd_batch_len = 0;
+}
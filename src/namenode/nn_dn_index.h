@@ -7,6 +7,7 @@
 #include "dfs_commpool.h"
 #include "dfs_task.h"
 #include "dfs_event.h"
+#include "dfs_rbtree.h"
 #include "nn_cycle.h"
 #include "nn_thread.h"
 
@@ -20,7 +21,14 @@
 #define DN_RECOVERBLOCK 6
 */
 
-#define ID_LEN 32
+#define ID_LEN   32
+#define RACK_LEN 64
+
+#define DEFAULT_RACK "/default-rack"
+
+// blocks name their datanodes by an index into the datanode table, 0 is 
+// no datanode
+#define DN_INDEX_MAX 65535
 
 #define HASH_BUF_PER_SZ sizeof(void *) 
 #define DFS_ALIGNMENT sizeof(uint64_t)
@@ -29,13 +37,35 @@
 
 #define DN_POOL_REMAIN_MEM (10 * 1024)
 
+// datanodes are checked for missed heartbeats a tick at a time, each 
+// waits in the slot of its next check
+#define DN_WHEEL_SLOTS 64
+#define DN_WHEEL_TICK  1000 // MSec
+
 #define DN_HASH_BUF(dn_count)  (dn_count * HASH_BUF_PER_SZ)
 #define DN_STORE_BUF(dn_count) (dn_count * DN_STORE_BUF_PER_SZ)
 
 #define DN_POOL_SIZE(dn_count) (DN_HASH_BUF(dn_count) \
         + DN_STORE_BUF(dn_count) + DN_POOL_REMAIN_MEM) 
 
-#define DELETING_BLK_FOR_ONCE 5
+// a heartbeat hands out about this share of the deletions waiting
+#define INVALIDATE_DRAIN_BEATS 4
+
+// a datanode listed in decommission takes no new blocks, it can be taken 
+// away once every block on it is fully replicated on the others
+#define DN_IN_SERVICE      0
+#define DN_DECOMMISSIONING 1
+#define DN_DECOMMISSIONED  2
+
+#define DN_DRAIN_MAX  64    // leaving datanodes swept a pass
+#define DN_DRAIN_SCAN 65536 // of the blocks of each
+
+#define dn_serving_has(ds, idx) \
+	((ds)->map[(idx) >> 3] & (1 << ((idx) & 7)))
+
+// a DN_CMD_WAIT with nothing to send is answered empty when the wheel 
+// next checks its datanode, after at least this long
+#define DN_CMD_WAIT_IDLE 10000 // MSec
 
 typedef struct del_blk_s
 {
@@ -43,34 +73,75 @@ typedef struct del_blk_s
 	uint64_t id;
 } del_blk_t;
 
+typedef struct copy_blk_s
+{
+    queue_t  me;
+	uint64_t id;
+	int      rate;
+	char     target[ID_LEN];
+} copy_blk_t;
+
+// where a client reading a block is, its replicas go to it closest first
+typedef struct dn_reader_s
+{
+    char ip[ID_LEN];
+	char rack[RACK_LEN];
+} dn_reader_t;
+
+// how full a live datanode is, for the balancer
+typedef struct dn_usage_s
+{
+    uint16_t idx;
+	uint64_t capacity;
+	uint64_t used;
+} dn_usage_t;
+
+// the datanodes in service at one moment, a bit by index, so the block 
+// index can count replicas without taking cache_rwlock
+typedef struct dn_serving_s
+{
+    uint8_t map[(DN_INDEX_MAX + 1) / 8];
+} dn_serving_t;
+
 typedef struct dn_info_s
 {
 	char     id[ID_LEN];
 	uint64_t capacity;
 	uint64_t dfs_used;
-	uint32_t remaining;
+	uint64_t remaining;
 	uint64_t namespace_used;
 	uint64_t last_update;
 	int      active_conn;
+	uint32_t recent_blks; // handed out since the last heartbeats, decays
+	uint32_t del_pending; // deletions it has queued, as of its heartbeat
+	char     rack[RACK_LEN];
 } dn_info_t;
 
 typedef struct dn_store_s 
 {
 	dfs_hashtable_link_t ln;
 	queue_t 	         me;
-	queue_t              blk;
+	rbtree_node_t        place;   // keyed by placement cost, cheapest first
+	queue_t              wheel;
+	rb_msec_t            last_beat;
+	int                  stale;   // no heartbeat for a while, not dead yet
+	int                  decommission;
+	uint32_t             drain_pos;   // where the sweep of its blocks is
+	uint32_t             drain_short; // blocks the sweep found short
+	uint16_t             idx;
 	queue_t              del_blk;
 	uint64_t             del_blk_num;
+	queue_t              copy_blk;
+	uint64_t             copy_blk_num;
+	task_queue_node_t   *cmd_wait;      // answered with the next commands
+	rb_msec_t            cmd_wait_since; // parked or last answered
+	int                  cmd_channel;   // commands go on it, not heartbeats
+	uint32_t             cmd_seq;
+	char                *cmd_batch;     // sent on it, not acked yet
+	int                  cmd_batch_len;
 	dn_info_t            dni;
 } dn_store_t;
 
-typedef struct dn_timer_s {
-    dfs_hashtable_link_t  ln;
-	dfs_thread_t	     *thread;
-	event_t 		      ev;
-	dn_store_t           *dns;
-} dn_timer_t;
-        
 typedef struct dn_cache_mem_s 
 {
     void                *mem;
@@ -84,20 +155,42 @@ typedef struct dn_cache_mgmt_s
     dfs_hashtable_t  *dn_htable;
     pthread_rwlock_t  cache_rwlock;
     dn_cache_mem_t    mem_mgmt;
-    dfs_hashtable_t  *dn_timer_htable;
-    pthread_rwlock_t  timer_rwlock;
-	int               timeout; // MSec
+    pthread_mutex_t   wheel_lock;   // taken by the thread turning it
+    queue_t           wheel[DN_WHEEL_SLOTS];
+	rb_msec_t         wheel_tick;   // the last one turned
+	int               timeout;      // MSec
+	int               stale_timeout;
+	pthread_mutex_t   drain_lock;   // taken by the thread sweeping
+	rb_msec_t         drain_last;
 } dn_cache_mgmt_t;
 
 int nn_dn_index_worker_init(cycle_t *cycle);
 int nn_dn_index_worker_release(cycle_t *cycle);
+void dn_liveness_run(rb_msec_t now);
+void dn_decommission_run(rb_msec_t now);
 
 int nn_dn_register(task_t *task);
 int nn_dn_heartbeat(task_t *task);
 int nn_dn_recv_blk_report(task_t *task);
 int nn_dn_del_blk_report(task_t *task);
 int nn_dn_blk_report(task_t *task);
+int nn_dn_cmd_wait(task_t *task);
+
+int generate_dns(short blk_rep, uint64_t blk_sz, 
+	create_resp_info_t *resp_info);
+
+int get_dn_ip(uint16_t idx, char ip[32]);
+void get_dn_reader(const char *ip, dn_reader_t *reader);
+int get_dn_locations(const dn_reader_t *reader, const uint16_t *dns, 
+	int n, char (*ips)[32], int max);
+int get_dn_num();
+int dn_in_service(uint16_t idx);
+void get_dn_serving(dn_serving_t *ds);
+int get_dn_usage(dn_usage_t *usage, int max);
+uint16_t choose_copy_target(const uint16_t *holders, int n, 
+	uint64_t blk_sz, const uint16_t *in, int max_in);
+int notify_dn_2_copy_blk(long blk_id, uint16_t src, uint16_t target, 
+	int rate);
 
-int generate_dns(short blk_rep, create_resp_info_t *resp_info);
 #endif
 
@@ -0,0 +1,430 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "dfs_types.h"
+#include "config.h"
+#include "dfs_conf.h"
+#include "dfs_task_cmd.h"
+#include "nn_cycle.h"
+#include "nn_conf.h"
+#include "nn_time.h"
+#include "nn_file_index.h"
+#include "nn_blk_index.h"
+#include "nn_replication.h"
+#include "nn_dn_index.h"
+#include "EditlogSM.h"
+#include "EditlogCodec.h"
+#include "phxeditlog.pb.h"
+
+using namespace phxeditlog;
+using namespace std;
+
+#define DEFAULT_CONF_FILE PREFIX"/etc/namenode.conf"
+
+typedef struct bench_op_s
+{
+    int    group;
+	string key;
+	string value;
+} bench_op_t;
+
+typedef struct bench_conf_s
+{
+    int depth;
+	int fanout;
+	int files;
+	int blks;
+	int rm_pct;
+	int groups;
+} bench_conf_t;
+
+string_t config_file;
+char   **dfs_argv;
+int      dfs_argc;
+
+static bench_conf_t       g_bench = { 3, 10, 10, 2, 50, 0 };
+static uint64_t          *g_instance;
+static uint64_t           g_blk_id = 1;
+static uint64_t           g_mtime = 1;
+
+static void bench_show_help(void);
+static int parse_cmdline(int argc, char *const *argv);
+static int bench_group(const string & key);
+static void bench_path_key(const char *path, string & key);
+static void gen_mkdir(vector<bench_op_t> & ops, const char *path);
+static void gen_tree(vector<bench_op_t> & ops, vector<string> & leaves,
+	const char *path, int level);
+static void gen_file(vector<bench_op_t> & ops, vector<bench_op_t> & rms,
+	const char *path, int rm);
+static void run_phase(PhxEditlogSM & sm, const char *name,
+	vector<bench_op_t> & ops);
+static uint64_t now_ns(void);
+static long rss_bytes(void);
+
+static void bench_show_help(void)
+{
+    printf("\t -c, Configure file (namenode.conf)\n"
+		"\t -d, directory depth, default 3\n"
+        "\t -f, sub-directories per directory, default 10\n"
+        "\t -n, files per leaf directory, default 10\n"
+        "\t -b, blocks per file, default 2\n"
+        "\t -r, percent of files removed, default 50\n"
+        "\t -g, paxos groups, default server.paxos_group_num\n");
+}
+
+static int parse_cmdline(int argc, char *const *argv)
+{
+    int  ch = 0;
+	char buf[255] = {0};
+
+	while ((ch = getopt(argc, argv, "c:d:f:n:b:r:g:h")) != -1)
+	{
+        switch (ch)
+		{
+            case 'c':
+                if (*optarg == '/')
+				{
+                    config_file.data = (uchar_t *)strdup(optarg);
+                    config_file.len = strlen(optarg);
+                }
+				else
+				{
+                    getcwd(buf, sizeof(buf));
+                    buf[strlen(buf)] = '/';
+                    strcat(buf, optarg);
+                    config_file.data = (uchar_t *)strdup(buf);
+                    config_file.len = strlen(buf);
+                }
+
+                break;
+
+			case 'd':
+				g_bench.depth = atoi(optarg);
+				break;
+
+			case 'f':
+				g_bench.fanout = atoi(optarg);
+				break;
+
+			case 'n':
+				g_bench.files = atoi(optarg);
+				break;
+
+			case 'b':
+				g_bench.blks = atoi(optarg);
+				break;
+
+			case 'r':
+				g_bench.rm_pct = atoi(optarg);
+				break;
+
+			case 'g':
+				g_bench.groups = atoi(optarg);
+				break;
+
+            case 'h':
+
+            default:
+                bench_show_help();
+
+                return DFS_ERROR;
+        }
+    }
+
+	if (g_bench.depth < 0 || g_bench.fanout < 1 || g_bench.files < 0
+		|| g_bench.blks < 1 || g_bench.blks > BLK_LIMIT
+		|| g_bench.rm_pct < 0 || g_bench.rm_pct > 100)
+	{
+        bench_show_help();
+
+        return DFS_ERROR;
+	}
+
+    return DFS_OK;
+}
+
+int main(int argc, char **argv)
+{
+    cycle_t       *cycle = NULL;
+    conf_server_t *sconf = NULL;
+
+	if (parse_cmdline(argc, argv) != DFS_OK)
+	{
+        return DFS_ERROR;
+	}
+
+    if (config_file.data == NULL)
+	{
+        config_file.data = (uchar_t *)strndup(DEFAULT_CONF_FILE,
+            strlen(DEFAULT_CONF_FILE));
+        config_file.len = strlen(DEFAULT_CONF_FILE);
+    }
+
+	dfs_argc = argc;
+    dfs_argv = argv;
+
+	cycle = cycle_create();
+
+    time_init();
+
+    if (cycle_init(cycle) != DFS_OK)
+	{
+        fprintf(stderr, "cycle_init fail\n");
+
+        return DFS_ERROR;
+    }
+
+	sconf = (conf_server_t *)cycle->sconf;
+
+	if (g_bench.groups <= 0)
+	{
+        g_bench.groups = sconf->paxos_group_num > 0 
+			? sconf->paxos_group_num : 1;
+	}
+
+	// the apply path tracks instances for paxos_group_num groups
+	sconf->paxos_group_num = g_bench.groups;
+
+	if (nn_file_index_worker_init(cycle) != DFS_OK
+		|| nn_blk_index_worker_init(cycle) != DFS_OK
+		|| nn_replication_worker_init(cycle) != DFS_OK
+		|| nn_dn_index_worker_init(cycle) != DFS_OK)
+	{
+        fprintf(stderr, "index init fail\n");
+
+        return DFS_ERROR;
+	}
+
+	g_instance = (uint64_t *)calloc(g_bench.groups, sizeof(uint64_t));
+
+	vector<bench_op_t> mkdirs;
+	vector<bench_op_t> writes;
+	vector<bench_op_t> rms;
+	vector<string>     leaves;
+
+	gen_mkdir(mkdirs, "/");
+	gen_tree(mkdirs, leaves, "", 0);
+
+	for (size_t i = 0; i < leaves.size(); i++)
+	{
+	    for (int j = 0; j < g_bench.files; j++)
+		{
+		    char path[PATH_LEN] = {0};
+			snprintf(path, sizeof(path), "%s/f%d", leaves[i].c_str(), j);
+
+			gen_file(writes, rms, path,
+				(int)((i * g_bench.files + j) % 100) < g_bench.rm_pct);
+		}
+	}
+
+	uint64_t inodes = mkdirs.size() + leaves.size() * g_bench.files;
+	if (inodes > sconf->index_num)
+	{
+	    fprintf(stderr, "%lu inodes exceed server.index_num %lu\n",
+			inodes, sconf->index_num);
+
+        return DFS_ERROR;
+	}
+
+	printf("depth %d, fanout %d, files %d, blks %d, rm %d%%, groups %d\n",
+		g_bench.depth, g_bench.fanout, g_bench.files, g_bench.blks,
+		g_bench.rm_pct, g_bench.groups);
+	printf("%-8s %10s %12s %10s %10s %10s %10s %10s\n", "phase", "ops",
+		"ops/sec", "p50(us)", "p90(us)", "p99(us)", "p999(us)", "max(us)");
+
+	PhxEditlogSM sm(g_bench.groups);
+	long rss = rss_bytes();
+
+	run_phase(sm, "mkdir", mkdirs);
+	run_phase(sm, "write", writes);
+
+	long used = rss_bytes() - rss;
+
+	run_phase(sm, "rm", rms);
+
+	printf("inodes %lu, resident %.1f bytes/inode, index %lu bytes/inode\n",
+		inodes, inodes ? (double)used / inodes : 0.0,
+		(uint64_t)(FI_STORE_BUF_PER_SZ + HASH_BUF_PER_SZ));
+
+	nn_dn_index_worker_release(cycle);
+	nn_replication_worker_release(cycle);
+	nn_blk_index_worker_release(cycle);
+	nn_file_index_worker_release(cycle);
+	free(g_instance);
+
+	return DFS_OK;
+}
+
+static int bench_group(const string & key)
+{
+    uint32_t hash = 0;
+
+	// same spread as FSEditlog::GetGroupIdx
+	for (size_t i = 0; i < key.size(); i++)
+    {
+        hash = hash * 7 + ((int)key[i]);
+    }
+
+    return hash % g_bench.groups;
+}
+
+static void bench_path_key(const char *path, string & key)
+{
+    uchar_t buf[PATH_LEN * 2] = {0};
+
+	key_encode((uchar_t *)path, buf);
+	key = (const char *)buf;
+}
+
+static void gen_mkdir(vector<bench_op_t> & ops, const char *path)
+{
+    bench_op_t op;
+	LogMkdir   mkr;
+
+	bench_path_key(path, op.key);
+	op.group = bench_group(op.key);
+
+	mkr.set_key(op.key);
+	mkr.set_permission(0755);
+	mkr.set_owner("bench");
+	mkr.set_group("bench");
+	mkr.set_modification_time(g_mtime++);
+	EditlogCodec::Encode(NN_MKDIR, LogOperator::kMkrFieldNumber, mkr, op.value);
+
+	ops.push_back(op);
+}
+
+static void gen_tree(vector<bench_op_t> & ops, vector<string> & leaves,
+	const char *path, int level)
+{
+    if (level == g_bench.depth)
+	{
+	    leaves.push_back(path);
+
+        return;
+	}
+
+	for (int i = 0; i < g_bench.fanout; i++)
+	{
+	    char sub[PATH_LEN] = {0};
+		snprintf(sub, sizeof(sub), "%s/d%d", path, i);
+
+		gen_mkdir(ops, sub);
+		gen_tree(ops, leaves, sub, level + 1);
+	}
+}
+
+static void gen_file(vector<bench_op_t> & ops, vector<bench_op_t> & rms,
+	const char *path, int rm)
+{
+    bench_op_t op;
+
+	bench_path_key(path, op.key);
+	op.group = bench_group(op.key);
+
+	LogCreate cre;
+	cre.set_key(op.key);
+	cre.set_permission(0644);
+	cre.set_owner("bench");
+	cre.set_group("bench");
+	cre.set_modification_time(g_mtime++);
+	cre.set_blk_id(g_blk_id++);
+	cre.set_blk_sz(64 * 1024 * 1024);
+	cre.set_blk_rep(3);
+	EditlogCodec::Encode(NN_CREATE, LogOperator::kCreFieldNumber, cre, op.value);
+	ops.push_back(op);
+
+	for (int i = 1; i < g_bench.blks; i++)
+	{
+	    LogGetAdditionalBlk gab;
+		gab.set_key(op.key);
+		gab.set_blk_id(g_blk_id++);
+		gab.set_blk_sz(64 * 1024 * 1024);
+		gab.set_blk_rep(3);
+		EditlogCodec::Encode(NN_GET_ADDITIONAL_BLK,
+			LogOperator::kGabFieldNumber, gab, op.value);
+		ops.push_back(op);
+	}
+
+	LogClose cle;
+	cle.set_key(op.key);
+	cle.set_modification_time(g_mtime++);
+	cle.set_len((uint64_t)g_bench.blks * 64 * 1024 * 1024);
+	cle.set_blk_rep(3);
+	EditlogCodec::Encode(NN_CLOSE, LogOperator::kCleFieldNumber, cle, op.value);
+	ops.push_back(op);
+
+	if (rm)
+	{
+	    LogRm lrm;
+		lrm.set_key(op.key);
+		lrm.set_modification_time(g_mtime++);
+		EditlogCodec::Encode(NN_RM, LogOperator::kRmFieldNumber, lrm, op.value);
+		rms.push_back(op);
+	}
+}
+
+static void run_phase(PhxEditlogSM & sm, const char *name,
+	vector<bench_op_t> & ops)
+{
+    vector<uint64_t> lat(ops.size());
+
+	if (ops.empty())
+	{
+        return;
+	}
+
+	uint64_t start = now_ns();
+
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+	    uint64_t t = now_ns();
+
+	    sm.Execute(ops[i].group, g_instance[ops[i].group]++, ops[i].value,
+			NULL);
+
+		lat[i] = now_ns() - t;
+	}
+
+	uint64_t total = now_ns() - start;
+
+	sort(lat.begin(), lat.end());
+
+	size_t n = lat.size();
+
+	printf("%-8s %10lu %12.0f %10.2f %10.2f %10.2f %10.2f %10.2f\n", name,
+		n, n * 1e9 / total, lat[n * 50 / 100] / 1e3,
+		lat[n * 90 / 100] / 1e3, lat[n * 99 / 100] / 1e3,
+		lat[n * 999 / 1000] / 1e3, lat[n - 1] / 1e3);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long rss_bytes(void)
+{
+    long  size = 0;
+	long  resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (!fp)
+	{
+        return 0;
+	}
+
+	if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+	{
+	    resident = 0;
+	}
+
+	fclose(fp);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
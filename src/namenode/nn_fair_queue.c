@@ -0,0 +1,284 @@
+#include <stdlib.h>
+
+#include "nn_fair_queue.h"
+#include "nn_cycle.h"
+#include "nn_conf.h"
+#include "dfs_string.h"
+#include "dfs_error_log.h"
+
+static int fq_user_cmp(const void *arg1, const void *arg2, size_t size);
+static fq_user_t *fq_user_get(fair_queue_t *fq, const char *name);
+static int fq_user_weight(const char *name);
+static task_queue_node_t *fq_user_take(fair_queue_t *fq, fq_user_t *u,
+	queue_t *q);
+static void fq_user_free(void *data);
+
+int fair_queue_init(fair_queue_t *fq)
+{
+    conf_server_t *sconf = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+
+    fq->users = dfs_hashtable_create(fq_user_cmp, FQ_USER_HASH_SIZE,
+		dfs_hashtable_hash_low, NULL);
+	if (!fq->users)
+	{
+        return DFS_ERROR;
+	}
+
+	if (pthread_spin_init(&fq->lock, 0) != 0)
+	{
+        return DFS_ERROR;
+	}
+
+	queue_init(&fq->active);
+	queue_init(&fq->all);
+	fq->count = 0;
+	fq->by_group = sconf->fair_by_group;
+	fq->last_stat = 0;
+
+	return DFS_OK;
+}
+
+void fair_queue_release(fair_queue_t *fq)
+{
+    if (!fq->users)
+	{
+        return;
+	}
+
+	dfs_hashtable_free_items(fq->users, fq_user_free, NULL);
+	dfs_hashtable_free_memory(fq->users);
+	fq->users = NULL;
+	pthread_spin_destroy(&fq->lock);
+}
+
+int fair_queue_push(fair_queue_t *fq, task_queue_node_t *node)
+{
+    fq_user_t *u = NULL;
+
+	pthread_spin_lock(&fq->lock);
+
+	u = fq_user_get(fq, fq->by_group ? node->tk.group : node->tk.user);
+	if (!u)
+	{
+	    pthread_spin_unlock(&fq->lock);
+
+        return DFS_ERROR;
+	}
+
+	queue_insert_tail(&u->tq, &node->qe);
+
+	if (!u->depth++)
+	{
+        queue_insert_tail(&fq->active, &u->active);
+	}
+
+	fq->count++;
+
+	pthread_spin_unlock(&fq->lock);
+
+	return DFS_OK;
+}
+
+// each turn a user may run weight tasks before the next user is served
+task_queue_node_t *fair_queue_pop(fair_queue_t *fq)
+{
+    fq_user_t         *u = NULL;
+	task_queue_node_t *node = NULL;
+
+	if (!fq->count)
+	{
+        return NULL;
+	}
+
+	pthread_spin_lock(&fq->lock);
+
+	while (!queue_empty(&fq->active))
+	{
+	    u = queue_data(queue_head(&fq->active), fq_user_t, active);
+
+		if (u->deficit <= 0)
+		{
+            u->deficit += u->weight;
+			queue_remove(&u->active);
+			queue_insert_tail(&fq->active, &u->active);
+
+			continue;
+		}
+
+		u->deficit--;
+		node = fq_user_take(fq, u, &u->tq);
+
+		break;
+	}
+
+	pthread_spin_unlock(&fq->lock);
+
+	return node;
+}
+
+// the user up next gives one up to an idle peer
+task_queue_node_t *fair_queue_steal(fair_queue_t *fq)
+{
+    fq_user_t         *u = NULL;
+	task_queue_node_t *node = NULL;
+
+	if (!fq->count)
+	{
+        return NULL;
+	}
+
+	pthread_spin_lock(&fq->lock);
+
+	if (!queue_empty(&fq->active))
+	{
+	    u = queue_data(queue_head(&fq->active), fq_user_t, active);
+        node = fq_user_take(fq, u, &u->tq);
+	}
+
+	pthread_spin_unlock(&fq->lock);
+
+	return node;
+}
+
+// users with nothing queued that ran nothing since the last stat are 
+// dropped, they are made again by their next task. no log, no stats
+void fair_queue_stat(fair_queue_t *fq, log_t *log)
+{
+    queue_t   *qe = NULL;
+	queue_t   *next = NULL;
+	fq_user_t *u = NULL;
+
+	pthread_spin_lock(&fq->lock);
+
+	for (qe = queue_head(&fq->all); qe != queue_sentinel(&fq->all);
+		qe = next)
+	{
+	    next = queue_next(qe);
+	    u = queue_data(qe, fq_user_t, me);
+
+		if (!u->depth && !u->served)
+		{
+		    dfs_hashtable_remove_link(fq->users, &u->ln);
+			queue_remove(&u->me);
+			fq_user_free(u);
+			
+            continue;
+		}
+
+		if (log)
+		{
+		    dfs_log_error(log, DFS_LOG_INFO, 0,
+			    "fair queue %s weight %d depth %ud served %uL",
+			    u->name, u->weight, u->depth, u->served);
+		}
+
+		u->served = 0;
+	}
+
+	pthread_spin_unlock(&fq->lock);
+}
+
+static task_queue_node_t *fq_user_take(fair_queue_t *fq, fq_user_t *u,
+	                                              queue_t *q)
+{
+    queue_t *qe = NULL;
+
+	qe = queue_head(q);
+	queue_remove(qe);
+
+	fq->count--;
+	u->served++;
+
+	if (!--u->depth)
+	{
+	    queue_remove(&u->active);
+        u->deficit = 0;
+	}
+
+	return queue_data(qe, task_queue_node_t, qe);
+}
+
+static fq_user_t *fq_user_get(fair_queue_t *fq, const char *name)
+{
+    size_t     len = 0;
+    fq_user_t *u = NULL;
+
+	len = strnlen(name, OWNER_LEN - 1);
+
+	u = (fq_user_t *)dfs_hashtable_lookup(fq->users, name, len);
+	if (u)
+	{
+        return u;
+	}
+
+	u = (fq_user_t *)calloc(1, sizeof(fq_user_t));
+	if (!u)
+	{
+        return NULL;
+	}
+
+	memcpy(u->name, name, len);
+	u->ln.key = u->name;
+	u->ln.len = len;
+	u->weight = fq_user_weight(u->name);
+	queue_init(&u->tq);
+	queue_init(&u->active);
+	queue_insert_tail(&fq->all, &u->me);
+
+	dfs_hashtable_join(fq->users, &u->ln);
+
+	return u;
+}
+
+// server.fair_weights = "alice:4,bob:2", anyone not listed weighs 1
+static int fq_user_weight(const char *name)
+{
+    size_t         len = 0;
+	int            weight = 0;
+    char          *p = NULL;
+	char          *end = NULL;
+	conf_server_t *sconf = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+	len = strlen(name);
+	p = (char *)sconf->fair_weights.data;
+	end = p + sconf->fair_weights.len;
+
+	while (p && p < end)
+	{
+	    if ((size_t)(end - p) > len && !strncmp(p, name, len)
+			&& p[len] == ':')
+		{
+            weight = atoi(p + len + 1);
+
+			return weight > 0 ? weight : 1;
+		}
+
+		p = (char *)memchr(p, ',', end - p);
+		while (p && p < end && (*p == ',' || *p == ' '))
+		{
+            p++;
+		}
+	}
+
+	return 1;
+}
+
+// arg2 is the stored name, it must end where the looked up one does
+static int fq_user_cmp(const void *arg1, const void *arg2, size_t size)
+{
+    if (string_strncmp(arg1, arg2, size)) 
+	{
+        return DFS_ERROR;
+	}
+
+	return ((const char *)arg2)[size] != '\0';
+}
+
+static void fq_user_free(void *data)
+{
+    free(data);
+}
+
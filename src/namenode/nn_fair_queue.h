@@ -0,0 +1,48 @@
+#ifndef NN_FAIR_QUEUE_H
+#define NN_FAIR_QUEUE_H
+
+#include <pthread.h>
+
+#include "dfs_types.h"
+#include "dfs_queue.h"
+#include "dfs_hashtable.h"
+#include "nn_task_queue.h"
+
+#define FQ_USER_HASH_SIZE 1024
+#define FQ_IDLE_TICK      60000 // MSec, idle users dropped when no stats
+
+// deficit round robin between users over the unkeyed tasks a task 
+// thread took from its tq. keyed ones stay in order on kq, outside it
+typedef struct fq_user_s
+{
+    dfs_hashtable_link_t ln;
+    char                 name[OWNER_LEN];
+    queue_t              tq;
+    queue_t              active;  // on fq->active while it has tasks
+    queue_t              me;
+    int                  weight;
+    int                  deficit;
+    uint32_t             depth;
+    uint64_t             served;
+} fq_user_t;
+
+typedef struct fair_queue_s
+{
+    dfs_hashtable_t    *users;
+    queue_t             active;
+    queue_t             all;
+    uint32_t            count;
+    int                 by_group;
+    rb_msec_t           last_stat;
+    pthread_spinlock_t  lock;
+} fair_queue_t;
+
+int  fair_queue_init(fair_queue_t *fq);
+void fair_queue_release(fair_queue_t *fq);
+int  fair_queue_push(fair_queue_t *fq, task_queue_node_t *node);
+task_queue_node_t *fair_queue_pop(fair_queue_t *fq);
+task_queue_node_t *fair_queue_steal(fair_queue_t *fq);
+void fair_queue_stat(fair_queue_t *fq, log_t *log);
+
+#endif
+
@@ -1,11 +1,13 @@
 #include <dirent.h>
 #include <string>
+#include <vector>
 #include "nn_file_index.h"
 #include "dfs_math.h"
 #include "dfs_memory.h"
 #include "nn_paxos.h"
 #include "fs_permission.h"
 #include "phxeditlog.pb.h"
+#include "EditlogCodec.h"
 #include "nn_thread.h"
 #include "nn_conf.h"
 #include "nn_net_response_handler.h"
@@ -19,13 +21,18 @@ using namespace std;
 #define FINDEX_TIMER_NR 10000
 #define SEC2MSEC(X) ((X) * 1000)
 #define FI_CREATE_TIME_OUT (60 * 60 * 1000)
+#define FI_IMAGE_BATCH 64
+#define FI_OPEN_REPLICAS 16 // looked up per block, the closest are sent
 
 extern _xvolatile rb_msec_t dfs_current_msec;
 
-uint64_t lastCheckpointInstanceID = 0;
 extern dfs_thread_t    *paxos_thread;
 static fi_cache_mgmt_t *g_fcm;
 static queue_t          g_checkpoint_q;
+static int              g_group_num;
+static uint64_t        *g_applied_instance;
+static uint64_t        *g_ckp_instance;
+static pthread_mutex_t  g_ckp_lock = PTHREAD_MUTEX_INITIALIZER;
 
 dfs_atomic_lock_t g_fs_object_num_lock;
 uint64_t          g_fs_object_num;
@@ -57,6 +64,7 @@ static int mv_current();
 static int copy_file(const char *src, const char *dst);
 static int mv_last_checkpoint();
 static int delete_dir(const char *dir);
+static int install_file(const char *src, const char *dst);
 static int update_fi_create(fi_inode_t *fin, uint64_t blk_id, void *data);
 static void fi_create_timeout(event_t *ev);
 static int update_fi_get_additional_blk(fi_inode_t *fin, 
@@ -83,6 +91,21 @@ int nn_file_index_worker_init(cycle_t *cycle)
 	g_fs_object_num = 0;
 
 	queue_init(&g_checkpoint_q);
+
+	g_group_num = conf->paxos_group_num;
+	g_applied_instance = (uint64_t *)memory_alloc(
+		sizeof(uint64_t) * g_group_num);
+	g_ckp_instance = (uint64_t *)memory_alloc(sizeof(uint64_t) * g_group_num);
+	if (!g_applied_instance || !g_ckp_instance) 
+	{
+        return DFS_ERROR;
+	}
+
+	for (int i = 0; i < g_group_num; i++) 
+	{
+	    g_applied_instance[i] = NoCheckpoint;
+		g_ckp_instance[i] = NoCheckpoint;
+	}
 	
     return DFS_OK;
 }
@@ -92,6 +115,18 @@ int nn_file_index_worker_release(cycle_t *cycle)
     fi_cache_mgmt_release(g_fcm);
 	g_fcm = NULL;
 
+	if (g_applied_instance) 
+	{
+	    memory_free(g_applied_instance, sizeof(uint64_t) * g_group_num);
+		g_applied_instance = NULL;
+	}
+
+	if (g_ckp_instance) 
+	{
+	    memory_free(g_ckp_instance, sizeof(uint64_t) * g_group_num);
+		g_ckp_instance = NULL;
+	}
+
     return DFS_OK;
 }
 
@@ -106,6 +141,7 @@ static fi_cache_mgmt_t *fi_cache_mgmt_new_init(conf_server_t *conf)
     }
 
     pthread_rwlock_init(&fcm->cache_rwlock, NULL);
+    pthread_rwlock_init(&fcm->apply_rwlock, NULL);
 
     return fcm;
 }
@@ -264,6 +300,7 @@ static void fi_cache_mgmt_release(fi_cache_mgmt_t *fcm)
     pthread_rwlock_unlock(&fcm->timer_rwlock);
 
 	pthread_rwlock_destroy(&fcm->cache_rwlock);
+	pthread_rwlock_destroy(&fcm->apply_rwlock);
 	pthread_rwlock_destroy(&fcm->timer_rwlock);
 
     fi_mem_mgmt_destroy(&fcm->mem_mgmt);
@@ -620,14 +657,30 @@ int nn_rm(task_t *task)
     return notice_wake_up(&paxos_thread->tq_notice);
 }
 
+// every block of the file covering the range asked for, with where 
+// each block starts and its replicas closest to the client first
 int nn_open(task_t *task)
 {
-    create_blk_info_t  blk_info;
-	create_resp_info_t resp_info;
-
-    memset(&resp_info, 0x00, sizeof(create_resp_info_t));
-	memset(&blk_info, 0x00, sizeof(create_blk_info_t));
-	memcpy(&blk_info, task->data, sizeof(create_blk_info_t));
+    int                i = 0;
+	int                n = 0;
+	int                num = 0;
+	int                located = 0;
+	uint64_t           off = 0;
+	uint64_t           end = 0;
+	uint64_t           size = 0;
+	char              *buf = NULL;
+	nn_wb_t           *wbt = NULL;
+	open_resp_head_t  *head = NULL;
+	blk_loc_t         *loc = NULL;
+	open_range_info_t  range;
+	dn_reader_t        reader;
+	uint16_t           dns[FI_OPEN_REPLICAS];
+
+	memset(&range, 0x00, sizeof(open_range_info_t));
+	if (task->data && task->data_len >= (int)sizeof(open_range_info_t)) 
+	{
+        memcpy(&range, task->data, sizeof(open_range_info_t));
+	}
 
 	task->data_len = 0;
 	task->data = NULL;
@@ -669,61 +722,139 @@ int nn_open(task_t *task)
 			return write_back(node);
 		}
 	}
-	
-	blk_store_t *blk = get_blk_store_obj(fin.blks[0]);
-
-	resp_info.blk_id = blk->id;
-	resp_info.blk_sz = blk->size;
-	resp_info.namespace_id = dfs_cycle->namespace_id;
 
-	resp_info.dn_num = 1;
-	strcpy(resp_info.dn_ips[0], blk->dn_ip);
-	strcpy(resp_info.dn_ips[1], "");
-	strcpy(resp_info.dn_ips[2], "");
+	while (num < BLK_LIMIT && fin.blks[num] > 0 
+		&& fin.blks[num] != (uint64_t)-1) 
+	{
+        num++;
+	}
 
-	task->data_len = sizeof(create_resp_info_t);
-	task->data = malloc(task->data_len);
-	if (NULL == task->data) 
+	buf = (char *)malloc(sizeof(open_resp_head_t) + num * sizeof(blk_loc_t));
+	if (NULL == buf) 
 	{
         dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, "malloc err");
+
+		task->ret = FAIL;
+
+		return write_back(node);
 	}
-	
-	memcpy(task->data, &resp_info, task->data_len);
+
+	head = (open_resp_head_t *)buf;
+	memset(head, 0x00, sizeof(open_resp_head_t));
+	head->namespace_id = dfs_cycle->namespace_id;
+	head->length = fin.length;
+
+	end = range.len > 0 && range.offset + range.len > range.offset 
+		? range.offset + range.len : (uint64_t)-1;
+
+	wbt = (nn_wb_t *)task->opq;
+	get_dn_reader(wbt && wbt->mc ? wbt->mc->ipaddr : NULL, &reader);
+
+	loc = (blk_loc_t *)(head + 1);
+
+	for (i = 0; i < num && off < end; i++) 
+	{
+	    size = 0;
+	    n = get_blk_replicas(fin.blks[i], &size, NULL, dns, 
+			FI_OPEN_REPLICAS);
+
+		// no datanode has told its size yet, it is as long as was asked
+		if (!size && off < fin.length) 
+		{
+            size = fin.length - off < fin.blk_size 
+				? fin.length - off : fin.blk_size;
+		}
+
+		if (off + size > range.offset) 
+		{
+		    memset(loc, 0x00, sizeof(blk_loc_t));
+			loc->blk_id = fin.blks[i];
+			loc->blk_sz = size;
+			loc->offset = off;
+			loc->dn_num = n > 0 ? get_dn_locations(&reader, dns, n, 
+				loc->dn_ips, BLK_LOC_DN_MAX) : 0;
+
+			located += loc->dn_num > 0;
+			head->blk_num++;
+			loc++;
+		}
+
+		off += size;
+	}
+
+	if (head->blk_num > 0 && 0 == located) 
+	{
+	    free(buf);
+		
+        task->ret = NOT_DATANODE;
+
+		return write_back(node);
+	}
+
+	task->data = buf;
+	task->data_len = sizeof(open_resp_head_t) 
+		+ head->blk_num * sizeof(blk_loc_t);
 
 	task->ret = SUCC;
 	
 	return write_back(node);
 }
 
-int update_fi_cache_mgmt(const uint64_t llInstanceID, 
+int update_fi_cache_mgmt(const int iGroupIdx, const uint64_t llInstanceID, 
 	const std::string & sPaxosValue, void *data)
 {
-    fi_inode_t fin;
+    // decoded in place on every apply, keep the messages per paxos 
+    // group thread so their strings are reused instead of reallocated
+    static thread_local LogMkdir            mkr;
+    static thread_local LogRmr              rmr;
+    static thread_local LogCreate           cre;
+    static thread_local LogGetAdditionalBlk gab;
+    static thread_local LogClose            cle;
+    static thread_local LogRm               rm;
+	
+    int         rs = DFS_OK;
+	uint32_t    optype = 0;
+	const char *sub = NULL;
+	int         sub_len = 0;
+    fi_inode_t  fin;
+	
 	memset(&fin, 0x00, sizeof(fi_inode_t));
 		
-    string str;
-    LogOperator lopr;
-	lopr.ParseFromString(sPaxosValue);
+	if (EditlogCodec::Decode(sPaxosValue, optype, sub, sub_len) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
+			"decode editlog err, instanceid: %lu", llInstanceID);
+
+		optype = 0;
+	}
 
-	int optype = lopr.optype();
+	// the applied instance must move together with the namespace, 
+	// save_image takes the write side to get a consistent cut
+	pthread_rwlock_rdlock(&g_fcm->apply_rwlock);
 	
 	switch (optype)
     {
+    case 0:
+		rs = DFS_ERROR;
+		break;
+		
     case NN_MKDIR:
+		mkr.ParseFromArray(sub, sub_len);
 		fin.uid = llInstanceID;
-		strcpy(fin.key, lopr.mutable_mkr()->key().c_str());
-		fin.permission = lopr.mutable_mkr()->permission();
-		strcpy(fin.owner, lopr.mutable_mkr()->owner().c_str());
-		strcpy(fin.group, lopr.mutable_mkr()->group().c_str());
-		fin.modification_time = lopr.mutable_mkr()->modification_time();
+		strcpy(fin.key, mkr.key().c_str());
+		fin.permission = mkr.permission();
+		strcpy(fin.owner, mkr.owner().c_str());
+		strcpy(fin.group, mkr.group().c_str());
+		fin.modification_time = mkr.modification_time();
 		fin.is_directory = DFS_TRUE;
 		
 		update_fi_mkdir(&fin);
 		break;
 
 	case NN_RMR:
-		strcpy(fin.key, lopr.mutable_rmr()->key().c_str());
-		fin.modification_time = lopr.mutable_rmr()->modification_time();
+		rmr.ParseFromArray(sub, sub_len);
+		strcpy(fin.key, rmr.key().c_str());
+		fin.modification_time = rmr.modification_time();
 
 		update_fi_rmr(&fin);
 		break;
@@ -732,40 +863,46 @@ int update_fi_cache_mgmt(const uint64_t llInstanceID,
 		break;
 
 	case NN_CREATE:
+		cre.ParseFromArray(sub, sub_len);
 		fin.uid = llInstanceID;
-		strcpy(fin.key, lopr.mutable_cre()->key().c_str());
-		fin.permission = lopr.mutable_cre()->permission();
-		strcpy(fin.owner, lopr.mutable_cre()->owner().c_str());
-		strcpy(fin.group, lopr.mutable_cre()->group().c_str());
-		fin.modification_time = lopr.mutable_cre()->modification_time();
-		fin.blk_size = lopr.mutable_cre()->blk_sz();
-		fin.blk_replication = lopr.mutable_cre()->blk_rep();
+		strcpy(fin.key, cre.key().c_str());
+		fin.permission = cre.permission();
+		strcpy(fin.owner, cre.owner().c_str());
+		strcpy(fin.group, cre.group().c_str());
+		fin.modification_time = cre.modification_time();
+		fin.blk_size = cre.blk_sz();
+		fin.blk_replication = cre.blk_rep();
 		fin.is_directory = DFS_FALSE;
 		
-		update_fi_create(&fin, lopr.mutable_cre()->blk_id(), data);
+		update_fi_create(&fin, cre.blk_id(), data);
+		set_blk_replication(cre.blk_id(), cre.blk_rep());
 		break;
 
 	case NN_GET_ADDITIONAL_BLK:
+		gab.ParseFromArray(sub, sub_len);
 		fin.uid = llInstanceID;
-		strcpy(fin.key, lopr.mutable_gab()->key().c_str());
-		fin.blk_size = lopr.mutable_gab()->blk_sz();
-		fin.blk_replication = lopr.mutable_gab()->blk_rep();
+		strcpy(fin.key, gab.key().c_str());
+		fin.blk_size = gab.blk_sz();
+		fin.blk_replication = gab.blk_rep();
 
-		update_fi_get_additional_blk(&fin, lopr.mutable_gab()->blk_id());
+		update_fi_get_additional_blk(&fin, gab.blk_id());
+		set_blk_replication(gab.blk_id(), gab.blk_rep());
 		break;
 
 	case NN_CLOSE:
-		strcpy(fin.key, lopr.mutable_cle()->key().c_str());
-		fin.modification_time = lopr.mutable_cle()->modification_time();
-		fin.length = lopr.mutable_cle()->len();
-		fin.blk_replication = lopr.mutable_cle()->blk_rep();
+		cle.ParseFromArray(sub, sub_len);
+		strcpy(fin.key, cle.key().c_str());
+		fin.modification_time = cle.modification_time();
+		fin.length = cle.len();
+		fin.blk_replication = cle.blk_rep();
 
 		update_fi_close(&fin);
 		break;
 
 	case NN_RM:
-		strcpy(fin.key, lopr.mutable_rm()->key().c_str());
-		fin.modification_time = lopr.mutable_rm()->modification_time();
+		rm.ParseFromArray(sub, sub_len);
+		strcpy(fin.key, rm.key().c_str());
+		fin.modification_time = rm.modification_time();
 
 		update_fi_rm(&fin);
 		break;
@@ -775,11 +912,18 @@ int update_fi_cache_mgmt(const uint64_t llInstanceID,
 		
 	default:
 		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
-			"unknown optype: ", optype);
-		return DFS_ERROR;
+			"unknown optype: %d", optype);
+		rs = DFS_ERROR;
 	}
+
+	if (iGroupIdx >= 0 && iGroupIdx < g_group_num) 
+	{
+	    g_applied_instance[iGroupIdx] = llInstanceID;
+	}
+
+	pthread_rwlock_unlock(&g_fcm->apply_rwlock);
 	
-    return DFS_OK;
+    return rs;
 }
 
 static void get_parent_key(uchar_t path[], uchar_t key[])
@@ -932,35 +1076,162 @@ static int clear_children(queue_t *head, uint64_t num)
 
 int do_checkpoint()
 {
+    int rs = DFS_ERROR;
+
+	// a paxos learner may be streaming current/ to another node
+	if (pthread_mutex_trylock(&g_ckp_lock) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+			"checkpoint state is locked, skip this checkpoint");
+		
+	    return DFS_OK;
+	}
+
 	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"do_checkpoint start, lastCheckpointInstanceID: %ld", 
-		lastCheckpointInstanceID);
+		"do_checkpoint start");
 
     if (mv_current() != DFS_OK) 
 	{
-        return DFS_ERROR;
+        goto out;
 	}
     
 	if (save_image() != DFS_OK) 
 	{
-        return DFS_ERROR;
+        goto out;
 	}
 
 	if (save_checkpoinID() != DFS_OK) 
 	{
-        return DFS_ERROR;
+        goto out;
 	}
 
 	if (mv_last_checkpoint() != DFS_OK) 
+	{
+        goto out;
+	}
+
+	for (int i = 0; i < g_group_num; i++) 
+	{
+	    set_checkpoint_instanceID(i, g_ckp_instance[i]);
+	}
+
+	rs = DFS_OK;
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+		"do_checkpoint done");
+
+out:
+	pthread_mutex_unlock(&g_ckp_lock);
+	
+    return rs;
+}
+
+int lock_checkpoint_state()
+{
+    if (pthread_mutex_lock(&g_ckp_lock) != DFS_OK) 
 	{
         return DFS_ERROR;
 	}
 
-	set_checkpoint_instanceID(lastCheckpointInstanceID);
+	return DFS_OK;
+}
+
+void unlock_checkpoint_state()
+{
+    pthread_mutex_unlock(&g_ckp_lock);
+}
+
+int get_checkpoint_state(string & dir, vector<string> & files)
+{
+    conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+	const char    *names[] = { "fsimage", "ckpid" };
+	
+	char path[PATH_LEN] = {0};
+	string_xxsprintf((uchar_t *)path, "%s/current", conf->fsimage_dir.data);
+	dir = path;
+
+	files.clear();
+	
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) 
+	{
+	    string name = dir + "/" + names[i];
+		if (access(name.c_str(), F_OK) == DFS_OK) 
+		{
+		    files.push_back(names[i]);
+		}
+	}
 	
     return DFS_OK;
 }
 
+int load_checkpoint_state(const string & dir, const vector<string> & files)
+{
+    conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+	int            rs = DFS_ERROR;
+
+	pthread_mutex_lock(&g_ckp_lock);
+
+	// keep the local image as previous.checkpoint
+	if (mv_current() != DFS_OK) 
+	{
+        goto out;
+	}
+
+	for (size_t i = 0; i < files.size(); i++) 
+	{
+	    const char *name = strrchr(files[i].c_str(), '/');
+		name = name ? name + 1 : files[i].c_str();
+		
+	    char dst[PATH_LEN] = {0};
+		string_xxsprintf((uchar_t *)dst, "%s/current/%s", 
+			conf->fsimage_dir.data, name);
+
+		if (install_file(files[i].c_str(), dst) != DFS_OK) 
+		{
+            goto out;
+		}
+	}
+
+	if (mv_last_checkpoint() != DFS_OK) 
+	{
+        goto out;
+	}
+
+	rs = DFS_OK;
+
+	dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+		"load checkpoint from %s done, files: %d", dir.c_str(), 
+		(int)files.size());
+
+out:
+	pthread_mutex_unlock(&g_ckp_lock);
+	
+    return rs;
+}
+
+static int install_file(const char *src, const char *dst)
+{
+    char tmp[PATH_LEN] = {0};
+	string_xxsprintf((uchar_t *)tmp, "%s.tmp", dst);
+
+	if (copy_file(src, tmp) != DFS_OK) 
+	{
+	    unlink(tmp);
+		
+        return DFS_ERROR;
+	}
+
+	if (rename(tmp, dst) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			"rename %s to %s err", tmp, dst);
+		
+        return DFS_ERROR;
+	}
+
+	return DFS_OK;
+}
+
 static int mv_current()
 {
     conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
@@ -971,6 +1242,21 @@ static int mv_current()
 	string_xxsprintf((uchar_t *)dst, "%s/lastcheckpoint.tmp", 
 		conf->fsimage_dir.data);
 	
+	if (access(src, F_OK) != DFS_OK 
+		&& mkdir(src, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			"mkdir %s err", src);
+		
+	    return DFS_ERROR;
+	}
+
+	// left behind by an interrupted checkpoint
+	if (access(dst, F_OK) == DFS_OK) 
+	{
+	    delete_dir(dst);
+	}
+	
     // mv current to lastcheckpoint.tmp
 	if (mkdir(dst, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH) != DFS_OK) 
 	{
@@ -1156,9 +1442,7 @@ static int delete_dir(const char *dir)
 
 int load_image()
 {
-    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
-		"load_image start, lastCheckpointInstanceID: %l", 
-		lastCheckpointInstanceID);
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, "load_image start");
 
 	conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
 
@@ -1181,10 +1465,27 @@ int load_image()
 	while (read(fd, &fin, sizeof(fi_inode_t)) > 0) 
 	{
 	    update_fi_mkdir(&fin);
+
+		// what the replication monitor holds reported blocks to
+		for (int i = 0; !fin.is_directory && i < BLK_LIMIT; i++) 
+		{
+            if (fin.blks[i] > 0 && fin.blks[i] != (uint64_t)-1) 
+			{
+                set_blk_replication(fin.blks[i], fin.blk_replication);
+			}
+		}
 	}
 
-    read_checkpoinID();
-    set_checkpoint_instanceID(lastCheckpointInstanceID);
+	close(fd);
+
+    if (read_checkpoinID() == DFS_OK) 
+	{
+	    for (int i = 0; i < g_group_num; i++) 
+		{
+		    g_applied_instance[i] = g_ckp_instance[i];
+	        set_checkpoint_instanceID(i, g_ckp_instance[i]);
+		}
+	}
 	
     return DFS_OK;
 }
@@ -1192,67 +1493,77 @@ int load_image()
 static int save_image()
 {
     conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
-    rb_msec_t start_time = dfs_current_msec;
-	uint64_t uid = 0;
+	fi_inode_t     fins[FI_IMAGE_BATCH];
+	int            n = 0;
+	int            rs = DFS_OK;
 	
     char image_name[PATH_LEN] = {0};
+	char tmp_name[PATH_LEN] = {0};
 	string_xxsprintf((uchar_t *)image_name, "%s/current/fsimage", 
 		conf->fsimage_dir.data);
+	string_xxsprintf((uchar_t *)tmp_name, "%s.tmp", image_name);
 	
-	int fd = open(image_name, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	int fd = open(tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0664);
 	if (fd < 0) 
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
-			"open[%s] err", image_name);
+			"open[%s] err", tmp_name);
 		
         return DFS_ERROR;
 	}
 
-	queue_t qhead;
-	queue_init(&qhead);
-
-	pthread_rwlock_rdlock(&g_fcm->cache_rwlock);
-	
-	if (!queue_empty(&g_checkpoint_q)) 
-	{
-        qhead.next = g_checkpoint_q.next;
-        qhead.prev = g_checkpoint_q.prev;
-        
-        qhead.next->prev = &qhead;
-        qhead.prev->next = &qhead;
-	}
-	
-	pthread_rwlock_unlock(&g_fcm->cache_rwlock);
+	// block editlog apply so the image and the instance ids match
+	pthread_rwlock_wrlock(&g_fcm->apply_rwlock);
 	
-	queue_t *head = &qhead;
+	queue_t *head = &g_checkpoint_q;
 	queue_t *entry = queue_next(head);
 	
 	while (head != entry) 
 	{
 	    fi_store_t *fis = queue_data(entry, fi_store_t, ckp);
-		fi_inode_t fii = fis->fin;
+		fins[n++] = fis->fin;
 
-		if (fii.modification_time > start_time) 
-		{
-			break;
-		}
-
-	    if (write(fd, &fii, sizeof(fi_inode_t)) < 0) 
+		entry = queue_next(entry);
+		
+		if (n == FI_IMAGE_BATCH || head == entry) 
 		{
-		    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
-				"write[%s] err", image_name);
+		    ssize_t len = sizeof(fi_inode_t) * n;
 			
-            return DFS_ERROR;
+	        if (write(fd, fins, len) != len) 
+		    {
+		        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+				    "write[%s] err", tmp_name);
+			
+                rs = DFS_ERROR;
+				
+			    break;
+		    }
+
+			n = 0;
 		}
+	}
 
-		uid = fii.uid;
+	memcpy(g_ckp_instance, g_applied_instance, 
+		sizeof(uint64_t) * g_group_num);
 
-		entry = queue_next(entry);
-	}
+	pthread_rwlock_unlock(&g_fcm->apply_rwlock);
 
 	close(fd);
 
-	lastCheckpointInstanceID = uid;
+	if (rs != DFS_OK) 
+	{
+	    unlink(tmp_name);
+		
+        return rs;
+	}
+
+	if (rename(tmp_name, image_name) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			"rename %s to %s err", tmp_name, image_name);
+		
+	    return DFS_ERROR;
+	}
 	
     return DFS_OK;
 }
@@ -1260,29 +1571,44 @@ static int save_image()
 static int save_checkpoinID()
 {
     conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+	ssize_t        len = sizeof(uint64_t) * g_group_num;
 	
     char ckp_name[PATH_LEN] = {0};
+	char tmp_name[PATH_LEN] = {0};
 	string_xxsprintf((uchar_t *)ckp_name, "%s/current/ckpid", 
 		conf->fsimage_dir.data);
+	string_xxsprintf((uchar_t *)tmp_name, "%s.tmp", ckp_name);
 	
-	int fd = open(ckp_name, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	int fd = open(tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0664);
 	if (fd < 0) 
 	{
 	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
-			"open[%s] err", ckp_name);
+			"open[%s] err", tmp_name);
 		
         return DFS_ERROR;
 	}
 
-	if (write(fd, &lastCheckpointInstanceID, sizeof(uint64_t)) < 0) 
+	// one checkpoint instance id per paxos group
+	if (write(fd, g_ckp_instance, len) != len) 
     {
 		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
-			"write[%s] err", ckp_name);
+			"write[%s] err", tmp_name);
+
+		close(fd);
+		unlink(tmp_name);
 
 		return DFS_ERROR;
 	}
 
 	close(fd);
+
+	if (rename(tmp_name, ckp_name) != DFS_OK) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
+			"rename %s to %s err", tmp_name, ckp_name);
+		
+	    return DFS_ERROR;
+	}
 	
     return DFS_OK;
 }
@@ -1290,6 +1616,7 @@ static int save_checkpoinID()
 static int read_checkpoinID()
 {
     conf_server_t *conf = (conf_server_t *)dfs_cycle->sconf;
+	ssize_t        len = sizeof(uint64_t) * g_group_num;
 	
     char ckp_name[PATH_LEN] = {0};
 	string_xxsprintf((uchar_t *)ckp_name, "%s/current/ckpid", 
@@ -1304,7 +1631,8 @@ static int read_checkpoinID()
         return DFS_ERROR;
 	}
 
-	if (read(fd, &lastCheckpointInstanceID, sizeof(uint64_t)) < 0) 
+	ssize_t rs = read(fd, g_ckp_instance, len);
+	if (rs < 0) 
     {
 		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno, 
 			"read %s err", ckp_name);
@@ -1315,6 +1643,26 @@ static int read_checkpoinID()
 	}
 
 	close(fd);
+
+	if (rs == sizeof(uint64_t)) 
+	{
+	    // single id written by older versions, shared by all groups
+	    for (int i = 1; i < g_group_num; i++) 
+		{
+		    g_ckp_instance[i] = g_ckp_instance[0];
+		}
+	}
+	else if (rs != len) 
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0, 
+			"%s has %d ids, but paxos_group_num is %d", ckp_name, 
+			(int)(rs / sizeof(uint64_t)), g_group_num);
+
+		for (int i = rs / sizeof(uint64_t); i < g_group_num; i++) 
+		{
+		    g_ckp_instance[i] = NoCheckpoint;
+		}
+	}
 	
     return DFS_OK;
 }
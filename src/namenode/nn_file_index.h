@@ -91,6 +91,7 @@ typedef struct fi_cache_mgmt_s
 {
     dfs_hashtable_t  *fi_htable;
     pthread_rwlock_t  cache_rwlock;
+    pthread_rwlock_t  apply_rwlock;
     fi_cache_mem_t    mem_mgmt;
     dfs_hashtable_t  *fi_timer_htable;
     pthread_rwlock_t  timer_rwlock;
@@ -110,7 +111,7 @@ int nn_close(task_t *task);
 int nn_rm(task_t *task);
 int nn_open(task_t *task);
 
-int update_fi_cache_mgmt(const uint64_t llInstanceID, 
+int update_fi_cache_mgmt(const int iGroupIdx, const uint64_t llInstanceID, 
 	const std::string & sPaxosValue, void *data); 
 
 fi_store_t *get_store_obj(uchar_t *key);
@@ -128,6 +129,11 @@ int is_InSafeMode();
 
 int do_checkpoint();
 int load_image();
+int lock_checkpoint_state();
+void unlock_checkpoint_state();
+int get_checkpoint_state(std::string & dir, std::vector<std::string> & files);
+int load_checkpoint_state(const std::string & dir, 
+	const std::vector<std::string> & files);
 
 #endif
 
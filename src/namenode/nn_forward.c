@@ -0,0 +1,503 @@
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "dfs_event.h"
+#include "dfs_event_timer.h"
+#include "dfs_conn_pool.h"
+#include "dfs_task_codec.h"
+#include "nn_forward.h"
+#include "nn_thread.h"
+#include "nn_net_response_handler.h"
+#include "nn_conf.h"
+
+#define FWD_TIME_OUT 30000
+
+static nn_fwd_peer_t *fwd_peer_get(const char *ip);
+static int  fwd_peer_connect(nn_fwd_peer_t *peer);
+static int  fwd_peer_flush(nn_fwd_peer_t *peer);
+static void fwd_peer_reply(nn_fwd_peer_t *peer, task_t *rsp);
+static void fwd_peer_close(nn_fwd_peer_t *peer, const char *err);
+static void fwd_redirect(task_t *task);
+static void fwd_read_handler(event_t *ev);
+static void fwd_write_handler(event_t *ev);
+
+// paxos thread, the request is handed back to its io thread to be relayed.
+// data is what the handler took off the task, it is sent along again
+int nn_forward_prepare(task_t *task, const char *ip,
+	                          const void *data, int data_len)
+{
+    nn_wb_t *wbt = NULL;
+	void    *copy = NULL;
+
+	if (!ip || !*ip)
+	{
+        return DFS_ERROR;
+	}
+
+	if (data && data_len > 0)
+	{
+        copy = malloc(data_len);
+		if (!copy)
+		{
+            return DFS_ERROR;
+		}
+
+		memcpy(copy, data, data_len);
+	}
+
+	wbt = (nn_wb_t *)task->opq;
+	snprintf(wbt->fwd_ip, sizeof(wbt->fwd_ip), "%s", ip);
+	wbt->fwd_master = task->master_nodeid;
+
+	task->data = copy;
+	task->data_len = copy ? data_len : 0;
+
+	return DFS_OK;
+}
+
+// io thread, DFS_OK once the request is on its way to the master.
+// otherwise the task is left to be answered with MASTER_REDIRECT
+int nn_forward_task(nn_conn_t *mc, task_t *task)
+{
+    int                rc = 0;
+	nn_wb_t           *wbt = NULL;
+	nn_fwd_peer_t     *peer = NULL;
+	task_queue_node_t *node = NULL;
+
+	wbt = (nn_wb_t *)task->opq;
+	node = queue_data(task, task_queue_node_t, tk);
+
+	peer = fwd_peer_get(wbt->fwd_ip);
+	wbt->fwd_ip[0] = '\0';
+
+	if (!peer || fwd_peer_connect(peer) != DFS_OK)
+	{
+        goto redirect;
+	}
+
+	// seq only matches the reply, the master's retry cache goes by call_id
+	wbt->fwd_seq = task->seq;
+	task->call_id = task->seq;
+	task->seq = peer->seq++;
+	task->master_nodeid = NN_FORWARDED;
+
+	rc = task_encode(task, peer->out);
+
+	task->call_id = 0;
+	task->master_nodeid = wbt->fwd_master;
+
+	if (rc != DFS_OK)
+	{
+	    dfs_log_error(mc->log, DFS_LOG_WARN, 0,
+			"forward to %s:%d full, cmd %d redirected",
+			peer->ip, peer->port, task->cmd);
+
+	    task->seq = wbt->fwd_seq;
+
+        goto redirect;
+	}
+
+	if (task->data)
+	{
+        free(task->data);
+		task->data = NULL;
+		task->data_len = 0;
+	}
+
+	queue_insert_tail(&peer->pending, &node->qe);
+
+	if (!peer->c->read->timer_set)
+	{
+        event_timer_add(peer->c->ev_timer, peer->c->read, FWD_TIME_OUT);
+	}
+
+	if (fwd_peer_flush(peer) != DFS_OK)
+	{
+        fwd_peer_close(peer, "send error");
+	}
+
+	return DFS_OK;
+
+redirect:
+	if (task->data)
+	{
+        free(task->data);
+		task->data = NULL;
+		task->data_len = 0;
+	}
+
+	return DFS_ERROR;
+}
+
+static nn_fwd_peer_t *fwd_peer_get(const char *ip)
+{
+    queue_t       *qe = NULL;
+	dfs_thread_t  *thread = NULL;
+	nn_fwd_peer_t *peer = NULL;
+	conf_server_t *sconf = NULL;
+	server_bind_t *bind = NULL;
+
+	thread = get_local_thread();
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+
+	for (qe = queue_head(&thread->fwd_peers);
+		qe != queue_sentinel(&thread->fwd_peers); qe = queue_next(qe))
+	{
+	    peer = queue_data(qe, nn_fwd_peer_t, me);
+		if (!strcmp(peer->ip, ip))
+		{
+            return peer;
+		}
+	}
+
+	peer = (nn_fwd_peer_t *)calloc(1, sizeof(nn_fwd_peer_t));
+	if (!peer)
+	{
+        return NULL;
+	}
+
+	// the namenodes of a group serve clients on the same port
+	bind = (server_bind_t *)sconf->bind_for_cli.elts;
+
+	snprintf(peer->ip, sizeof(peer->ip), "%s", ip);
+	peer->port = bind[0].port;
+	peer->addr.sin_family = AF_INET;
+	peer->addr.sin_port = htons(peer->port);
+
+	if (inet_pton(AF_INET, peer->ip, &peer->addr.sin_addr) != 1)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, 0,
+			"bad master addr %s", peer->ip);
+
+		free(peer);
+
+		return NULL;
+	}
+
+	peer->pool = pool_create(4096, 4096, dfs_cycle->error_log);
+	if (!peer->pool)
+	{
+        free(peer);
+
+		return NULL;
+	}
+
+	peer->in = buffer_create(peer->pool, sconf->recv_buff_len * 2);
+	peer->out = buffer_create(peer->pool, sconf->send_buff_len * 2);
+	if (!peer->in || !peer->out)
+	{
+        pool_destroy(peer->pool);
+		free(peer);
+
+		return NULL;
+	}
+
+	peer->seq = 1;
+	queue_init(&peer->pending);
+	queue_insert_tail(&thread->fwd_peers, &peer->me);
+
+	return peer;
+}
+
+static int fwd_peer_connect(nn_fwd_peer_t *peer)
+{
+    int          rc = 0;
+    conn_t      *c = NULL;
+	conn_peer_t  pc;
+
+	if (peer->c)
+	{
+        return DFS_OK;
+	}
+
+	c = conn_pool_get_connection(thread_get_conn_pool());
+	if (!c)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"forward to %s: get connection failed", peer->ip);
+
+        return DFS_ERROR;
+	}
+
+	conn_set_default(c, DFS_INVALID_FILE);
+	c->log = dfs_cycle->error_log;
+	c->ev_base = thread_get_event_base();
+	c->ev_timer = thread_get_event_timer();
+	c->conn_data = peer;
+	c->read->handler = fwd_read_handler;
+	c->write->handler = fwd_write_handler;
+
+	memset(&pc, 0x00, sizeof(conn_peer_t));
+	pc.connection = c;
+	pc.sockaddr = (struct sockaddr *)&peer->addr;
+	pc.socklen = sizeof(peer->addr);
+
+	peer->c = c;
+	peer->connected = DFS_FALSE;
+
+	rc = conn_connect_peer(&pc, c->ev_base);
+	if (rc == DFS_ERROR)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_ERROR, errno,
+			"forward connect to %s:%d failed", peer->ip, peer->port);
+
+        fwd_peer_close(peer, NULL);
+
+		return DFS_ERROR;
+	}
+
+	conn_tcp_nodelay(c->fd);
+
+	if (rc == DFS_OK)
+	{
+        peer->connected = DFS_TRUE;
+
+		return DFS_OK;
+	}
+
+	event_timer_add(c->ev_timer, c->write, FWD_TIME_OUT);
+
+	return DFS_OK;
+}
+
+static int fwd_peer_flush(nn_fwd_peer_t *peer)
+{
+    ssize_t  n = 0;
+	conn_t  *c = peer->c;
+
+	if (!peer->connected)
+	{
+        return DFS_OK;
+	}
+
+	while (buffer_size(peer->out) > 0)
+	{
+	    n = c->send(c, peer->out->pos, buffer_size(peer->out));
+		if (n > 0)
+		{
+            peer->out->pos += n;
+
+			continue;
+		}
+
+		if (n == DFS_AGAIN)
+		{
+            return DFS_OK;
+		}
+
+		return DFS_ERROR;
+	}
+
+	buffer_reset(peer->out);
+
+	return DFS_OK;
+}
+
+static void fwd_read_handler(event_t *ev)
+{
+    int            rc = 0;
+    ssize_t        n = 0;
+	size_t         blen = 0;
+	conn_t        *c = NULL;
+	nn_fwd_peer_t *peer = NULL;
+	task_t         rsp;
+
+	c = (conn_t *)ev->data;
+	peer = (nn_fwd_peer_t *)c->conn_data;
+
+	if (ev->timedout)
+	{
+        ev->timedout = 0;
+		fwd_peer_close(peer, "master not answering");
+
+		return;
+	}
+
+	while (1)
+	{
+	    buffer_shrink(peer->in);
+
+		blen = buffer_free_size(peer->in);
+		if (!blen)
+		{
+            fwd_peer_close(peer, "reply too large");
+
+			return;
+		}
+
+		n = c->recv(c, peer->in->last, blen);
+		if (n == DFS_AGAIN)
+		{
+            break;
+		}
+
+		if (n <= 0)
+		{
+            fwd_peer_close(peer, n ? "recv error" : "closed by master");
+
+			return;
+		}
+
+		peer->in->last += n;
+
+		while (1)
+		{
+            memset(&rsp, 0x00, sizeof(task_t));
+
+			rc = task_decode(peer->in, &rsp);
+			if (rc != DFS_OK)
+			{
+                break;
+			}
+
+			fwd_peer_reply(peer, &rsp);
+		}
+
+		if (rc == DFS_ERROR)
+		{
+            fwd_peer_close(peer, "proto error");
+
+			return;
+		}
+	}
+
+	if (c->read->timer_set)
+	{
+        event_timer_del(c->ev_timer, c->read);
+	}
+
+	if (!queue_empty(&peer->pending))
+	{
+        event_timer_add(c->ev_timer, c->read, FWD_TIME_OUT);
+	}
+}
+
+static void fwd_write_handler(event_t *ev)
+{
+    conn_t        *c = NULL;
+	nn_fwd_peer_t *peer = NULL;
+
+	c = (conn_t *)ev->data;
+	peer = (nn_fwd_peer_t *)c->conn_data;
+
+	if (ev->timedout)
+	{
+        ev->timedout = 0;
+		fwd_peer_close(peer, "connect timed out");
+
+		return;
+	}
+
+	if (c->write->timer_set)
+	{
+        event_timer_del(c->ev_timer, c->write);
+	}
+
+	peer->connected = DFS_TRUE;
+
+	if (fwd_peer_flush(peer) != DFS_OK)
+	{
+        fwd_peer_close(peer, "send error");
+	}
+}
+
+// the reply's data points into peer->in, the client gets its own copy
+static void fwd_peer_reply(nn_fwd_peer_t *peer, task_t *rsp)
+{
+    queue_t           *qe = NULL;
+	nn_wb_t           *wbt = NULL;
+	task_t            *t = NULL;
+	task_queue_node_t *node = NULL;
+
+	for (qe = queue_head(&peer->pending);
+		qe != queue_sentinel(&peer->pending); qe = queue_next(qe))
+	{
+	    node = queue_data(qe, task_queue_node_t, qe);
+		if (node->tk.seq == rsp->seq)
+		{
+            break;
+		}
+	}
+
+	if (qe == queue_sentinel(&peer->pending))
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+			"unexpected forward reply from %s, seq: %ud", peer->ip, rsp->seq);
+
+        return;
+	}
+
+	queue_remove(qe);
+
+	t = &node->tk;
+	wbt = (nn_wb_t *)t->opq;
+
+	t->seq = wbt->fwd_seq;
+	t->ret = rsp->ret;
+	t->master_nodeid = rsp->master_nodeid == NN_FORWARDED
+		? 0 : rsp->master_nodeid;
+
+	if (rsp->data && rsp->data_len > 0)
+	{
+	    t->data = malloc(rsp->data_len);
+		if (!t->data)
+		{
+            fwd_redirect(t);
+
+			return;
+		}
+
+        memcpy(t->data, rsp->data, rsp->data_len);
+		t->data_len = rsp->data_len;
+	}
+
+	nn_conn_outtask(wbt->mc, t);
+}
+
+// whatever is still waiting on the master goes back as a redirect
+static void fwd_peer_close(nn_fwd_peer_t *peer, const char *err)
+{
+    queue_t           *qe = NULL;
+	task_queue_node_t *node = NULL;
+
+	if (err)
+	{
+	    dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+			"forward to %s:%d %s", peer->ip, peer->port, err);
+	}
+
+	if (peer->c)
+	{
+	    peer->c->conn_data = NULL;
+        conn_release(peer->c);
+		conn_pool_free_connection(thread_get_conn_pool(), peer->c);
+		peer->c = NULL;
+	}
+
+	peer->connected = DFS_FALSE;
+	buffer_reset(peer->in);
+	buffer_reset(peer->out);
+
+	while (!queue_empty(&peer->pending))
+	{
+	    qe = queue_head(&peer->pending);
+		queue_remove(qe);
+		node = queue_data(qe, task_queue_node_t, qe);
+
+		node->tk.seq = ((nn_wb_t *)node->tk.opq)->fwd_seq;
+		fwd_redirect(&node->tk);
+	}
+}
+
+static void fwd_redirect(task_t *task)
+{
+    nn_wb_t *wbt = (nn_wb_t *)task->opq;
+
+	task->ret = MASTER_REDIRECT;
+	task->master_nodeid = wbt->fwd_master;
+	task->data = NULL;
+	task->data_len = 0;
+
+	nn_conn_outtask(wbt->mc, task);
+}
+
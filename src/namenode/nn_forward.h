@@ -0,0 +1,39 @@
+#ifndef NN_FORWARD_H
+#define NN_FORWARD_H
+
+#include <netinet/in.h>
+
+#include "dfs_types.h"
+#include "dfs_conn.h"
+#include "dfs_buffer.h"
+#include "dfs_queue.h"
+#include "dfs_task.h"
+#include "nn_request.h"
+
+// master_nodeid of a request a namenode forwarded, its receiver redirects
+// rather than forwarding it again
+#define NN_FORWARDED   -1
+
+// one persistent connection from an io thread to a group master, the
+// requests relayed on it are pipelined and matched by seq
+typedef struct nn_fwd_peer_s
+{
+    queue_t             me;        // on the io thread's fwd_peers
+    char                ip[32];
+    int                 port;
+    conn_t             *c;
+    struct sockaddr_in  addr;
+    pool_t             *pool;
+    buffer_t           *in;
+    buffer_t           *out;
+    queue_t             pending;   // sent, waiting for the master
+    uint32_t            seq;
+    int                 connected;
+} nn_fwd_peer_t;
+
+int nn_forward_prepare(task_t *task, const char *ip,
+	const void *data, int data_len);
+int nn_forward_task(nn_conn_t *mc, task_t *task);
+
+#endif
+
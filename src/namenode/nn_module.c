@@ -5,6 +5,8 @@
 #include "nn_file_index.h"
 #include "nn_dn_index.h"
 #include "nn_blk_index.h"
+#include "nn_replication.h"
+#include "nn_balancer.h"
 
 static int dfs_mod_max = 0;
 
@@ -89,6 +91,32 @@ dfs_module_t dfs_modules[] =
         NULL
     },
 
+	{
+        string_make("replication"),
+        0,
+        PROCESS_MOD_INIT,
+        NULL,
+        NULL,
+        NULL,
+        nn_replication_worker_init,
+        nn_replication_worker_release,
+        NULL,
+        NULL
+    },
+
+	{
+        string_make("balancer"),
+        0,
+        PROCESS_MOD_INIT,
+        NULL,
+        NULL,
+        NULL,
+        nn_balancer_worker_init,
+        nn_balancer_worker_release,
+        NULL,
+        NULL
+    },
+
     {string_null, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
 };
 
@@ -114,6 +114,11 @@ int trans_task(task_t *task, dfs_thread_t *thread)
     task_queue_node_t *node = NULL;
 
     node  = task_data(task, task_queue_node_t, tk);
+
+    if (THREAD_TASK == thread->type) 
+	{
+        __sync_fetch_and_add(&thread->tq_depth, 1);
+    }
      
     push_task(&thread->tq, node);
     
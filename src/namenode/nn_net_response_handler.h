@@ -10,6 +10,9 @@ struct nn_wb_s
 {
     nn_conn_t    *mc;
     dfs_thread_t *thread;
+    char          fwd_ip[32];  // set by the paxos thread, relay to master
+    uint32_t      fwd_seq;     // the client's seq while forwarded
+    int           fwd_master;
 };
 
 typedef struct nn_wb_s nn_wb_t;
@@ -3,6 +3,7 @@
 #include "dfs_task.h"
 #include "FSEditlog.h"
 #include "phxeditlog.pb.h"
+#include "EditlogCodec.h"
 #include "fs_permission.h"
 #include "nn_conf.h"
 #include "nn_task_queue.h"
@@ -10,18 +11,32 @@
 #include "nn_net_response_handler.h"
 #include "nn_blk_index.h"
 #include "nn_dn_index.h"
+#include "nn_forward.h"
+#include "nn_retry_cache.h"
 
 using namespace phxpaxos;
 using namespace phxeditlog;
 using namespace std;
 
-static FSEditlog *g_editlog = NULL;
-static uint32_t   g_edit_op_num = 0;
+static FSEditlog     *g_editlog = NULL;
+static uint32_t       g_edit_op_num = 0;
+static retry_cache_t  g_retry_cache;
+static _xvolatile rb_msec_t g_leader_since = 0;
+
+// reused for every proposal instead of a LogOperator per call
+static thread_local LogMkdir            g_log_mkr;
+static thread_local LogRmr              g_log_rmr;
+static thread_local LogCreate           g_log_cre;
+static thread_local LogGetAdditionalBlk g_log_gab;
+static thread_local LogClose            g_log_cle;
+static thread_local LogRm               g_log_rm;
 
 extern uint64_t g_fs_object_num;
 extern _xvolatile rb_msec_t dfs_current_msec;
 
 static int do_paxos_task(task_t *task);
+static int master_redirect(task_t *task, const void *data, int data_len);
+static int paxos_reply(task_queue_node_t *node);
 static int log_mkdir(task_t *task);
 static int log_rmr(task_t *task);
 static int inc_edit_op_num();
@@ -109,7 +124,8 @@ int nn_paxos_worker_init(cycle_t *cycle)
     
     int iGroupCount = (int)sconf->paxos_group_num;
 
-    g_editlog = new FSEditlog(oMyNode, vecNodeList, editlogDir, iGroupCount);
+    g_editlog = new FSEditlog(oMyNode, vecNodeList, editlogDir, iGroupCount, 
+		sconf->paxos_hold_log_num);
     if (NULL == g_editlog)
     {
         dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
@@ -118,6 +134,15 @@ int nn_paxos_worker_init(cycle_t *cycle)
         return DFS_ERROR;
     }
 
+    if (retry_cache_init(&g_retry_cache, sconf->retry_cache_size,
+		(rb_msec_t)sconf->retry_cache_expiry * 1000) != DFS_OK)
+    {
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_FATAL, 0, 
+            "retry_cache_init err");
+     
+        return DFS_ERROR;
+    }
+
     return DFS_OK;
 }
 
@@ -129,17 +154,54 @@ int nn_paxos_worker_release(cycle_t *cycle)
 		g_editlog = NULL;
     }
 
+    retry_cache_release(&g_retry_cache);
+
     return DFS_OK;
 }
 
+// cluster wide work, re-replication and the like, is scheduled by one 
+// namenode, the master of the root's group
+int nn_paxos_is_leader()
+{
+    return g_editlog && g_editlog->IsIMMaster("/") ? DFS_TRUE : DFS_FALSE;
+}
+
+// called from the task threads, notes since when this namenode leads
+void nn_paxos_leader_run(rb_msec_t now)
+{
+    if (!nn_paxos_is_leader()) 
+	{
+        g_leader_since = 0;
+
+		return;
+	}
+
+	if (!g_leader_since) 
+	{
+        g_leader_since = now;
+	}
+}
+
+// the leader once it has caught up. the edit log was replayed before 
+// paxos ran, the edits chosen elsewhere are learned within 
+// NN_LEADER_SETTLE
+int nn_paxos_leader_ready()
+{
+    rb_msec_t since = g_leader_since;
+
+	return since && dfs_current_msec - since >= NN_LEADER_SETTLE 
+		&& nn_paxos_is_leader() ? DFS_TRUE : DFS_FALSE;
+}
+
 int nn_paxos_run()
 {
     return g_editlog->RunPaxos();
 }
 
-void set_checkpoint_instanceID(const uint64_t llInstanceID)
+void set_checkpoint_instanceID(const int iGroupIdx, 
+	const uint64_t llInstanceID)
 {
-    g_editlog->setCheckpointInstanceID(llInstanceID);
+    g_editlog->setCheckpointInstanceID(iGroupIdx, llInstanceID);
 }
 
 void do_paxos_task_handler(void *q)
@@ -175,6 +237,12 @@ void do_paxos_task_handler(void *q)
 static int do_paxos_task(task_t *task)
 {
     int optype = task->cmd;
+
+	// a retried call is answered the way it was the first time
+	if (retry_cache_get(&g_retry_cache, task) == DFS_OK) 
+	{
+        return write_back(queue_data(task, task_queue_node_t, tk));
+	}
 	
 	switch (optype)
     {
@@ -258,6 +326,39 @@ int check_ancestor_access(uchar_t *path, task_t *task,
     return DFS_OK;
 }
 
+// every answer a handler gives after running the call is remembered for
+// the call's retries, redirects are not
+static int paxos_reply(task_queue_node_t *node)
+{
+    retry_cache_put(&g_retry_cache, &node->tk);
+
+	return write_back(node);
+}
+
+// with server.forward_writes the io thread relays the request to the
+// master instead, data is what the handler already took off the task.
+// a request that was forwarded to us is never forwarded again
+static int master_redirect(task_t *task, const void *data, int data_len)
+{
+    int                forwarded = 0;
+	conf_server_t     *sconf = (conf_server_t *)dfs_cycle->sconf;
+    task_queue_node_t *node = queue_data(task, task_queue_node_t, tk);
+
+	NodeInfo master = g_editlog->GetMaster(task->key);
+
+	forwarded = task->master_nodeid == NN_FORWARDED;
+
+    task->ret = MASTER_REDIRECT;
+	task->master_nodeid = master.GetNodeID();
+
+	if (sconf->forward_writes && !forwarded && master.GetNodeID() != 0) 
+	{
+        nn_forward_prepare(task, master.GetIP().c_str(), data, data_len);
+	}
+
+	return write_back(node);
+}
+
 static int log_mkdir(task_t *task)
 {
     int            expect_mkdir_num = 0;
@@ -269,10 +370,7 @@ static int log_mkdir(task_t *task)
 
 	if (!g_editlog->IsIMMaster(task->key)) 
 	{
-        task->ret = MASTER_REDIRECT;
-		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
-
-		return write_back(node);
+		return master_redirect(task, NULL, 0);
 	}
 
 	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
@@ -280,7 +378,7 @@ static int log_mkdir(task_t *task)
 	{
 		task->ret = KEY_EXIST;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 	uchar_t path[PATH_LEN] = "";
@@ -306,7 +404,7 @@ static int log_mkdir(task_t *task)
 
 		task->ret = NOT_DIRECTORY;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 	
     if (!is_super(task->user, &dfs_cycle->admin))
@@ -319,14 +417,14 @@ static int log_mkdir(task_t *task)
 
 			task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 		}
 		
         if (check_traverse(path, task, finodes, names_sz) != DFS_OK) 
 	    {
             task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 	    }
 
 		if (check_ancestor_access(path, task, WRITE, finodes[parent_index]) 
@@ -334,7 +432,7 @@ static int log_mkdir(task_t *task)
 	    {
             task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 	    }
     }
 
@@ -348,19 +446,18 @@ static int log_mkdir(task_t *task)
 		
         task->ret = FSOBJECT_EXCEED;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 do_paxos:
 	string sPaxosValue;
 	PhxEditlogSMCtx oEditlogSMCtx;
 	string sKey;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_mkr()->set_permission(task->permission);
-	lopr.mutable_mkr()->set_owner(task->user);
-	lopr.mutable_mkr()->set_group(task->group);
-	lopr.mutable_mkr()->set_modification_time(dfs_current_msec);
+	g_log_mkr.Clear();
+	g_log_mkr.set_permission(task->permission);
+	g_log_mkr.set_owner(task->user);
+	g_log_mkr.set_group(task->group);
+	g_log_mkr.set_modification_time(dfs_current_msec);
 
 	for (int i = 0; i < names_sz; i++) 
 	{
@@ -387,8 +484,9 @@ do_paxos:
 			sKey = string((const char *)keys[i]);
 		}
 
-		lopr.mutable_mkr()->set_key(sKey);
-	    lopr.SerializeToString(&sPaxosValue);
+		g_log_mkr.set_key(sKey);
+	    EditlogCodec::Encode(task->cmd, LogOperator::kMkrFieldNumber, 
+			g_log_mkr, sPaxosValue);
 
 	    g_editlog->Propose(sKey, sPaxosValue, oEditlogSMCtx);
 	}
@@ -397,7 +495,7 @@ do_paxos:
 
 	inc_edit_op_num();
 	
-	return write_back(node);
+	return paxos_reply(node);
 }
 
 static int log_rmr(task_t *task)
@@ -406,10 +504,7 @@ static int log_rmr(task_t *task)
 
 	if (!g_editlog->IsIMMaster(task->key)) 
 	{
-        task->ret = MASTER_REDIRECT;
-		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
-
-		return write_back(node);
+		return master_redirect(task, NULL, 0);
 	}
 
 	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
@@ -417,13 +512,13 @@ static int log_rmr(task_t *task)
 	{
 		task->ret = KEY_NOTEXIST;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 	else if (!fi->fin.is_directory)
 	{
         task->ret = NOT_DIRECTORY;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 	uchar_t path[PATH_LEN] = "";
@@ -437,17 +532,17 @@ static int log_rmr(task_t *task)
 	    {
             task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 	    }
     }
 	
     string sPaxosValue;
 	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_rmr()->set_key((const char *)task->key);
-	lopr.mutable_rmr()->set_modification_time(dfs_current_msec);
-	lopr.SerializeToString(&sPaxosValue);
+	g_log_rmr.Clear();
+	g_log_rmr.set_key((const char *)task->key);
+	g_log_rmr.set_modification_time(dfs_current_msec);
+	EditlogCodec::Encode(task->cmd, LogOperator::kRmrFieldNumber, g_log_rmr, 
+		sPaxosValue);
 
 	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
 
@@ -455,7 +550,7 @@ static int log_rmr(task_t *task)
 
 	inc_edit_op_num();
 	
-	return write_back(node);
+	return paxos_reply(node);
 }
 
 static int inc_edit_op_num()
@@ -509,10 +604,7 @@ static int log_create(task_t *task)
 
 	if (!g_editlog->IsIMMaster(task->key)) 
 	{
-        task->ret = MASTER_REDIRECT;
-		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
-
-		return write_back(node);
+		return master_redirect(task, &blk_info, sizeof(create_blk_info_t));
 	}
 
 	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
@@ -527,7 +619,7 @@ static int log_create(task_t *task)
             task->ret = KEY_STATE_CREATING;
 		}
 		
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 	uchar_t path[PATH_LEN] = "";
@@ -549,7 +641,7 @@ static int log_create(task_t *task)
 
 		task->ret = NOT_DIRECTORY;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 	
     if (!is_super(task->user, &dfs_cycle->admin))
@@ -562,14 +654,14 @@ static int log_create(task_t *task)
 
 			task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 		}
 		
         if (check_traverse(path, task, finodes, names_sz) != DFS_OK) 
 	    {
             task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 	    }
 
 		if (check_ancestor_access(path, task, WRITE, finodes[parent_index]) 
@@ -577,7 +669,7 @@ static int log_create(task_t *task)
 	    {
             task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 	    }
     }
 
@@ -589,32 +681,33 @@ static int log_create(task_t *task)
 		
         task->ret = FSOBJECT_EXCEED;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
-	if (generate_dns(blk_info.blk_rep, &resp_info) != DFS_OK)
+	if (generate_dns(blk_info.blk_rep, blk_info.blk_sz, &resp_info) 
+		!= DFS_OK)
 	{
         task->ret = NOT_DATANODE;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 	resp_info.blk_id = generate_uid();
 	resp_info.namespace_id = dfs_cycle->namespace_id;
 	
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_cre()->set_key((const char *)task->key);
-	lopr.mutable_cre()->set_permission(task->permission);
-	lopr.mutable_cre()->set_owner(task->user);
-	lopr.mutable_cre()->set_group(task->group);
-	lopr.mutable_cre()->set_modification_time(dfs_current_msec);
-	lopr.mutable_cre()->set_blk_id(resp_info.blk_id);
-	lopr.mutable_cre()->set_blk_sz(blk_info.blk_sz);
-	lopr.mutable_cre()->set_blk_rep(blk_info.blk_rep);
+	g_log_cre.Clear();
+	g_log_cre.set_key((const char *)task->key);
+	g_log_cre.set_permission(task->permission);
+	g_log_cre.set_owner(task->user);
+	g_log_cre.set_group(task->group);
+	g_log_cre.set_modification_time(dfs_current_msec);
+	g_log_cre.set_blk_id(resp_info.blk_id);
+	g_log_cre.set_blk_sz(blk_info.blk_sz);
+	g_log_cre.set_blk_rep(blk_info.blk_rep);
 
 	string sPaxosValue;
-	lopr.SerializeToString(&sPaxosValue);
+	EditlogCodec::Encode(task->cmd, LogOperator::kCreFieldNumber, g_log_cre, 
+		sPaxosValue);
 
     PhxEditlogSMCtx oEditlogSMCtx;
 	oEditlogSMCtx.data = get_local_thread();
@@ -635,7 +728,7 @@ static int log_create(task_t *task)
 
 	inc_edit_op_num();
 	
-	return write_back(node);
+	return paxos_reply(node);
 }
 
 static int log_get_additional_blk(task_t *task)
@@ -654,10 +747,7 @@ static int log_get_additional_blk(task_t *task)
 
 	if (!g_editlog->IsIMMaster(task->key)) 
 	{
-        task->ret = MASTER_REDIRECT;
-		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
-
-		return write_back(node);
+		return master_redirect(task, &blk_info, sizeof(create_blk_info_t));
 	}
 
 	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
@@ -665,14 +755,15 @@ static int log_get_additional_blk(task_t *task)
 	{
         task->ret = FAIL;
 		
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
-    if (generate_dns(blk_info.blk_rep, &resp_info) != DFS_OK)
+    if (generate_dns(blk_info.blk_rep, blk_info.blk_sz, &resp_info) 
+		!= DFS_OK)
 	{
         task->ret = NOT_DATANODE;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 	resp_info.blk_id = generate_uid();
@@ -680,14 +771,14 @@ static int log_get_additional_blk(task_t *task)
 
 	string sPaxosValue;
 	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_gab()->set_key((const char *)task->key);
-	lopr.mutable_gab()->set_blk_id(resp_info.blk_id);
-	lopr.mutable_gab()->set_blk_sz(blk_info.blk_sz);
-	lopr.mutable_gab()->set_blk_rep(blk_info.blk_rep);
+	g_log_gab.Clear();
+	g_log_gab.set_key((const char *)task->key);
+	g_log_gab.set_blk_id(resp_info.blk_id);
+	g_log_gab.set_blk_sz(blk_info.blk_sz);
+	g_log_gab.set_blk_rep(blk_info.blk_rep);
     
-	lopr.SerializeToString(&sPaxosValue);
+	EditlogCodec::Encode(task->cmd, LogOperator::kGabFieldNumber, g_log_gab, 
+		sPaxosValue);
 
 	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
 
@@ -705,7 +796,7 @@ static int log_get_additional_blk(task_t *task)
 
 	inc_edit_op_num();
 	
-	return write_back(node);
+	return paxos_reply(node);
 }
 
 static int log_close(task_t *task)
@@ -722,7 +813,7 @@ static int log_close(task_t *task)
     //    task->ret = MASTER_REDIRECT;
 	//	task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
     //
-	//	return write_back(node);
+	//	return paxos_reply(node);
 	//}
 
 	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
@@ -730,19 +821,19 @@ static int log_close(task_t *task)
 	{
         task->ret = FAIL;
 		
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 	string sPaxosValue;
 	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_cle()->set_key((const char *)task->key);
-	lopr.mutable_cle()->set_modification_time(dfs_current_msec);
-	lopr.mutable_cle()->set_len(len);
-	lopr.mutable_cle()->set_blk_rep(task->ret);
+	g_log_cle.Clear();
+	g_log_cle.set_key((const char *)task->key);
+	g_log_cle.set_modification_time(dfs_current_msec);
+	g_log_cle.set_len(len);
+	g_log_cle.set_blk_rep(task->ret);
     
-	lopr.SerializeToString(&sPaxosValue);
+	EditlogCodec::Encode(task->cmd, LogOperator::kCleFieldNumber, g_log_cle, 
+		sPaxosValue);
 
 	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
 
@@ -750,7 +841,7 @@ static int log_close(task_t *task)
 
 	inc_edit_op_num();
 	
-	return write_back(node);
+	return paxos_reply(node);
 }
 
 static int log_rm(task_t *task)
@@ -759,10 +850,7 @@ static int log_rm(task_t *task)
 
 	if (!g_editlog->IsIMMaster(task->key)) 
 	{
-        task->ret = MASTER_REDIRECT;
-		task->master_nodeid = g_editlog->GetMaster(task->key).GetNodeID();
-
-		return write_back(node);
+		return master_redirect(task, NULL, 0);
 	}
 
 	fi_store_t *fi = get_store_obj((uchar_t *)task->key);
@@ -770,13 +858,13 @@ static int log_rm(task_t *task)
 	{
 		task->ret = KEY_NOTEXIST;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 	else if (fi->fin.is_directory)
 	{
         task->ret = NOT_FILE;
 
-		return write_back(node);
+		return paxos_reply(node);
 	}
 
 	uchar_t path[PATH_LEN] = "";
@@ -790,17 +878,17 @@ static int log_rm(task_t *task)
 	    {
             task->ret = PERMISSION_DENY;
 
-			return write_back(node);
+			return paxos_reply(node);
 	    }
     }
 	
     string sPaxosValue;
 	PhxEditlogSMCtx oEditlogSMCtx;
-	LogOperator lopr;
-	lopr.set_optype(task->cmd);
-	lopr.mutable_rm()->set_key((const char *)task->key);
-	lopr.mutable_rm()->set_modification_time(dfs_current_msec);
-	lopr.SerializeToString(&sPaxosValue);
+	g_log_rm.Clear();
+	g_log_rm.set_key((const char *)task->key);
+	g_log_rm.set_modification_time(dfs_current_msec);
+	EditlogCodec::Encode(task->cmd, LogOperator::kRmFieldNumber, g_log_rm, 
+		sPaxosValue);
 
 	g_editlog->Propose((const char *)task->key, sPaxosValue, oEditlogSMCtx);
 
@@ -808,6 +896,6 @@ static int log_rm(task_t *task)
 
 	inc_edit_op_num();
 	
-	return write_back(node);
+	return paxos_reply(node);
 }
 
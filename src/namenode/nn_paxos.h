@@ -4,10 +4,18 @@
 #include "nn_cycle.h"
 #include "nn_file_index.h"
 
+// a new leader acts on blocks it does not know of only after this long, 
+// by then it has learned what was chosen before it was elected
+#define NN_LEADER_SETTLE 30000 // MSec
+
 int nn_paxos_worker_init(cycle_t *cycle);
 int nn_paxos_worker_release(cycle_t *cycle);
 int nn_paxos_run();
-void set_checkpoint_instanceID(const uint64_t llInstanceID);
+int nn_paxos_is_leader();
+void nn_paxos_leader_run(rb_msec_t now);
+int nn_paxos_leader_ready();
+void set_checkpoint_instanceID(const int iGroupIdx, 
+	const uint64_t llInstanceID);
 void do_paxos_task_handler(void *q);
 int check_traverse(uchar_t *path, task_t *task, 
 	fi_inode_t *finodes[], int num);
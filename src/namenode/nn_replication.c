@@ -0,0 +1,499 @@
+#include <stdlib.h>
+
+#include "nn_replication.h"
+#include "nn_blk_index.h"
+#include "nn_dn_index.h"
+#include "nn_paxos.h"
+#include "nn_conf.h"
+#include "dfs_memory.h"
+#include "dfs_error_log.h"
+
+#define REPL_MAX_REPLICAS 16
+
+static repl_monitor_t *g_repl = NULL;
+
+static int repl_key_cmp(const void *arg1, const void *arg2, size_t size);
+static repl_blk_t *repl_blk_new(long id);
+static int repl_prio(int held, int live);
+static void repl_enqueue(repl_blk_t *rb, int prio);
+static void repl_dequeue(repl_blk_t *rb);
+static void repl_blk_del(repl_blk_t *rb);
+static void repl_expire(rb_msec_t now);
+static int repl_schedule(repl_blk_t *rb, rb_msec_t now,
+	conf_server_t *sconf);
+static void repl_blk_free(void *data);
+
+int nn_replication_worker_init(cycle_t *cycle)
+{
+    int             i = 0;
+    repl_monitor_t *rm = NULL;
+	conf_server_t  *sconf = (conf_server_t *)cycle->sconf;
+
+	rm = (repl_monitor_t *)memory_calloc(sizeof(repl_monitor_t));
+	if (!rm)
+	{
+        return DFS_ERROR;
+	}
+
+	rm->blks = dfs_hashtable_create(repl_key_cmp, REPL_HASH_SIZE,
+		dfs_hashtable_hash_key8, NULL);
+	rm->out = (uint16_t *)memory_calloc((DN_INDEX_MAX + 1)
+		* sizeof(uint16_t));
+	rm->in = (uint16_t *)memory_calloc((DN_INDEX_MAX + 1)
+		* sizeof(uint16_t));
+	if (!rm->blks || !rm->out || !rm->in)
+	{
+        return DFS_ERROR;
+	}
+
+	for (i = 0; i < REPL_PRIO_NUM; i++)
+	{
+        queue_init(&rm->queues[i]);
+	}
+
+	queue_init(&rm->pending);
+	pthread_mutex_init(&rm->lock, NULL);
+
+	// out and in count up to it
+	if (sconf->replication_streams > 0xffff)
+	{
+        sconf->replication_streams = 0xffff;
+	}
+
+	g_repl = rm;
+
+    return DFS_OK;
+}
+
+int nn_replication_worker_release(cycle_t *cycle)
+{
+    repl_monitor_t *rm = g_repl;
+
+	if (!rm)
+	{
+        return DFS_OK;
+	}
+
+	g_repl = NULL;
+
+	dfs_hashtable_free_items(rm->blks, repl_blk_free, NULL);
+	dfs_hashtable_free_memory(rm->blks);
+	memory_free(rm->out, (DN_INDEX_MAX + 1) * sizeof(uint16_t));
+	memory_free(rm->in, (DN_INDEX_MAX + 1) * sizeof(uint16_t));
+	pthread_mutex_destroy(&rm->lock);
+	memory_free(rm, sizeof(repl_monitor_t));
+
+    return DFS_OK;
+}
+
+// a replica of block id went away, it has held left, live of them in 
+// service, of want
+void repl_check_blk(long id, int held, int live, int want)
+{
+    repl_blk_t *rb = NULL;
+
+	if (!g_repl)
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&g_repl->lock);
+
+	rb = (repl_blk_t *)dfs_hashtable_lookup(g_repl->blks, &id, sizeof(id));
+
+	// the copy under way finishes or times out first
+	if (rb && rb->prio == REPL_PENDING)
+	{
+	    pthread_mutex_unlock(&g_repl->lock);
+
+		return;
+	}
+
+	if (live >= want)
+	{
+	    if (rb)
+		{
+            repl_dequeue(rb);
+			repl_blk_del(rb);
+		}
+
+		pthread_mutex_unlock(&g_repl->lock);
+
+		return;
+	}
+
+	if (!rb)
+	{
+        rb = repl_blk_new(id);
+		if (!rb)
+		{
+		    pthread_mutex_unlock(&g_repl->lock);
+
+			return;
+		}
+	}
+	else
+	{
+        repl_dequeue(rb);
+	}
+
+	repl_enqueue(rb, repl_prio(held, live));
+
+	pthread_mutex_unlock(&g_repl->lock);
+}
+
+// block id is on a leaving datanode and short on the others. its data is 
+// all there still, it waits behind the blocks that lost replicas
+void repl_drain_blk(long id)
+{
+    repl_blk_t *rb = NULL;
+
+	if (!g_repl)
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&g_repl->lock);
+
+	rb = (repl_blk_t *)dfs_hashtable_lookup(g_repl->blks, &id, sizeof(id));
+	if (!rb)
+	{
+	    rb = repl_blk_new(id);
+		if (rb)
+		{
+            repl_enqueue(rb, REPL_UNDER);
+		}
+	}
+	else if (rb->prio == REPL_NO_REPLICA)
+	{
+	    // the leaving datanode still has it
+        repl_dequeue(rb);
+		repl_enqueue(rb, REPL_UNDER);
+	}
+
+	pthread_mutex_unlock(&g_repl->lock);
+}
+
+// datanode dn reported block id, a copy scheduled to it is done
+void repl_replica_added(long id, uint16_t dn, int held, int live, 
+	int want)
+{
+    repl_blk_t *rb = NULL;
+
+	// most reports are of blocks nobody is waiting for
+	if (!g_repl || dfs_hashtable_empty(g_repl->blks))
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&g_repl->lock);
+
+	rb = (repl_blk_t *)dfs_hashtable_lookup(g_repl->blks, &id, sizeof(id));
+	if (!rb || (rb->prio == REPL_PENDING && rb->target != dn))
+	{
+	    pthread_mutex_unlock(&g_repl->lock);
+
+		return;
+	}
+
+	repl_dequeue(rb);
+
+	if (live >= want)
+	{
+        repl_blk_del(rb);
+	}
+	else
+	{
+        repl_enqueue(rb, repl_prio(held, live));
+	}
+
+	pthread_mutex_unlock(&g_repl->lock);
+}
+
+void repl_blk_removed(long id)
+{
+    repl_blk_t *rb = NULL;
+
+	if (!g_repl || dfs_hashtable_empty(g_repl->blks))
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&g_repl->lock);
+
+	rb = (repl_blk_t *)dfs_hashtable_lookup(g_repl->blks, &id, sizeof(id));
+	if (rb)
+	{
+        repl_dequeue(rb);
+		repl_blk_del(rb);
+	}
+
+	pthread_mutex_unlock(&g_repl->lock);
+}
+
+// called from the task threads, one of them runs a pass every
+// replication_interval on the leader namenode
+void repl_monitor_run(rb_msec_t now)
+{
+    int            prio = 0;
+	int            budget = 0;
+	uint32_t       n = 0;
+	repl_blk_t    *rb = NULL;
+	conf_server_t *sconf = NULL;
+
+	sconf = (conf_server_t *)dfs_cycle->sconf;
+
+    if (!g_repl
+		|| now - g_repl->last_run < (rb_msec_t)sconf->replication_interval * 1000
+		|| pthread_mutex_trylock(&g_repl->lock) != 0)
+	{
+        return;
+	}
+
+	if (now - g_repl->last_run < (rb_msec_t)sconf->replication_interval * 1000)
+	{
+	    pthread_mutex_unlock(&g_repl->lock);
+
+        return;
+	}
+
+	g_repl->last_run = now;
+
+	if (dfs_hashtable_empty(g_repl->blks) || !nn_paxos_is_leader())
+	{
+	    pthread_mutex_unlock(&g_repl->lock);
+
+        return;
+	}
+
+	repl_expire(now);
+
+	// about streams copies out of every live datanode a pass
+	budget = sconf->replication_streams * get_dn_num();
+
+	for (prio = REPL_ONE_REPLICA; prio < REPL_PRIO_NUM && budget > 0; prio++)
+	{
+	    // the ones put back go to the tail, visit each once
+	    n = g_repl->queued[prio];
+
+        while (n-- > 0 && budget > 0)
+		{
+		    rb = queue_data(queue_head(&g_repl->queues[prio]), repl_blk_t, me);
+			repl_dequeue(rb);
+
+			if (repl_schedule(rb, now, sconf) == DFS_OK)
+			{
+                budget--;
+			}
+		}
+	}
+
+	if (g_repl->queued[REPL_NO_REPLICA] != g_repl->last_missing)
+	{
+	    g_repl->last_missing = g_repl->queued[REPL_NO_REPLICA];
+
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+			"%ud blocks have no live replica", g_repl->last_missing);
+	}
+
+	dfs_log_debug(dfs_cycle->error_log, DFS_LOG_DEBUG, 0,
+		"replication queued %ud %ud %ud, pending %ud",
+		g_repl->queued[REPL_NO_REPLICA], g_repl->queued[REPL_ONE_REPLICA],
+		g_repl->queued[REPL_UNDER], g_repl->pending_n);
+
+	pthread_mutex_unlock(&g_repl->lock);
+}
+
+// the next repl_monitor_run makes a pass whenever it was last made
+void repl_kick()
+{
+    if (!g_repl) 
+	{
+        return;
+	}
+
+	pthread_mutex_lock(&g_repl->lock);
+	g_repl->last_run = 0;
+	pthread_mutex_unlock(&g_repl->lock);
+}
+
+// hand the block to its least busy holder to copy to a datanode that
+// has none, DFS_OK when a copy was sent off. replicas on leaving 
+// datanodes are copied from but do not count
+static int repl_schedule(repl_blk_t *rb, rb_msec_t now,
+	conf_server_t *sconf)
+{
+    int      i = 0;
+	int      held = 0;
+	int      live = 0;
+	int      want = 0;
+	int      streams = sconf->replication_streams;
+	uint16_t src = 0;
+	uint16_t target = 0;
+	uint64_t size = 0;
+	uint16_t dns[REPL_MAX_REPLICAS];
+
+	held = get_blk_replicas(rb->id, &size, &want, dns, REPL_MAX_REPLICAS);
+
+	for (i = 0; i < held; i++)
+	{
+	    if (dn_in_service(dns[i]))
+		{
+            live++;
+		}
+	}
+
+	if (held < 0 || live >= want)
+	{
+        repl_blk_del(rb);
+
+		return DFS_DECLINED;
+	}
+
+	if (0 == held)
+	{
+        repl_enqueue(rb, REPL_NO_REPLICA);
+
+		return DFS_DECLINED;
+	}
+
+	for (i = 0; i < held; i++)
+	{
+        if (g_repl->out[dns[i]] < streams
+			&& (!src || g_repl->out[dns[i]] < g_repl->out[src]))
+		{
+            src = dns[i];
+		}
+	}
+
+	if (src)
+	{
+        target = choose_copy_target(dns, held, size, g_repl->in, streams);
+	}
+
+	if (!target || notify_dn_2_copy_blk(rb->id, src, target, 0) != DFS_OK)
+	{
+        repl_enqueue(rb, repl_prio(held, live));
+
+		return DFS_BUSY;
+	}
+
+	rb->prio = REPL_PENDING;
+	rb->back = repl_prio(held, live);
+	rb->src = src;
+	rb->target = target;
+	rb->expire = now + (rb_msec_t)sconf->replication_timeout * 1000;
+
+	g_repl->out[src]++;
+	g_repl->in[target]++;
+
+	queue_insert_tail(&g_repl->pending, &rb->me);
+	g_repl->pending_n++;
+
+	return DFS_OK;
+}
+
+// a copy not reported in time is scheduled again, maybe elsewhere
+static void repl_expire(rb_msec_t now)
+{
+    repl_blk_t *rb = NULL;
+
+	while (!queue_empty(&g_repl->pending))
+	{
+	    rb = queue_data(queue_head(&g_repl->pending), repl_blk_t, me);
+		if (rb->expire > now)
+		{
+            break;
+		}
+
+		dfs_log_error(dfs_cycle->error_log, DFS_LOG_WARN, 0,
+			"copy of blk %l from datanode %d to %d timed out",
+			rb->id, rb->src, rb->target);
+
+		repl_dequeue(rb);
+		repl_enqueue(rb, rb->back);
+	}
+}
+
+static repl_blk_t *repl_blk_new(long id)
+{
+    repl_blk_t *rb = (repl_blk_t *)calloc(1, sizeof(repl_blk_t));
+	if (!rb)
+	{
+        dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0,
+			"no memory to queue blk %l for replication", id);
+
+		return NULL;
+	}
+
+	rb->id = id;
+	rb->ln.key = &rb->id;
+	rb->ln.len = sizeof(rb->id);
+	rb->prio = -1;
+
+	dfs_hashtable_join(g_repl->blks, &rb->ln);
+
+	return rb;
+}
+
+// a block all of whose replicas are leaving is still readable, it goes 
+// with the ones down to their last
+static int repl_prio(int held, int live)
+{
+    if (held <= 0)
+	{
+        return REPL_NO_REPLICA;
+	}
+
+	return live <= 1 ? REPL_ONE_REPLICA : REPL_UNDER;
+}
+
+static void repl_enqueue(repl_blk_t *rb, int prio)
+{
+    rb->prio = prio;
+
+    queue_insert_tail(&g_repl->queues[prio], &rb->me);
+	g_repl->queued[prio]++;
+}
+
+// off whatever queue it is on, a copy in flight stops counting
+static void repl_dequeue(repl_blk_t *rb)
+{
+    if (rb->prio < 0)
+	{
+        return;
+	}
+
+	queue_remove(&rb->me);
+
+	if (rb->prio == REPL_PENDING)
+	{
+	    g_repl->out[rb->src]--;
+		g_repl->in[rb->target]--;
+        g_repl->pending_n--;
+	}
+	else
+	{
+        g_repl->queued[rb->prio]--;
+	}
+
+	rb->prio = -1;
+}
+
+static void repl_blk_del(repl_blk_t *rb)
+{
+    dfs_hashtable_remove_link(g_repl->blks, &rb->ln);
+
+	free(rb);
+}
+
+static int repl_key_cmp(const void *arg1, const void *arg2, size_t size)
+{
+    return memcmp(arg1, arg2, sizeof(long)) ? DFS_ERROR : DFS_OK;
+}
+
+static void repl_blk_free(void *data)
+{
+    free(data);
+}
+
@@ -0,0 +1,56 @@
+#ifndef NN_REPLICATION_H
+#define NN_REPLICATION_H
+
+#include "dfs_types.h"
+#include "dfs_queue.h"
+#include "dfs_hashtable.h"
+#include "nn_cycle.h"
+
+#define REPL_HASH_SIZE 65536
+
+// the sooner the next loss would be data loss, the lower the queue
+#define REPL_NO_REPLICA  0   // nothing to copy from until one comes back
+#define REPL_ONE_REPLICA 1
+#define REPL_UNDER       2
+#define REPL_PRIO_NUM    3
+#define REPL_PENDING     REPL_PRIO_NUM
+
+typedef struct repl_blk_s
+{
+    dfs_hashtable_link_t ln;
+    queue_t              me;       // on its priority queue or on pending
+    long                 id;
+	int                  prio;     // REPL_PENDING while being copied
+	int                  back;     // the queue it goes back to if it times out
+	uint16_t             src;
+	uint16_t             target;
+	rb_msec_t            expire;
+} repl_blk_t;
+
+typedef struct repl_monitor_s
+{
+    pthread_mutex_t  lock;
+    dfs_hashtable_t *blks;         // every block queued or being copied
+    queue_t          queues[REPL_PRIO_NUM];
+	uint32_t         queued[REPL_PRIO_NUM];
+	queue_t          pending;      // oldest first
+	uint32_t         pending_n;
+	uint16_t        *out;          // copies each datanode is sending
+	uint16_t        *in;           // and receiving, by datanode index
+	rb_msec_t        last_run;
+	uint32_t         last_missing;
+} repl_monitor_t;
+
+int nn_replication_worker_init(cycle_t *cycle);
+int nn_replication_worker_release(cycle_t *cycle);
+
+void repl_check_blk(long id, int held, int live, int want);
+void repl_replica_added(long id, uint16_t dn, int held, int live, 
+	int want);
+void repl_drain_blk(long id);
+void repl_blk_removed(long id);
+void repl_monitor_run(rb_msec_t now);
+void repl_kick();
+
+#endif
+
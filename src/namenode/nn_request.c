@@ -14,27 +14,36 @@
 #include "nn_worker_process.h"
 #include "nn_net_response_handler.h"
 #include "nn_request.h"
+#include "nn_forward.h"
 #include "nn_conf.h"
 
 #define CONN_TIME_OUT        300000
 #define TASK_TIME_OUT        100
 
-#define NN_TASK_POOL_MAX_SIZE 64
-#define NN_TASK_POOL_MIN_SIZE 8
+#define NN_TASK_SLAB_SIZE    64
+#define NN_OUT_ZC_SIZE       4096
+
+// client requests dispatched to the task threads and not yet answered
+static volatile int32_t nn_inflight = 0;
 
-extern dfs_thread_t  *dn_thread;
-extern dfs_thread_t  *cli_thread;
 task_t                busy_task;
 
 static void nn_event_process_handler(event_t *ev);
 //static void nn_empty_handler(event_t *ev);
 static void nn_conn_read_handler(nn_conn_t *mc);
 static void nn_conn_write_handler(nn_conn_t *mc);
-static int nn_conn_out_buffer(conn_t *c, buffer_t *b);
+static int nn_conn_pack(nn_conn_t *mc);
+static buffer_t *nn_conn_out_link(nn_conn_t *mc, chain_t **tail, 
+	uchar_t *pos, uchar_t *last);
+static void nn_conn_free_sent(nn_conn_t *mc);
 static void nn_conn_free_queue(nn_conn_t *mc);
 static void nn_conn_close(nn_conn_t *mc);
 static int  nn_conn_recv(nn_conn_t *mc);
 static int  nn_conn_decode(nn_conn_t *mc);
+static int  nn_conn_admit(nn_conn_t *mc);
+static void nn_conn_reject(nn_conn_t *mc, task_queue_node_t *node);
+static wb_node_t *nn_task_node_get(dfs_thread_t *thread);
+static void nn_task_node_put(dfs_thread_t *thread, wb_node_t *node);
 
 static void  nn_conn_timer_handler(event_t *ev)
 {
@@ -58,10 +67,7 @@ void nn_conn_init(conn_t *c)
     event_t      *wev = NULL;
     nn_conn_t    *mc = NULL;
     pool_t       *pool = NULL;
-    wb_node_t    *node = NULL;
-    wb_node_t    *buff = NULL;
 	dfs_thread_t *thread = NULL;
-    int32_t       i = 0;
    
     thread = get_local_thread();
 	
@@ -108,38 +114,14 @@ void nn_conn_init(conn_t *c)
     c->ev_timer = &thread->event_timer;
 	mc->max_task = ((conf_server_t*)dfs_cycle->sconf)->max_tqueue_len;
     mc->count = 0;
+    mc->inflight = 0;
+    mc->max_inflight = thread->type == THREAD_CLI 
+		? ((conf_server_t*)dfs_cycle->sconf)->cli_conn_inflight : 0;
     mc->connection = c;
     mc->slow = 0;
 	
     snprintf(mc->ipaddr, sizeof(mc->ipaddr), "%s", c->addr_text.data);
 	
-    queue_init(&mc->free_task);
-	
-    buff = (wb_node_t *)pool_alloc(mc->mempool, mc->max_task * sizeof(wb_node_t));
-    if (!buff) 
-	{
-        goto error;
-    }
-	
-    for (i = 0; i < mc->max_task; i++) 
-	{
-        node = buff + i;
-        node->qnode.tk.opq = &node->wbt;
-		node->qnode.tk.data = NULL;
-        (node->wbt).mc = mc;
-
-		if (THREAD_DN == thread->type)
-		{
-			(node->wbt).thread = dn_thread;
-		} 
-		else if (THREAD_CLI == thread->type)
-		{
-			(node->wbt).thread = cli_thread;
-		}
-		
-        queue_insert_head(&mc->free_task, &node->qnode.qe);
-    }
-	
     memset(&mc->ev_timer, 0, sizeof(event_t));
     mc->ev_timer.data = mc;
     mc->ev_timer.handler = nn_conn_timer_handler;
@@ -147,6 +129,9 @@ void nn_conn_init(conn_t *c)
     wev->handler = nn_event_process_handler;
 	
     queue_init(&mc->out_task);
+    queue_init(&mc->sending);
+    mc->out_chain = NULL;
+    mc->out_n = 0;
 	
     mc->read_event_handler = nn_conn_read_handler;
 	
@@ -277,6 +262,13 @@ static int nn_conn_decode(nn_conn_t *mc)
         rc = task_decode(mc->in, &node->tk);
         if (rc == DFS_OK) 
 		{
+            if (nn_conn_admit(mc) != DFS_OK) 
+			{
+                nn_conn_reject(mc, node);
+				
+                continue;
+            }
+			
             dispatch_task(node);
 
             node = NULL;
@@ -304,6 +296,62 @@ static int nn_conn_decode(nn_conn_t *mc)
 	return DFS_OK;
 }
 
+// only client conns are limited, datanode traffic is always admitted
+static int nn_conn_admit(nn_conn_t *mc)
+{
+    conf_server_t *sconf = NULL;
+	
+    if (!mc->max_inflight) 
+	{
+        return DFS_OK;
+    }
+
+    if (mc->inflight >= mc->max_inflight) 
+	{
+        return DFS_BUSY;
+    }
+
+    sconf = (conf_server_t *)dfs_cycle->sconf;
+	
+    if (__sync_add_and_fetch(&nn_inflight, 1) > (int32_t)sconf->max_inflight) 
+	{
+        __sync_sub_and_fetch(&nn_inflight, 1);
+		
+        return DFS_BUSY;
+    }
+
+    mc->inflight++;
+
+    return DFS_OK;
+}
+
+// answered on the io thread once decoding is done, the task threads 
+// never see it
+static void nn_conn_reject(nn_conn_t *mc, task_queue_node_t *node)
+{
+    task_t       *t = NULL;
+    retry_info_t *ri = NULL;
+
+    t = &node->tk;
+    t->ret = RETRY_LATER;
+    t->data = NULL;
+    t->data_len = 0;
+
+    ri = (retry_info_t *)malloc(sizeof(retry_info_t));
+    if (ri) 
+	{
+        ri->retry_after = ((conf_server_t *)dfs_cycle->sconf)->retry_after;
+        t->data = ri;
+        t->data_len = sizeof(retry_info_t);
+    }
+
+    dfs_log_error(mc->log, DFS_LOG_DEBUG, 0, 
+		"%s busy, inflight %d, cmd %d rejected", 
+		mc->ipaddr, mc->inflight, t->cmd);
+
+    queue_insert_tail(&mc->out_task, &node->qe);
+}
+
 static void nn_conn_read_handler(nn_conn_t *mc)
 {
 	int   rc = 0;
@@ -339,6 +387,12 @@ static void nn_conn_read_handler(nn_conn_t *mc)
 	
     	goto error;
     }
+
+    // flush rejections
+    if (!queue_empty(&mc->out_task)) 
+	{
+        nn_conn_output(mc);
+    }
 	
    	return;
 	
@@ -396,39 +450,27 @@ int nn_conn_is_connected(nn_conn_t *mc)
     return mc->state == ST_CONNCECTED;
 }
 
-static int nn_conn_out_buffer(conn_t *c, buffer_t *b)
-{
-    size_t size = 0;
-    int    rc = 0;
-    
-    if (!c->write->ready) 
-	{
-        return DFS_AGAIN;
-    }
-  
-    size = buffer_size(b);
-	
-    while (size) 
-	{      
-        rc = c->send(c, b->pos, size);
-        if (rc < 0) 
-		{
-            return rc;
-        }
-        
-        b->pos += rc,
-        size -= rc;
-    }
-	
-	buffer_reset(b);
-    
-    return DFS_OK;
-}
-
 int nn_conn_outtask(nn_conn_t *mc, task_t *t)
 {   
     task_queue_node_t *node =NULL;
 	node = queue_data(t, task_queue_node_t, tk);   
+
+	// still counts as in flight until the master's reply is relayed
+	if (((nn_wb_t *)t->opq)->fwd_ip[0]) 
+	{
+        if (mc->state == ST_CONNCECTED && nn_forward_task(mc, t) == DFS_OK) 
+		{
+            return DFS_OK;
+        }
+
+        ((nn_wb_t *)t->opq)->fwd_ip[0] = '\0';
+	}
+
+	if (mc->max_inflight) 
+	{
+        mc->inflight--;
+        __sync_sub_and_fetch(&nn_inflight, 1);
+	}
 	
 	if (mc->state != ST_CONNCECTED) 
 	{
@@ -444,93 +486,189 @@ int nn_conn_outtask(nn_conn_t *mc, task_t *t)
 
 int nn_conn_output(nn_conn_t *mc)
 {
-    conn_t            *c = NULL;
-    int                rc =0;
-	task_t            *t = NULL;
-	task_queue_node_t *node = NULL;
-	queue_t           *qe = NULL;
-	char              *err_msg = NULL;              
+    conn_t  *c = NULL;
+    chain_t *cl = NULL;
     
     c = mc->connection;
     
-    if (!c->write->ready && buffer_size(mc->out) > 0 ) 
+    if (!c->write->ready && mc->out_chain) 
 	{
         return DFS_AGAIN;
     }
     
     mc->write_event_handler = nn_conn_write_handler;
     
-repack:
-	buffer_shrink(mc->out);
+    for ( ;; ) 
+	{
+        if (!mc->out_chain) 
+		{
+            nn_conn_free_sent(mc);
+			
+            if (nn_conn_pack(mc) != DFS_OK) 
+			{
+                return DFS_OK;
+            }
+        }
+
+        cl = c->send_chain(c, mc->out_chain, 0);
+        if (cl == DFS_CHAIN_ERROR) 
+		{
+            dfs_log_error(c->log, DFS_LOG_FATAL, 0, 
+				"send data error  close conn");
+            nn_conn_finalize(mc);
+	
+	        return DFS_ERROR;
+        }
+
+        mc->out_chain = cl;
+		
+        if (cl) 
+		{
+            if (event_handle_write(c->ev_base, c->write, 0) == DFS_ERROR) 
+		    {
+                dfs_log_error(mc->log, DFS_LOG_FATAL, 0, "event_handle_write");
+			
+        	    return DFS_ERROR;
+            }
+		
+            event_timer_add(c->ev_timer, c->write, CONN_TIME_OUT);
+		
+            return DFS_AGAIN; 
+        }
+    }
+    
+	return DFS_OK;
+}
+
+// small replies are copied into mc->out, payloads of NN_OUT_ZC_SIZE or 
+// more are linked into the chain as they are and freed once sent
+static int nn_conn_pack(nn_conn_t *mc)
+{
+    int                rc = 0;
+    int                zc = 0;
+	task_t            *t = NULL;
+	task_queue_node_t *node = NULL;
+	queue_t           *qe = NULL;
+    chain_t           *tail = NULL;
+    buffer_t          *seg = NULL;
+
+    buffer_reset(mc->out);
+    mc->out_n = 0;
+    mc->out_chain = NULL;
 	
 	while (!queue_empty(&mc->out_task)) 
 	{
     	qe = queue_head(&mc->out_task);
 		node = queue_data(qe, task_queue_node_t, qe);
-		t =&node->tk;
+		t = &node->tk;
+		zc = t->data && t->data_len >= NN_OUT_ZC_SIZE;
+
+        if (mc->out_n + (seg ? 0 : 1) + zc > NN_OUT_CHAIN_N) 
+		{
+            break;
+        }
+
+        if (!seg) 
+		{
+            seg = nn_conn_out_link(mc, &tail, mc->out->last, mc->out->last);
+        }
 		
-		rc = task_encode(t, mc->out);
-		if (rc == DFS_OK) 
+		rc = zc ? task_encode_hdr(t, mc->out) : task_encode(t, mc->out);
+		if (rc == DFS_AGAIN && mc->out_chain == tail && !buffer_size(seg)) 
 		{
-			queue_remove(qe);
-			nn_conn_free_task(mc, qe);
+            // larger than an empty out buffer, it can never be sent
+            dfs_log_error(mc->log, DFS_LOG_ERROR, 0, 
+				"reply of %d bytes dropped", t->data_len);
 			
-			continue;
+            rc = DFS_ERROR;
 		}
 
 		if (rc == DFS_AGAIN) 
 		{
-			goto send;
+			break;
 		}
 		
-		if (rc == DFS_ERROR) 
+		queue_remove(qe);
+		
+		if (rc != DFS_OK) 
 		{
-            queue_remove(qe);
 			nn_conn_free_task(mc, qe);
+			
+			continue;
+        }
+
+        seg->last = mc->out->last;
+		queue_insert_tail(&mc->sending, qe);
+
+        if (zc) 
+		{
+            nn_conn_out_link(mc, &tail, (uchar_t *)t->data, 
+				(uchar_t *)t->data + t->data_len);
+            seg = NULL;
         }
 	}
 
-send:
-    if(!buffer_size(mc->out)) 
+    if (!mc->out_chain || chain_size(mc->out_chain) == 0) 
 	{
-        return DFS_OK;
-    }
-    
-	rc = nn_conn_out_buffer(c, mc->out);
-    if (rc == DFS_ERROR) 
-	{
-        err_msg = (char *)"send data error  close conn";
+        mc->out_chain = NULL;
 		
-		goto close;
+        return DFS_AGAIN;
     }
-    
-    if (rc == DFS_AGAIN) 
+
+    return DFS_OK;
+}
+
+static buffer_t *nn_conn_out_link(nn_conn_t *mc, chain_t **tail, 
+	                                      uchar_t *pos, uchar_t *last)
+{
+    chain_t  *cl = NULL;
+    buffer_t *b = NULL;
+
+    cl = &mc->out_cl[mc->out_n];
+    b = &mc->out_buf[mc->out_n];
+    mc->out_n++;
+
+    memset(b, 0x00, sizeof(buffer_t));
+    b->start = b->pos = pos;
+    b->end = b->last = last;
+    b->memory = DFS_TRUE;
+    b->temporary = DFS_TRUE;
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    if (*tail) 
 	{
-        if (event_handle_write(c->ev_base, c->write, 0) == DFS_ERROR) 
-		{
-            dfs_log_error(mc->log, DFS_LOG_FATAL, 0, "event_handle_write");
-			
-        	return DFS_ERROR;
-        }
-		
-        event_timer_add(c->ev_timer, c->write, CONN_TIME_OUT);
-		
-        return DFS_AGAIN; 
+        (*tail)->next = cl;
+    } 
+	else 
+	{
+        mc->out_chain = cl;
     }
-    
-    goto repack;
-    
-close:
-	dfs_log_error(c->log, DFS_LOG_FATAL, 0, err_msg);
-    nn_conn_finalize(mc);
+
+    *tail = cl;
+
+    return b;
+}
+
+static void nn_conn_free_sent(nn_conn_t *mc)
+{
+    queue_t *qn = NULL;
 	
-	return DFS_ERROR;
+    while (!queue_empty(&mc->sending)) 
+	{
+        qn = queue_head(&mc->sending);
+        queue_remove(qn);
+        nn_conn_free_task(mc, qn);
+    }
 }
 
+// task nodes come from a slab cached on the io thread, max_task only 
+// bounds how many of them one connection may hold at a time
 void * nn_conn_get_task(nn_conn_t *mc)
 {
-    queue_t           *queue = NULL; 
-    task_queue_node_t *node = NULL;
+    dfs_thread_t *thread = NULL;
+    wb_node_t    *node = NULL;
 	
 	if (mc->count >= mc->max_task)
 	{
@@ -539,13 +677,26 @@ void * nn_conn_get_task(nn_conn_t *mc)
 		
 		return NULL;
 	}
+
+    thread = get_local_thread();
 	
-    queue = queue_head(&mc->free_task);
-    node = queue_data(queue, task_queue_node_t, qe);
-    queue_remove(queue);
+    node = nn_task_node_get(thread);
+    if (!node) 
+	{
+        dfs_log_error(mc->log, DFS_LOG_ALERT, 0, "task node alloc failed");
+		
+        return NULL;
+    }
+
+    memset(&node->qnode.tk, 0x00, sizeof(task_t));
+    node->qnode.tk.opq = &node->wbt;
+    (node->wbt).mc = mc;
+    (node->wbt).fwd_ip[0] = '\0';
+	// replies go back to the io thread that owns the connection
+	(node->wbt).thread = thread;
     mc->count++;
 	
-    return node;  
+    return &node->qnode;  
 }
 
 void nn_conn_free_task(nn_conn_t *mc, queue_t *q)
@@ -560,8 +711,7 @@ void nn_conn_free_task(nn_conn_t *mc, queue_t *q)
 	   task->data = NULL;
    }
    
-   queue_init(q);
-   queue_insert_tail(&mc->free_task, q);
+   nn_task_node_put(get_local_thread(), (wb_node_t *)node);
    
    if (mc->state == ST_DISCONNCECTED && mc->count == 0) 
    {
@@ -569,6 +719,39 @@ void nn_conn_free_task(nn_conn_t *mc, queue_t *q)
    }
 }
 
+static wb_node_t *nn_task_node_get(dfs_thread_t *thread)
+{
+    wb_node_t *buff = NULL;
+    queue_t   *q = NULL;
+    int        i = 0;
+
+    if (queue_empty(&thread->task_free)) 
+	{
+        buff = (wb_node_t *)memory_calloc(NN_TASK_SLAB_SIZE * sizeof(wb_node_t));
+        if (!buff) 
+		{
+            return NULL;
+        }
+
+        for (i = 0; i < NN_TASK_SLAB_SIZE; i++) 
+		{
+            queue_insert_tail(&thread->task_free, &buff[i].qnode.qe);
+        }
+    }
+
+    q = queue_head(&thread->task_free);
+    queue_remove(q);
+    queue_init(q);
+
+    return (wb_node_t *)queue_data(q, task_queue_node_t, qe);
+}
+
+static void nn_task_node_put(dfs_thread_t *thread, wb_node_t *node)
+{
+	// lifo keeps the hot nodes in cache
+    queue_insert_head(&thread->task_free, &node->qnode.qe);
+}
+
 static void nn_conn_free_queue(nn_conn_t *mc)
 {
     queue_t *qn = NULL;
@@ -579,6 +762,9 @@ static void nn_conn_free_queue(nn_conn_t *mc)
         queue_remove(qn);
         nn_conn_free_task(mc, qn);
     }
+
+    mc->out_chain = NULL;
+    nn_conn_free_sent(mc);
 }
 
 int nn_conn_update_state(nn_conn_t *mc, int state)
@@ -4,9 +4,12 @@
 #include "dfs_types.h"
 #include "dfs_conn.h"
 #include "dfs_buffer.h"
+#include "dfs_chain.h"
 #include "dfs_queue.h"
 #include "dfs_task.h"
 
+#define NN_OUT_CHAIN_N 16
+
 typedef struct nn_conn_s nn_conn_t;
 typedef void (*nn_event_handler_pt)(nn_conn_t *);
 
@@ -22,14 +25,20 @@ struct nn_conn_s
     buffer_t            *in;
     buffer_t            *out;
     queue_t              out_task;
+    queue_t              sending;      // tasks referenced by out_chain
+    chain_t             *out_chain;    // unsent part of the packed replies
+    int32_t              out_n;
+    chain_t              out_cl[NN_OUT_CHAIN_N];
+    buffer_t             out_buf[NN_OUT_CHAIN_N];
     nn_event_handler_pt  read_event_handler;
     nn_event_handler_pt  write_event_handler;
     int32_t              count;
     int32_t              slow;
-    queue_t              free_task;
     pool_t              *mempool;
     event_t              ev_timer;
     int32_t              max_task;
+    int32_t              inflight;     // dispatched, reply not back yet
+    int32_t              max_inflight; // 0 for datanode conns
     int32_t              state;
     char                 ipaddr[32];
     log_t               *log;
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+
+#include "nn_retry_cache.h"
+#include "nn_time.h"
+
+static int rc_key_cmp(const void *arg1, const void *arg2, size_t size);
+static void rc_expire(retry_cache_t *rc, rb_msec_t now);
+static void rc_entry_del(retry_cache_t *rc, rc_entry_t *e);
+static void rc_entry_free(void *data);
+static void rc_key_set(rc_key_t *key, task_t *task);
+
+int retry_cache_init(retry_cache_t *rc, uint32_t max, rb_msec_t ttl)
+{
+    rc->entries = dfs_hashtable_create(rc_key_cmp, RETRY_CACHE_HASH_SIZE,
+		dfs_hashtable_hash_key8, NULL);
+	if (!rc->entries)
+	{
+        return DFS_ERROR;
+	}
+
+	queue_init(&rc->order);
+	rc->count = 0;
+	rc->max = max;
+	rc->ttl = ttl;
+	rc->hits = 0;
+
+	return DFS_OK;
+}
+
+void retry_cache_release(retry_cache_t *rc)
+{
+    if (!rc->entries)
+	{
+        return;
+	}
+
+	dfs_hashtable_free_items(rc->entries, rc_entry_free, NULL);
+	dfs_hashtable_free_memory(rc->entries);
+	rc->entries = NULL;
+}
+
+// DFS_OK when task is a retry of a call already answered, task then
+// carries that answer. data is a copy the caller owns
+int retry_cache_get(retry_cache_t *rc, task_t *task)
+{
+    rc_key_t    key;
+	rc_entry_t *e = NULL;
+	void       *data = NULL;
+
+	if (!rc->entries || !task->client_id)
+	{
+        return DFS_ERROR;
+	}
+
+	rc_expire(rc, time_curtime());
+
+	rc_key_set(&key, task);
+
+	e = (rc_entry_t *)dfs_hashtable_lookup(rc->entries, &key, sizeof(key));
+	if (!e || e->cmd != task->cmd)
+	{
+        return DFS_ERROR;
+	}
+
+	if (e->data_len > 0)
+	{
+	    data = malloc(e->data_len);
+		if (!data)
+		{
+            return DFS_ERROR;
+		}
+
+		memcpy(data, e->data, e->data_len);
+	}
+
+	task->data = data;
+	task->data_len = e->data_len;
+
+	task->ret = e->ret;
+	rc->hits++;
+
+	return DFS_OK;
+}
+
+void retry_cache_put(retry_cache_t *rc, task_t *task)
+{
+    int         data_len = 0;
+    rb_msec_t   now = 0;
+    rc_key_t    key;
+	rc_entry_t *e = NULL;
+
+	if (!rc->entries || !task->client_id)
+	{
+        return;
+	}
+
+	now = time_curtime();
+	rc_expire(rc, now);
+
+	rc_key_set(&key, task);
+
+	// a call is answered once, a replayed one never gets here
+	if (dfs_hashtable_lookup(rc->entries, &key, sizeof(rc_key_t)))
+	{
+        return;
+	}
+
+	data_len = task->data ? task->data_len : 0;
+
+	e = (rc_entry_t *)malloc(sizeof(rc_entry_t) + data_len);
+	if (!e)
+	{
+        return;
+	}
+
+	memset(e, 0x00, sizeof(rc_entry_t));
+	e->key = key;
+	e->ln.key = &e->key;
+	e->ln.len = sizeof(rc_key_t);
+	e->expire = now + rc->ttl;
+	e->cmd = task->cmd;
+	e->ret = task->ret;
+	e->data_len = data_len;
+
+	if (data_len > 0)
+	{
+        memcpy(e->data, task->data, data_len);
+	}
+
+	if (rc->count >= rc->max && !queue_empty(&rc->order))
+	{
+        rc_entry_del(rc, queue_data(queue_head(&rc->order), rc_entry_t, me));
+	}
+
+	dfs_hashtable_join(rc->entries, &e->ln);
+	queue_insert_tail(&rc->order, &e->me);
+	rc->count++;
+}
+
+// entries are kept in the order they were added, all with the same ttl
+static void rc_expire(retry_cache_t *rc, rb_msec_t now)
+{
+    rc_entry_t *e = NULL;
+
+	while (!queue_empty(&rc->order))
+	{
+	    e = queue_data(queue_head(&rc->order), rc_entry_t, me);
+		if (e->expire > now)
+		{
+            break;
+		}
+
+		rc_entry_del(rc, e);
+	}
+}
+
+static void rc_entry_del(retry_cache_t *rc, rc_entry_t *e)
+{
+    queue_remove(&e->me);
+	dfs_hashtable_remove_link(rc->entries, &e->ln);
+	rc->count--;
+
+	free(e);
+}
+
+static int rc_key_cmp(const void *arg1, const void *arg2, size_t size)
+{
+    return memcmp(arg1, arg2, sizeof(rc_key_t)) ? DFS_ERROR : DFS_OK;
+}
+
+static void rc_entry_free(void *data)
+{
+    free(data);
+}
+
+// a forwarded call keeps the client's seq in call_id, its own seq is the 
+// forwarding namenode's
+static void rc_key_set(rc_key_t *key, task_t *task)
+{
+    memset(key, 0x00, sizeof(rc_key_t));
+	key->client_id = task->client_id;
+	key->call_id = task->call_id ? task->call_id : task->seq;
+}
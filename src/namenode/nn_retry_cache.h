@@ -0,0 +1,48 @@
+#ifndef NN_RETRY_CACHE_H
+#define NN_RETRY_CACHE_H
+
+#include "dfs_types.h"
+#include "dfs_queue.h"
+#include "dfs_hashtable.h"
+#include "dfs_task.h"
+
+#define RETRY_CACHE_HASH_SIZE 65536
+
+typedef struct rc_key_s
+{
+    uint64_t client_id;
+    uint32_t call_id;
+    uint32_t pad;
+} rc_key_t;
+
+// the answer a completed mutation got, replayed to a retry of the call
+typedef struct rc_entry_s
+{
+    dfs_hashtable_link_t ln;
+    rc_key_t             key;
+    queue_t              me;       // on cache->order, oldest first
+    rb_msec_t            expire;
+    cmd_t                cmd;
+    int                  ret;
+    int                  data_len;
+    char                 data[0];
+} rc_entry_t;
+
+// only touched from the paxos thread
+typedef struct retry_cache_s
+{
+    dfs_hashtable_t *entries;
+    queue_t          order;
+    uint32_t         count;
+    uint32_t         max;
+    rb_msec_t        ttl;
+    uint64_t         hits;
+} retry_cache_t;
+
+int  retry_cache_init(retry_cache_t *rc, uint32_t max, rb_msec_t ttl);
+void retry_cache_release(retry_cache_t *rc);
+int  retry_cache_get(retry_cache_t *rc, task_t *task);
+void retry_cache_put(retry_cache_t *rc, task_t *task);
+
+#endif
+
@@ -83,6 +83,10 @@ int nn_rpc_service_run(task_t *task)
 	case DN_BLK_REPORT:
 		nn_dn_blk_report(task);
 		break;
+
+	case DN_CMD_WAIT:
+		nn_dn_cmd_wait(task);
+		break;
 		
 	default:
 		dfs_log_error(dfs_cycle->error_log, DFS_LOG_ALERT, 0, 
@@ -6,6 +6,7 @@
 #include "dfs_queue.h"
 #include "nn_thread.h"
 #include "nn_rpc_server.h"
+#include "nn_worker_process.h"
 
 static void do_task(task_t *task)
 {
@@ -13,33 +14,112 @@ static void do_task(task_t *task)
 	nn_rpc_service_run(task);
 }
 
+static void fill_fair_queue(dfs_thread_t *thread)
+{
+	queue_t            q;
+	queue_t           *qe = NULL;
+	task_queue_node_t *tnode = NULL;
+
+	if (task_queue_empty(&thread->tq)) 
+	{
+	    return;
+	}
+
+	queue_init(&q);
+	pop_all(&thread->tq, &q);
+
+	while (!queue_empty(&q)) 
+	{
+	    qe = queue_head(&q);
+		queue_remove(qe);
+		tnode = queue_data(qe, task_queue_node_t, qe);
+
+		if (fair_queue_push(&thread->fq, tnode) != DFS_OK) 
+		{
+		    // no memory for a new user, run it rather than drop it
+		    __sync_fetch_and_sub(&thread->tq_depth, 1);
+			queue_init(&tnode->qe);
+			do_task(&tnode->tk);
+		}
+	}
+}
+
+// datanode tasks first, keyed ones in arrival order next, then the 
+// unkeyed ones of users in turn by weight
+static task_queue_node_t *pop_local_task(dfs_thread_t *thread)
+{
+	task_queue_node_t *tnode = NULL;
+
+	tnode = pop_task(&thread->pq);
+	if (!tnode) 
+	{
+	    tnode = pop_task(&thread->kq);
+	}
+
+	if (!tnode) 
+	{
+	    fill_fair_queue(thread);
+		
+	    tnode = fair_queue_pop(&thread->fq);
+	}
+
+	if (tnode) 
+	{
+	    __sync_fetch_and_sub(&thread->tq_depth, 1);
+	}
+
+	return tnode;
+}
+
+static task_queue_node_t *steal_task(dfs_thread_t *thread)
+{
+	task_queue_node_t *tnode = NULL;
+    dfs_thread_t      *victim = NULL;
+
+	victim = get_steal_task_thread(thread);
+	if (!victim) 
+	{
+	    return NULL;
+	}
+
+	// only unkeyed tasks can be stolen, the ones the victim has not 
+	// taken yet first
+	tnode = pop_task(&victim->tq);
+	if (!tnode) 
+	{
+	    tnode = fair_queue_steal(&victim->fq);
+	}
+
+	if (tnode) 
+	{
+	    __sync_fetch_and_sub(&victim->tq_depth, 1);
+	}
+
+	return tnode;
+}
+
 void do_task_handler(void *q)
 {
 	task_queue_node_t *tnode = NULL;
-	task_t            *t = NULL;
-	queue_t           *cur = NULL;
-	queue_t            qhead;
-	task_queue_t      *tq = NULL;
     dfs_thread_t      *thread = NULL;
 
-	tq = (task_queue_t *)q;
-    thread = get_local_thread();
+	thread = (dfs_thread_t *)q;
 	
-    queue_init(&qhead);
-	pop_all(tq, &qhead);
-	
-	cur = queue_head(&qhead);
-	
-	while (!queue_empty(&qhead) && thread->running)
+	while (thread->running)
 	{
-		tnode = queue_data(cur, task_queue_node_t, qe);
-		t = &tnode->tk;
-		
-        queue_remove(cur);
+		tnode = pop_local_task(thread);
+		if (!tnode) 
+		{
+		    tnode = steal_task(thread);
+		}
 
-        do_task(t);
+		if (!tnode) 
+		{
+		    break;
+		}
 		
-		cur = queue_head(&qhead);
+		queue_init(&tnode->qe);
+
+        do_task(&tnode->tk);
 	}
 }
-
@@ -4,6 +4,8 @@
 
 #include "nn_task_queue.h"
 
+static void task_queue_take(task_queue_t *tq);
+
 void queue_node_destory(task_queue_node_t *node, opq_free free_fn)
 {
 	assert(node != NULL);
@@ -56,6 +58,7 @@ int task_queue_init(task_queue_t* tq)
 	}
 
 	queue_init(&(tq->qh));
+	tq->head = NULL;
 	
 	return 0;
 }
@@ -78,6 +81,7 @@ task_queue_t *task_queue_create()
 	}
 
 	queue_init(&(tq->qh));
+	tq->head = NULL;
 	
 	return tq;
 }
@@ -88,14 +92,52 @@ void task_queue_destory(task_queue_t* q)
 	free(q);
 }
 
+// move everything pushed so far onto qh, oldest first
+static void task_queue_take(task_queue_t *tq)
+{
+	task_queue_node_t *tnode = NULL;
+	task_queue_node_t *prev = NULL;
+	task_queue_node_t *next = NULL;
+
+	if (!tq->head)
+	{
+		return;
+	}
+
+	tnode = __sync_lock_test_and_set(&tq->head, (task_queue_node_t *)NULL);
+
+	while (tnode)
+	{
+		next = tnode->next;
+		tnode->next = prev;
+		prev = tnode;
+		tnode = next;
+	}
+
+	for (tnode = prev; tnode; tnode = tnode->next)
+	{
+		queue_insert_tail(&tq->qh, &tnode->qe);
+	}
+}
+
 task_queue_node_t* pop_task(task_queue_t* queue)
 {
 	task_queue_node_t *tnode = NULL;
 	queue_t           *q = NULL;
 	
 	assert(queue);
+
+	if (!queue->head && queue_empty(&queue->qh))
+	{
+		return NULL;
+	}
 	
 	pthread_spin_lock(&queue->lock);
+
+	if (queue_empty(&queue->qh))
+	{
+		task_queue_take(queue);
+	}
 	
 	if (queue_empty(&queue->qh))
 	{
@@ -104,7 +146,7 @@ task_queue_node_t* pop_task(task_queue_t* queue)
 		return NULL;
 	}
 
-	q = queue_tail(&queue->qh);
+	q = queue_head(&queue->qh);
 	queue_remove(q);
 	
 	pthread_spin_unlock(&queue->lock);
@@ -116,7 +158,7 @@ task_queue_node_t* pop_task(task_queue_t* queue)
 
 void pop_all(task_queue_t* tq, queue_t* queue)
 {
-	pthread_spin_lock(&tq->lock);
+	task_queue_take(tq);
 	
 	if (!queue_empty(&tq->qh)) 
 	{
@@ -127,19 +169,23 @@ void pop_all(task_queue_t* tq, queue_t* queue)
         queue->prev->next = queue;
         queue_init(&tq->qh);
 	}
-	
-	pthread_spin_unlock(&tq->lock);
 }
 
 void push_task(task_queue_t*queue, task_queue_node_t* tnode)
 {
+	task_queue_node_t *head = NULL;
+	
 	assert(queue);
 	assert(tnode);
-	
-	pthread_spin_lock(&queue->lock);
-	
-	queue_insert_head(&queue->qh, &tnode->qe);
-	
-	pthread_spin_unlock(&queue->lock);
+
+	do
+	{
+		head = queue->head;
+		tnode->next = head;
+	} while (!__sync_bool_compare_and_swap(&queue->head, head, tnode));
 }
 
+int task_queue_empty(task_queue_t *tq)
+{
+	return !tq->head && queue_empty(&tq->qh);
+}
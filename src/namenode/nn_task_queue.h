@@ -6,18 +6,25 @@
 #include "dfs_queue.h"
 #include "dfs_task.h"
 
-typedef struct task_queue_node_s
+typedef struct task_queue_node_s task_queue_node_t;
+
+struct task_queue_node_s
 {
-	task_t  tk;
-	queue_t qe;
-} task_queue_node_t;
+	task_t             tk;
+	queue_t            qe;
+	task_queue_node_t *next;
+};
 
 typedef void (*opq_free)(void*);
 
+// producers push lock-free onto a LIFO list, consumers move it in FIFO 
+// order onto qh. pop_all is for a single consumer, pop_task may be 
+// called by several (work stealing) and is serialised by lock
 typedef struct
 {
-	queue_t            qh;
-	pthread_spinlock_t lock;
+	task_queue_node_t * volatile head;
+	queue_t                      qh;
+	pthread_spinlock_t           lock;
 } task_queue_t;
 
 task_queue_node_t * queue_node_create();
@@ -30,6 +37,7 @@ void task_queue_destory(task_queue_t* q);
 task_queue_node_t* pop_task(task_queue_t* queue);
 void pop_all(task_queue_t*sq, queue_t* queue);
 void push_task(task_queue_t*sq, task_queue_node_t* tnode);
+int task_queue_empty(task_queue_t *tq);
 
 #endif
 
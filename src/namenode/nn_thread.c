@@ -6,6 +6,8 @@
 extern _xvolatile rb_msec_t dfs_current_msec;
 static pthread_key_t dfs_thread_key;
 
+static int thread_task_pending(dfs_thread_t *thread);
+
 void thread_env_init()
 {
     pthread_key_create(&dfs_thread_key, NULL);
@@ -88,11 +90,33 @@ int thread_event_init(dfs_thread_t *thread)
     return DFS_OK;
 }
 
+static int thread_task_pending(dfs_thread_t *thread)
+{
+    int i = 0;
+
+    if (!task_queue_empty(&thread->tq) || !task_queue_empty(&thread->kq)
+		|| !task_queue_empty(&thread->pq) || thread->fq.count) 
+	{
+        return DFS_TRUE;
+    }
+
+    for (i = 0; thread->bque && i < thread->queue_size; i++) 
+	{
+        if (!task_queue_empty(&thread->bque[i])) 
+		{
+            return DFS_TRUE;
+        }
+    }
+
+    return DFS_FALSE;
+}
+
 void thread_event_process(dfs_thread_t *thread)
 {
     uint32_t      flags = 0;
     rb_msec_t     timer = 0;
     rb_msec_t     delta = 0;
+    int           pending = DFS_FALSE;
     event_base_t *ev_base;
     
     ev_base = &thread->event_base;
@@ -108,11 +132,30 @@ void thread_event_process(dfs_thread_t *thread)
 	{
         timer = 10;
     }
+
+    if (thread->tq_notice.call_back) 
+	{
+        notice_park(&thread->tq_notice);
+
+        pending = thread_task_pending(thread);
+        if (pending) 
+	    {
+            notice_unpark(&thread->tq_notice);
+            timer = 0;
+        }
+    }
     
     delta = dfs_current_msec;
 
     (void) event_process_events(ev_base, timer, flags);
 
+    notice_unpark(&thread->tq_notice);
+
+    if (pending) 
+	{
+        thread->tq_notice.call_back(thread->tq_notice.data);
+    }
+
     if ((THREAD_DN == thread->type || THREAD_CLI == thread->type) 
 		&& !queue_empty(&ev_base->posted_accept_events)) 
     {
@@ -10,6 +10,7 @@
 #include "dfs_notice.h"
 #include "nn_cycle.h"
 #include "nn_task_queue.h"
+#include "nn_fair_queue.h"
 
 typedef void *(*TREAD_FUNC)(void *);
 typedef struct dfs_thread_s dfs_thread_t;
@@ -22,7 +23,13 @@ struct dfs_thread_s
     event_timer_t  event_timer;
     conn_pool_t    conn_pool;
     task_queue_t   tq;
+    task_queue_t   kq;         // keyed tasks, never stolen
+    task_queue_t   pq;         // keyed datanode tasks, served first
+    fair_queue_t   fq;         // tq tasks taken, served per user
+    int            tq_depth;   // tasks queued on tq + kq + pq + fq
     task_queue_t  *bque;
+    queue_t        task_free;  // io thread cache of request task nodes
+    queue_t        fwd_peers;  // io thread channels to group masters
     int            queue_size;
     notice_t       tq_notice;
     TREAD_FUNC     run_func;
@@ -13,6 +13,9 @@
 #include "nn_conf.h"
 #include "nn_process.h"
 #include "nn_paxos.h"
+#include "nn_replication.h"
+#include "nn_dn_index.h"
+#include "nn_balancer.h"
 
 #define WORKER_TITLE "namenode: worker process"
 
@@ -29,11 +32,16 @@ dfs_thread_t *last_task;
 int           task_num = 0;
 
 extern dfs_thread_t *main_thread;
-dfs_thread_t        *dn_thread;
-dfs_thread_t        *cli_thread;
+dfs_thread_t        *dn_threads;
+int                  dn_thread_num = 0;
+dfs_thread_t        *cli_threads;
+int                  cli_thread_num = 0;
 dfs_thread_t        *paxos_thread;
 
-static inline int hash_task_key(char* str, int len);
+static inline uint32_t hash_task_key(char* str, int len);
+static inline int task_is_ordered(task_t *t);
+static inline int task_is_urgent(task_t *t);
+static dfs_thread_t *get_idle_task_thread();
 static void  thread_registration_init();
 static void  threads_total_add(int n);
 static int   thread_setup(dfs_thread_t *thread, int type);
@@ -47,6 +55,8 @@ static void stop_task_thread(cycle_t *cycle);
 static int channel_add_event(int fd, int event,
     event_handler_pt handler, void *data);
 static void channel_handler(event_t *ev);
+static dfs_thread_t *create_io_thread(cycle_t *cycle, int n, int type, 
+    TREAD_FUNC func);
 static int create_dn_thread(cycle_t *cycle);
 static void stop_dn_thread();
 static void *thread_dn_cycle(void * args);
@@ -63,6 +73,10 @@ static int thread_setup(dfs_thread_t *thread, int type)
 	
     sconf = (conf_server_t *)dfs_cycle->sconf;
     task_queue_init(&thread->tq);
+    task_queue_init(&thread->kq);
+    task_queue_init(&thread->pq);
+    queue_init(&thread->task_free);
+    queue_init(&thread->fwd_peers);
     thread->event_base.nevents = sconf->connection_n;
     
     if (thread_event_init(thread) != DFS_OK) 
@@ -73,7 +87,7 @@ static int thread_setup(dfs_thread_t *thread, int type)
     thread->type = type;
     if (THREAD_TASK == thread->type) 
 	{
-        return DFS_OK;
+        return fair_queue_init(&thread->fq);
     }
 
     thread->event_base.time_update = time_update;
@@ -90,6 +104,7 @@ static void thread_task_exit(dfs_thread_t *thread)
 {
     thread->state = THREAD_ST_EXIT;
     dfs_module_wokerthread_release(thread);
+    fair_queue_release(&thread->fq);
 }
 
 static int process_worker_exit(cycle_t *cycle)
@@ -147,19 +162,66 @@ void register_thread_exit(void)
     pthread_mutex_unlock(&init_lock);
 }
 
+// mutations are pinned by key so that requests on the same path or from 
+// the same datanode reach the paxos thread in arrival order, everything 
+// else goes to the shallowest queue and may be stolen by an idle thread.
+// heartbeats and block reports take the keyed priority lane so a client 
+// backlog cannot push a datanode past dn_timeout
 void dispatch_task(void *data)
 {
     task_queue_node_t *node = NULL;
     task_t            *t = NULL;
-    uint32_t           index = 0;
+    dfs_thread_t      *th = NULL;
 
 	node = (task_queue_node_t *)data;
     t = &node->tk;
-		
-    index = hash_task_key(t->key, 16);
-    last_task = &task_threads[index % task_num];
-    push_task(&last_task->tq, (task_queue_node_t *)data);
-    notice_wake_up(&last_task->tq_notice);
+
+    if (task_is_urgent(t)) 
+	{
+        th = &task_threads[hash_task_key(t->key, KEY_LEN) % task_num];
+        __sync_fetch_and_add(&th->tq_depth, 1);
+        push_task(&th->pq, node);
+    } 
+    else if (task_is_ordered(t)) 
+	{
+        th = &task_threads[hash_task_key(t->key, KEY_LEN) % task_num];
+        __sync_fetch_and_add(&th->tq_depth, 1);
+        push_task(&th->kq, node);
+    } 
+	else 
+	{
+        th = get_idle_task_thread();
+        __sync_fetch_and_add(&th->tq_depth, 1);
+        push_task(&th->tq, node);
+    }
+
+    last_task = th;
+    notice_wake_up(&th->tq_notice);
+}
+
+dfs_thread_t *get_steal_task_thread(dfs_thread_t *me)
+{
+    int           i = 0;
+    int           depth = 0;
+    int           max = 1;
+    dfs_thread_t *victim = NULL;
+
+    for (i = 0; i < task_num; i++) 
+	{
+        if (&task_threads[i] == me) 
+		{
+            continue;
+        }
+
+        depth = task_threads[i].tq_depth;
+        if (depth > max) 
+		{
+            max = depth;
+            victim = &task_threads[i];
+        }
+    }
+
+    return victim;
 }
 
 void worker_processer(cycle_t *cycle, void *data)
@@ -415,7 +477,10 @@ int create_task_thread(cycle_t *cycle)
 
 static void * thread_task_cycle(void *arg)
 {
-    dfs_thread_t *me = (dfs_thread_t *)arg;
+    dfs_thread_t  *me = (dfs_thread_t *)arg;
+    conf_server_t *sconf = (conf_server_t *)dfs_cycle->sconf;
+    rb_msec_t      stat_ms = (rb_msec_t)sconf->fair_stat_interval * 1000;
+    rb_msec_t      tick_ms = stat_ms ? stat_ms : FQ_IDLE_TICK;
 
     thread_bind_key(me);
 
@@ -428,11 +493,26 @@ static void * thread_task_cycle(void *arg)
 
     register_thread_initialized();
    
-    notice_init(&me->event_base, &me->tq_notice, do_task_handler, &me->tq);
+    notice_init(&me->event_base, &me->tq_notice, do_task_handler, me);
 
     while (me->running) 
 	{
         thread_event_process(me);
+
+		// idle loops wake at least every 10ms, steal from busy peers
+		do_task_handler(me);
+
+		if (dfs_current_msec - me->fq.last_stat >= tick_ms) 
+		{
+            fair_queue_stat(&me->fq, stat_ms ? dfs_cycle->error_log : NULL);
+            me->fq.last_stat = dfs_current_msec;
+		}
+
+		nn_paxos_leader_run(dfs_current_msec);
+		repl_monitor_run(dfs_current_msec);
+		dn_liveness_run(dfs_current_msec);
+		dn_decommission_run(dfs_current_msec);
+		balancer_run(dfs_current_msec);
     }
 
 exit:
@@ -443,61 +523,93 @@ exit:
     return NULL;
 }
 
-static int create_dn_thread(cycle_t *cycle)
+static dfs_thread_t *create_io_thread(cycle_t *cycle, int n, int type, 
+	                                          TREAD_FUNC func)
 {
-    int i = 0; 
+    int           i = 0; 
+    int           j = 0; 
+    dfs_thread_t *threads = NULL;
+    dfs_thread_t *th = NULL;
 	
-    dn_thread = (dfs_thread_t *)pool_calloc(cycle->pool, sizeof(dfs_thread_t));
-    if (!dn_thread) 
+    threads = (dfs_thread_t *)pool_calloc(cycle->pool, 
+		n * sizeof(dfs_thread_t));
+    if (!threads) 
 	{
         dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "pool_calloc err");
 		
-        return DFS_ERROR;
+        return NULL;
     }
-    
-    if (thread_setup(dn_thread, THREAD_DN) != DFS_OK) 
+
+    for (i = 0; i < n; i++) 
 	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "thread_setup err");
+        th = &threads[i];
 		
-        return DFS_ERROR;
-    }
+        if (thread_setup(th, type) != DFS_OK) 
+	    {
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
+				"thread_setup err");
+		
+            return NULL;
+        }
 	
-    task_queue_init(&dn_thread->tq);
+        task_queue_init(&th->tq);
 	
-    dn_thread->queue_size = ((conf_server_t*)cycle->sconf)->worker_n;
+        th->queue_size = ((conf_server_t*)cycle->sconf)->worker_n;
 	
-    dn_thread->bque = (task_queue_t *)malloc(sizeof(task_queue_t) * dn_thread->queue_size);
-    if (!dn_thread->bque)
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "queue malloc fail");
-    }
+        th->bque = (task_queue_t *)malloc(sizeof(task_queue_t) 
+			* th->queue_size);
+        if (!th->bque)
+	    {
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
+				"queue malloc fail");
+			
+            return NULL;
+        }
 	
-    for (i = 0; i < dn_thread->queue_size; i++ )
-	{
-        task_queue_init(&dn_thread->bque[i]);
-    }
+        for (j = 0; j < th->queue_size; j++)
+	    {
+            task_queue_init(&th->bque[j]);
+        }
 	
-    dn_thread->run_func= thread_dn_cycle;
-    dn_thread->running = DFS_TRUE;
-    dn_thread->state = THREAD_ST_UNSTART;
+        th->run_func = func;
+        th->running = DFS_TRUE;
+        th->state = THREAD_ST_UNSTART;
 	
-    if (thread_create(dn_thread) != DFS_OK) 
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
-			"thread_create error");
+        if (thread_create(th) != DFS_OK) 
+	    {
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
+			    "thread_create error");
 		
-        return DFS_ERROR;
+            return NULL;
+        }
+	
+        threads_total_add(1);
     }
 	
-    threads_total_add(1);
     wait_for_thread_registration();
-	
-    if (dn_thread->state != THREAD_ST_OK) 
+
+    for (i = 0; i < n; i++) 
 	{
-        return DFS_ERROR;
+        if (threads[i].state != THREAD_ST_OK) 
+		{
+            dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0,
+                "create io thread[%d] type %d err", i, type);
+		   
+            return NULL;
+        }
     }
 	
-    return DFS_OK;
+    return threads;
+}
+
+static int create_dn_thread(cycle_t *cycle)
+{
+    dn_thread_num = ((conf_server_t*)cycle->sconf)->dn_io_thread_n;
+	
+    dn_threads = create_io_thread(cycle, dn_thread_num, THREAD_DN, 
+		thread_dn_cycle);
+	
+    return dn_threads ? DFS_OK : DFS_ERROR;
 }
 
 static void * thread_dn_cycle(void * args)
@@ -510,7 +622,8 @@ static void * thread_dn_cycle(void * args)
     
     notice_init(&me->event_base, &me->tq_notice, net_response_handler, me);
 
-    if (conn_listening_add_event(&me->event_base, listens) != DFS_OK) 
+    if (conn_listening_add_event_slice(&me->event_base, listens, 
+		me - dn_threads, dn_thread_num) != DFS_OK) 
 	{
         goto exit;
     }
@@ -535,59 +648,12 @@ exit:
 
 static int create_cli_thread(cycle_t *cycle)
 {
-    int i = 0; 
-	
-    cli_thread = (dfs_thread_t *)pool_calloc(cycle->pool, sizeof(dfs_thread_t));
-    if (!cli_thread) 
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "pool_calloc err");
-		
-        return DFS_ERROR;
-    }
-    
-    if (thread_setup(cli_thread, THREAD_CLI) != DFS_OK) 
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "thread_setup err");
-		
-        return DFS_ERROR;
-    }
-	
-    task_queue_init(&cli_thread->tq);
-	
-    cli_thread->queue_size = ((conf_server_t*)cycle->sconf)->worker_n;
-	
-    cli_thread->bque = (task_queue_t *)malloc(sizeof(task_queue_t) * cli_thread->queue_size);
-    if (!cli_thread->bque)
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, "queue malloc fail");
-    }
-	
-    for (i = 0; i < cli_thread->queue_size; i++ )
-	{
-        task_queue_init(&cli_thread->bque[i]);
-    }
+    cli_thread_num = ((conf_server_t*)cycle->sconf)->cli_io_thread_n;
 	
-    cli_thread->run_func= thread_cli_cycle;
-    cli_thread->running = DFS_TRUE;
-    cli_thread->state = THREAD_ST_UNSTART;
+    cli_threads = create_io_thread(cycle, cli_thread_num, THREAD_CLI, 
+		thread_cli_cycle);
 	
-    if (thread_create(cli_thread) != DFS_OK) 
-	{
-        dfs_log_error(cycle->error_log, DFS_LOG_FATAL, 0, 
-			"thread_create error");
-		
-        return DFS_ERROR;
-    }
-	
-    threads_total_add(1);
-    wait_for_thread_registration();
-	
-    if (cli_thread->state != THREAD_ST_OK) 
-	{
-        return DFS_ERROR;
-    }
-	
-    return DFS_OK;
+    return cli_threads ? DFS_OK : DFS_ERROR;
 }
 
 static void * thread_cli_cycle(void * args)
@@ -600,7 +666,8 @@ static void * thread_cli_cycle(void * args)
     
     notice_init(&me->event_base, &me->tq_notice, net_response_handler, me);
 
-    if (conn_listening_add_event(&me->event_base, listens) != DFS_OK) 
+    if (conn_listening_add_event_slice(&me->event_base, listens, 
+		me - cli_threads, cli_thread_num) != DFS_OK) 
 	{
         goto exit;
     }
@@ -759,12 +826,22 @@ static void channel_handler(event_t *ev)
 
 static void stop_cli_thread()
 {
-    cli_thread->running = DFS_FALSE;
+    int i = 0;
+	
+    for (i = 0; i < cli_thread_num; i++) 
+	{
+        cli_threads[i].running = DFS_FALSE;
+    }
 }
 
 static void stop_dn_thread()
 {
-    dn_thread->running = DFS_FALSE;
+    int i = 0;
+	
+    for (i = 0; i < dn_thread_num; i++) 
+	{
+        dn_threads[i].running = DFS_FALSE;
+    }
 }
 
 static void stop_task_thread(cycle_t *cycle)
@@ -791,9 +868,80 @@ static void threads_total_add(int n)
     total_threads += n;
 }
 
-static inline int hash_task_key(char* str, int len)
+static inline uint32_t hash_task_key(char* str, int len)
+{
+    uint32_t hash = 2166136261u;
+    int      i = 0;
+
+    for (i = 0; i < len && str[i]; i++) 
+	{
+        hash ^= (uchar_t)str[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static inline int task_is_ordered(task_t *t)
 {
-    (void) len;
-    return str[0];
+    switch (t->cmd) 
+	{
+    case NN_LS:
+    case NN_GET_FILE_INFO:
+    case NN_OPEN:
+        return DFS_FALSE;
+
+    default:
+        return DFS_TRUE;
+    }
+}
+
+static inline int task_is_urgent(task_t *t)
+{
+    switch (t->cmd) 
+	{
+    case DN_HEARTBEAT:
+    case DN_RECV_BLK_REPORT:
+    case DN_DEL_BLK_REPORT:
+    case DN_BLK_REPORT:
+    case DN_CMD_WAIT:
+        return DFS_TRUE;
+
+    default:
+        return DFS_FALSE;
+    }
+}
+
+static dfs_thread_t *get_idle_task_thread()
+{
+    static uint32_t  cursor = 0;
+    uint32_t         start = 0;
+    int              i = 0;
+    int              depth = 0;
+    int              min = 0;
+    dfs_thread_t    *th = NULL;
+    dfs_thread_t    *idle = NULL;
+
+    // rotate the scan start so ties do not all land on thread 0
+    start = __sync_fetch_and_add(&cursor, 1);
+
+    for (i = 0; i < task_num; i++) 
+	{
+        th = &task_threads[(start + i) % task_num];
+        depth = th->tq_depth;
+		
+        if (!idle || depth < min) 
+		{
+            min = depth;
+            idle = th;
+			
+            if (!depth) 
+			{
+                break;
+            }
+        }
+    }
+
+    return idle;
 }
 
@@ -2,10 +2,12 @@
 #define NN_WORKER_PROCESSS_H
 
 #include "nn_cycle.h"
+#include "nn_thread.h"
 
 void worker_processer(cycle_t *cycle, void *data);
 void register_thread_initialized(void);
 void dispatch_task(void *);
+dfs_thread_t *get_steal_task_thread(dfs_thread_t *me);
 void register_thread_exit(void);
 
 #endif
@@ -0,0 +1,85 @@
+#include "EditlogCodec.h"
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
+#include "dfs_types.h"
+
+using namespace google::protobuf::io;
+using google::protobuf::internal::WireFormatLite;
+
+int EditlogCodec::Encode(const uint32_t iOpType, const int iField, 
+    const google::protobuf::Message & oSub, string & sValue)
+{
+    int iSubLen = oSub.ByteSize();
+
+    sValue.clear();
+
+    {
+        StringOutputStream oStream(&sValue);
+        CodedOutputStream oOut(&oStream);
+
+        oOut.WriteTag(WireFormatLite::MakeTag(1, 
+            WireFormatLite::WIRETYPE_VARINT));
+        oOut.WriteVarint32(iOpType);
+        oOut.WriteTag(WireFormatLite::MakeTag(iField, 
+            WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+        oOut.WriteVarint32(iSubLen);
+        oSub.SerializeWithCachedSizes(&oOut);
+
+        if (oOut.HadError())
+        {
+            return DFS_ERROR;
+        }
+    }
+
+    return DFS_OK;
+}
+
+int EditlogCodec::Decode(const string & sValue, uint32_t & iOpType, 
+    const char *& pcSub, int & iSubLen)
+{
+    CodedInputStream oIn((const uint8_t *)sValue.data(), sValue.size());
+    uint32_t iTag = 0;
+
+    iOpType = 0;
+    pcSub = NULL;
+    iSubLen = 0;
+
+    while ((iTag = oIn.ReadTag()) != 0)
+    {
+        if (WireFormatLite::GetTagFieldNumber(iTag) == 1 
+            && WireFormatLite::GetTagWireType(iTag) 
+            == WireFormatLite::WIRETYPE_VARINT)
+        {
+            if (!oIn.ReadVarint32(&iOpType))
+            {
+                return DFS_ERROR;
+            }
+        }
+        else if (WireFormatLite::GetTagWireType(iTag) 
+            == WireFormatLite::WIRETYPE_LENGTH_DELIMITED)
+        {
+            uint32_t iLen = 0;
+
+            if (!oIn.ReadVarint32(&iLen))
+            {
+                return DFS_ERROR;
+            }
+
+            pcSub = sValue.data() + oIn.CurrentPosition();
+            iSubLen = (int)iLen;
+
+            if (!oIn.Skip(iLen))
+            {
+                return DFS_ERROR;
+            }
+        }
+        else if (!WireFormatLite::SkipField(&oIn, iTag))
+        {
+            return DFS_ERROR;
+        }
+    }
+
+    return pcSub != NULL ? DFS_OK : DFS_ERROR;
+}
+
@@ -0,0 +1,25 @@
+#ifndef EDIT_LOG_CODEC_H_
+#define EDIT_LOG_CODEC_H_
+
+#include <stdint.h>
+#include <string>
+#include <google/protobuf/message.h>
+
+using namespace std;
+
+// LogOperator carries the optype plus exactly one sub-message, so the
+// envelope is written and read by hand and the sub-message is (de)coded
+// into objects the caller keeps per thread. The bytes are identical to
+// LogOperator::SerializeToString().
+class EditlogCodec
+{
+public:
+    static int Encode(const uint32_t iOpType, const int iField, 
+        const google::protobuf::Message & oSub, string & sValue);
+
+    static int Decode(const string & sValue, uint32_t & iOpType, 
+        const char *& pcSub, int & iSubLen);
+};
+
+#endif
+
@@ -4,7 +4,8 @@
 #include "nn_cycle.h"
 #include "nn_file_index.h"
 
-PhxEditlogSM::PhxEditlogSM() : m_llCheckpointInstanceID(NoCheckpoint)
+PhxEditlogSM::PhxEditlogSM(const int iGroupCount) 
+	: m_vecCheckpointInstanceID(iGroupCount, NoCheckpoint)
 {
 }
 
@@ -25,11 +26,12 @@ bool PhxEditlogSM::Execute(const int iGroupIdx, const uint64_t llInstanceID,
         poPhxEditlogSMCtx->iExecuteRet = DFS_OK;
         poPhxEditlogSMCtx->llInstanceID = llInstanceID;
 
-		update_fi_cache_mgmt(llInstanceID, sPaxosValue, poPhxEditlogSMCtx->data);
+		update_fi_cache_mgmt(iGroupIdx, llInstanceID, sPaxosValue, 
+			poPhxEditlogSMCtx->data);
     }
 	else 
 	{
-        update_fi_cache_mgmt(llInstanceID, sPaxosValue, NULL);
+        update_fi_cache_mgmt(iGroupIdx, llInstanceID, sPaxosValue, NULL);
 	}
 
     return DFS_TRUE;
@@ -42,13 +44,53 @@ const int PhxEditlogSM::SMID() const
 
 const uint64_t PhxEditlogSM::GetCheckpointInstanceID(const int iGroupIdx) const
 {
-    return m_llCheckpointInstanceID;
+    if (iGroupIdx < 0 || iGroupIdx >= (int)m_vecCheckpointInstanceID.size())
+    {
+        return NoCheckpoint;
+    }
+	
+    return m_vecCheckpointInstanceID[iGroupIdx];
 }
 
-int PhxEditlogSM::SyncCheckpointInstanceID(const uint64_t llInstanceID)
+int PhxEditlogSM::SyncCheckpointInstanceID(const int iGroupIdx, 
+	const uint64_t llInstanceID)
 {
-    m_llCheckpointInstanceID = llInstanceID;
+    if (iGroupIdx < 0 || iGroupIdx >= (int)m_vecCheckpointInstanceID.size())
+    {
+        return DFS_ERROR;
+    }
+	
+    m_vecCheckpointInstanceID[iGroupIdx] = llInstanceID;
 
     return DFS_OK;
 }
 
+int PhxEditlogSM::LockCheckpointState()
+{
+    return lock_checkpoint_state();
+}
+
+int PhxEditlogSM::GetCheckpointState(const int iGroupIdx, string & sDirPath, 
+    vector<string> & vecFileList)
+{
+    return get_checkpoint_state(sDirPath, vecFileList);
+}
+
+void PhxEditlogSM::UnLockCheckpointState()
+{
+    unlock_checkpoint_state();
+}
+
+int PhxEditlogSM::LoadCheckpointState(const int iGroupIdx, 
+	const string & sCheckpointTmpFileDirPath,
+    const vector<string> & vecFileList, 
+    const uint64_t llCheckpointInstanceID)
+{
+    dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, 
+        "[SM LoadCheckpointState] group: %d, instanceid: %lu, dir: %s", 
+        iGroupIdx, llCheckpointInstanceID, 
+        sCheckpointTmpFileDirPath.c_str());
+
+    return load_checkpoint_state(sCheckpointTmpFileDirPath, vecFileList);
+}
+
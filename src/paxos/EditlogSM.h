@@ -5,6 +5,7 @@
 #include "phxpaxos/options.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <vector>
 
 using namespace phxpaxos;
 using namespace std;
@@ -27,7 +28,7 @@ public:
 class PhxEditlogSM : public StateMachine
 {
 public:
-    PhxEditlogSM();
+    PhxEditlogSM(const int iGroupCount);
     ~PhxEditlogSM();
 
     bool Execute(const int iGroupIdx, const uint64_t llInstanceID, 
@@ -36,10 +37,20 @@ public:
     const int SMID() const;
 
     const uint64_t GetCheckpointInstanceID(const int iGroupIdx) const;
-    int SyncCheckpointInstanceID(const uint64_t llInstanceID);
+    int SyncCheckpointInstanceID(const int iGroupIdx, 
+		const uint64_t llInstanceID);
+
+    int LockCheckpointState();
+    int GetCheckpointState(const int iGroupIdx, string & sDirPath, 
+        vector<string> & vecFileList);
+    void UnLockCheckpointState();
+    int LoadCheckpointState(const int iGroupIdx, 
+		const string & sCheckpointTmpFileDirPath,
+        const vector<string> & vecFileList, 
+        const uint64_t llCheckpointInstanceID);
 
 private:
-    uint64_t m_llCheckpointInstanceID;
+    vector<uint64_t> m_vecCheckpointInstanceID;
 };
 
 #endif
@@ -11,9 +11,11 @@
 #include "nn_error_log.h"
 
 FSEditlog::FSEditlog(const NodeInfo & oMyNode, const NodeInfoList & vecNodeList, 
-    string & sPaxosLogPath, int iGroupCount) : m_oMyNode(oMyNode), 
-    m_vecNodeList(vecNodeList), m_sPaxosLogPath(sPaxosLogPath), 
-    m_iGroupCount(iGroupCount), m_poPaxosNode(nullptr)
+    string & sPaxosLogPath, int iGroupCount, uint64_t llHoldLogCount) 
+    : m_oMyNode(oMyNode), m_vecNodeList(vecNodeList), 
+    m_sPaxosLogPath(sPaxosLogPath), m_iGroupCount(iGroupCount), 
+    m_llHoldLogCount(llHoldLogCount), m_poPaxosNode(nullptr), 
+    m_oEditlogSM(iGroupCount)
 {
 }
 
@@ -25,9 +27,10 @@ FSEditlog::~FSEditlog()
     }
 }
 
-void FSEditlog::setCheckpointInstanceID(const uint64_t llInstanceID)
+void FSEditlog::setCheckpointInstanceID(const int iGroupIdx, 
+	const uint64_t llInstanceID)
 {
-    m_oEditlogSM.SyncCheckpointInstanceID(llInstanceID);
+    m_oEditlogSM.SyncCheckpointInstanceID(iGroupIdx, llInstanceID);
 }
 
 int FSEditlog::RunPaxos()
@@ -65,6 +68,11 @@ int FSEditlog::RunPaxos()
         return ret;
     }
 
+    // paxos log before the fsimage checkpoint can be truncated, 
+    // keep the newest ones so lagging nodes catch up without a snapshot
+    m_poPaxosNode->SetHoldPaxosLogCount(m_llHoldLogCount);
+    m_poPaxosNode->ContinuePaxosLogCleaner();
+
     dfs_log_error(dfs_cycle->error_log, DFS_LOG_INFO, 0, "run paxos ok...");
 	
     return DFS_OK;
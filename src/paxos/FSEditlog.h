@@ -13,10 +13,11 @@ class FSEditlog
 {
 public:
     FSEditlog(const NodeInfo & oMyNode, const NodeInfoList & vecNodeList, 
-        string & sPaxosLogPath, int iGroupCount);
+        string & sPaxosLogPath, int iGroupCount, uint64_t llHoldLogCount);
     ~FSEditlog();
 
-    void setCheckpointInstanceID(const uint64_t llInstanceID);
+    void setCheckpointInstanceID(const int iGroupIdx, 
+		const uint64_t llInstanceID);
 	
     int RunPaxos();
 
@@ -35,6 +36,7 @@ private:
     NodeInfoList m_vecNodeList;
     string m_sPaxosLogPath;
     int m_iGroupCount;
+    uint64_t m_llHoldLogCount;
 
     Node * m_poPaxosNode;
     PhxEditlogSM m_oEditlogSM;